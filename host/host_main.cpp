@@ -0,0 +1,326 @@
+// Runs main.cpp on a PC: the sketch is built as it is (like the Arduino IDE does, as one translation unit)
+// against the stand-ins in stubs/ and the simulated board in sim_hardware.cpp, and fed an IMU trace.
+// Simulated time only moves as the sketch runs, so a flight replays in a fraction of real time and
+// every run of the same trace gives the same output.
+//
+//   make -C host                                   build (DEFINES="-DICM_FIFO_MODE ..." for other configurations)
+//   host/build/host_sim --synthetic flight --csv out.csv
+//   host/build/host_sim --trace flight.csv --serial-out telemetry.bin
+//
+// flight.csv is what tools/decode_flight_log.py makes of a flight log dump. Prints a summary of the run
+// to stderr; with --max-error it also fails (exit 1) if the attitude strays further than that from the trace's.
+#include <chrono>
+#include <string>
+#include "../main.cpp"
+#include "sim_hardware.h"
+#include "trace.h"
+
+namespace Host {
+  /** @brief runner settings from the command line */
+  struct Options {
+    const char* trace_path = NULL;
+    const char* profile = "spin";
+    SyntheticSettings synthetic;
+    const char* save_trace_path = NULL;
+    const char* serial_out_path = NULL;
+    const char* serial_in_path = NULL;
+    const char* csv_path = NULL;
+    const char* flash_path = NULL;
+    const char* eeprom_path = NULL;
+    unsigned inject_divider = 0;    // send every Nth trace sample over serial instead of through the ICM, 0 for none
+    uint32_t loop_us = 10;          // what one loop() costs on top of the clock reads
+    unsigned bus_errors = 0;        // every Nth read of the ICM's data fails, 0 for none
+    float settle_s = 1.0f;          // the attitude error only counts after this, the estimators start from the raw reading
+    float max_error_deg = -1.0f;
+    float timeout_s = 60.0f;
+  };
+
+  /** @brief what the run did, for the summary */
+  namespace Run {
+    Options options;
+    FILE* serial_out = NULL;
+    FILE* csv = NULL;
+    unsigned long loops = 0;
+    long recorded_sample = -1;
+    unsigned long error_count = 0;
+    double error_sq_sum = 0.0;
+    double error_max = 0.0;
+    std::chrono::steady_clock::time_point wall_start;
+  }
+}
+
+#ifdef COMMAND_LINK
+/** @brief Queues a command frame (layout of TELEMETRY FRAMES in main.cpp) to come in at at_us */
+static void QueueCommand(uint8_t type, const void* payload, uint8_t len, uint64_t at_us)
+{
+  static uint8_t sequence = 0;
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  uint32_t timestamp = (uint32_t)at_us;
+  frame[0] = TELEMETRY_SYNC_0;
+  frame[1] = TELEMETRY_SYNC_1;
+  frame[2] = type;
+  frame[3] = len;
+  frame[4] = sequence++;
+  memcpy(frame + 5, &timestamp, sizeof(timestamp));
+  memcpy(frame + TELEMETRY_HEADER_SIZE, payload, len);
+  uint16_t crc = Crc16(frame + 2, TELEMETRY_HEADER_SIZE - 2 + len);
+  memcpy(frame + TELEMETRY_HEADER_SIZE + len, &crc, sizeof(crc));
+  Host::QueueSerialInput(frame, TELEMETRY_HEADER_SIZE + len + TELEMETRY_CRC_SIZE, at_us);
+}
+
+/** @brief Switches the sketch to injected samples and queues every divider th trace sample, then zeros what the ICM reads */
+static void QueueInjection(unsigned divider)
+{
+  uint8_t mode = COMMAND_MODE_INJECT;
+  QueueCommand(COMMAND_FRAME_MODE, &mode, sizeof(mode), 0);
+  for (size_t i = 0; i < Host::trace.samples.size(); i += divider) {
+    const Host::TraceSample& sample = Host::trace.samples[i];
+    int16_t payload[9];
+    memcpy(payload, sample.acc, sizeof(sample.acc));
+    memcpy(payload + 3, sample.gyr, sizeof(sample.gyr));
+    memcpy(payload + 6, sample.mag, sizeof(sample.mag));
+    QueueCommand(COMMAND_FRAME_IMU, payload, sizeof(payload), sample.t_us);
+  }
+  for (Host::TraceSample& sample : Host::trace.samples) {
+    memset(sample.acc, 0, sizeof(sample.acc));
+    memset(sample.gyr, 0, sizeof(sample.gyr));
+    memset(sample.mag, 0, sizeof(sample.mag));
+  }
+}
+#endif
+
+static void PrintUsage()
+{
+  fprintf(stderr,
+    "usage: host_sim [options]\n"
+    "  --trace FILE        replay a CSV trace (columns of tools/decode_flight_log.py)\n"
+    "  --synthetic NAME    make a trace instead: pad, spin (default) or flight\n"
+    "  --duration S        synthetic trace length (10)\n"
+    "  --rate HZ           synthetic sample rate (1000)\n"
+    "  --noise X           synthetic sensor noise scale (1, 0 for clean)\n"
+    "  --seed N            synthetic noise seed (1)\n"
+    "  --save-trace FILE   write the trace that is played back as CSV\n"
+    "  --serial-out FILE   write what the sketch sends over serial\n"
+    "  --serial-in FILE    bytes the sketch can read from serial\n"
+    "  --inject N          COMMAND_LINK builds: send every Nth sample of the trace as an IMU command and leave\n"
+    "                      the simulated ICM reading zeros, so the attitude only follows the trace through the link\n"
+    "  --csv FILE          attitude and canards at every sample, next to the trace attitude\n"
+    "  --flash FILE        log flash image, loaded if it exists and saved at the end\n"
+    "  --eeprom FILE       EEPROM image (calibration), loaded if it exists and saved at the end\n"
+    "  --loop-us N         simulated time one loop() takes besides the clock reads (10)\n"
+    "  --bus-errors N      every Nth read of the ICM's data fails, with junk in place of the data (0, none)\n"
+    "  --settle S          leave the first S seconds out of the attitude error (1)\n"
+    "  --max-error DEG     exit 1 if the attitude error exceeds DEG after settling\n"
+    "  --timeout S         stop a sketch still stuck S seconds after the trace ended (60)\n");
+}
+
+/** @return false if an option is unknown or misses its value */
+static bool ParseOptions(int argc, char** argv, Host::Options& options)
+{
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help" || i + 1 >= argc) {
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "--trace") options.trace_path = value;
+    else if (arg == "--synthetic") options.profile = value;
+    else if (arg == "--duration") options.synthetic.duration_s = (float)atof(value);
+    else if (arg == "--rate") options.synthetic.rate_hz = (float)atof(value);
+    else if (arg == "--noise") options.synthetic.noise = (float)atof(value);
+    else if (arg == "--seed") options.synthetic.seed = (uint32_t)strtoul(value, NULL, 0);
+    else if (arg == "--save-trace") options.save_trace_path = value;
+    else if (arg == "--serial-out") options.serial_out_path = value;
+    else if (arg == "--serial-in") options.serial_in_path = value;
+    else if (arg == "--inject") options.inject_divider = (unsigned)strtoul(value, NULL, 0);
+    else if (arg == "--csv") options.csv_path = value;
+    else if (arg == "--flash") options.flash_path = value;
+    else if (arg == "--eeprom") options.eeprom_path = value;
+    else if (arg == "--loop-us") options.loop_us = (uint32_t)strtoul(value, NULL, 0);
+    else if (arg == "--bus-errors") options.bus_errors = (unsigned)strtoul(value, NULL, 0);
+    else if (arg == "--settle") options.settle_s = (float)atof(value);
+    else if (arg == "--max-error") options.max_error_deg = (float)atof(value);
+    else if (arg == "--timeout") options.timeout_s = (float)atof(value);
+    else return false;
+  }
+  return true;
+}
+
+/** @return true once the sketch has an attitude of its own (it does not in the modes that only run setup or serve the log) */
+static bool Estimating()
+{
+#ifdef ICM_DMP_MODE
+  return Sensor::dmp_timestamp != 0;
+#else
+  return Sensor::sample_count > 0;
+#endif
+}
+
+/** @brief Compares the sketch's attitude with the newest trace sample's, once per sample */
+static void RecordSample()
+{
+  using namespace Host;
+  long newest = NewestSample();
+  if (newest < 0 || newest == Run::recorded_sample) {
+    return;
+  }
+  Run::recorded_sample = newest;
+  const TraceSample& sample = trace.samples[newest];
+
+  float q[4];
+  GetAttitude(q);
+  float dot = fabsf(q[0] * sample.q[0] + q[1] * sample.q[1] + q[2] * sample.q[2] + q[3] * sample.q[3]);
+  double error_deg = 2.0 * acos((dot > 1.0f)? 1.0 : dot) * RAD2DEG;
+  if (trace.has_attitude && Estimating() && sample.t_us >= Run::options.settle_s * 1e6f) {
+    Run::error_count++;
+    Run::error_sq_sum += error_deg * error_deg;
+    Run::error_max = (error_deg > Run::error_max)? error_deg : Run::error_max;
+  }
+
+  if (Run::csv != NULL) {
+    float canards[4];
+    GetCanardRotations(canards);
+    fprintf(Run::csv, "%lu,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.3f,%.5f,%.5f,%.5f,%.5f\n",
+            (unsigned long)sample.t_us, q[0], q[1], q[2], q[3], sample.q[0], sample.q[1], sample.q[2], sample.q[3],
+            trace.has_attitude? error_deg : 0.0, canards[0], canards[1], canards[2], canards[3]);
+  }
+}
+
+/** @brief Closes the outputs, saves the chips and prints the summary; @return the exit code */
+static int Finish()
+{
+  using namespace Host;
+  double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - Run::wall_start).count();
+  double sim_s = now_us / 1e6;
+  if (Run::serial_out != NULL) {
+    fclose(Run::serial_out);
+  }
+  if (Run::csv != NULL) {
+    fclose(Run::csv);
+  }
+  if (Run::options.flash_path != NULL && !SaveFlash(Run::options.flash_path)) {
+    fprintf(stderr, "host: cannot write %s\n", Run::options.flash_path);
+  }
+  if (Run::options.eeprom_path != NULL && !SaveEEPROM(Run::options.eeprom_path)) {
+    fprintf(stderr, "host: cannot write %s\n", Run::options.eeprom_path);
+  }
+
+  fprintf(stderr, "host: %.3f s simulated in %.3f s (%.0fx real time), %zu samples, %lu loop() calls, %lu serial bytes\n",
+          sim_s, wall_s, (wall_s > 0.0)? sim_s / wall_s : 0.0, trace.samples.size(), Run::loops, SerialBytesWritten());
+  fprintf(stderr, "host: sensor samples %lu, task overruns", Sensor::sample_count);
+  for (size_t i = 0; i < TASK_COUNT; i++) {
+    fprintf(stderr, " %lu", tasks[i].overruns);
+  }
+  fprintf(stderr, ", frames dropped %lu, fifo overflows %lu, read errors %lu, launched %s, phase %u, ICM read %lu us (max %lu)\n",
+          TxQueue::dropped, Sensor::fifo_overflows, Sensor::read_errors, Flight::launched? "yes" : "no", Flight::phase, Sensor::read_us, Sensor::max_read_us);
+#ifdef COMMAND_LINK
+  fprintf(stderr, "host: commands %lu (bad %lu), injected samples %lu, serial bytes lost %lu\n", Command::frames,
+          Command::bad_frames, Command::injected, SerialOverflows());
+#endif
+#ifdef TELEMETRY_DELTA
+  fprintf(stderr, "host: state frames %lu bytes, %lu as STATE_Q12 (%.2fx)\n", TelemetryDelta::sent_bytes,
+          TelemetryDelta::state_q12_bytes, TelemetryCompressionPercent() / 100.0);
+#endif
+
+  if (Run::error_count == 0) {
+    return 0;
+  }
+  double rms = sqrt(Run::error_sq_sum / Run::error_count);
+  fprintf(stderr, "host: attitude error after %.1f s: rms %.3f max %.3f deg over %lu samples\n",
+          Run::options.settle_s, rms, Run::error_max, Run::error_count);
+  if (Run::options.max_error_deg >= 0.0f && Run::error_max > Run::options.max_error_deg) {
+    fprintf(stderr, "host: FAIL, attitude error over %.3f deg\n", Run::options.max_error_deg);
+    return 1;
+  }
+  return 0;
+}
+
+static void FinishStuck()
+{
+  Finish();
+}
+
+int main(int argc, char** argv)
+{
+  using namespace Host;
+  Options& options = Run::options;
+  if (!ParseOptions(argc, argv, options)) {
+    PrintUsage();
+    return 2;
+  }
+
+  if (options.trace_path != NULL) {
+    if (!LoadTrace(options.trace_path, trace)) {
+      return 2;
+    }
+  } else if (!MakeSyntheticTrace(options.profile, options.synthetic, trace) || trace.samples.empty()) {
+    fprintf(stderr, "host: no synthetic trace '%s'\n", options.profile);
+    return 2;
+  }
+  if (options.save_trace_path != NULL && !SaveTrace(options.save_trace_path, trace)) {
+    fprintf(stderr, "host: cannot write %s\n", options.save_trace_path);
+    return 2;
+  }
+
+  if (options.serial_out_path != NULL && (Run::serial_out = fopen(options.serial_out_path, "wb")) == NULL) {
+    fprintf(stderr, "host: cannot write %s\n", options.serial_out_path);
+    return 2;
+  }
+  SetSerialOutput(Run::serial_out);
+  if (options.serial_in_path != NULL) {
+    FILE* f = fopen(options.serial_in_path, "rb");
+    if (f == NULL) {
+      fprintf(stderr, "host: cannot open %s\n", options.serial_in_path);
+      return 2;
+    }
+    std::vector<uint8_t> input;
+    int c;
+    while ((c = fgetc(f)) != EOF) {
+      input.push_back((uint8_t)c);
+    }
+    fclose(f);
+    QueueSerialInput(input.data(), input.size(), 0);
+  }
+  if (options.inject_divider > 0) {
+#ifdef COMMAND_LINK
+    QueueInjection(options.inject_divider);
+#else
+    fprintf(stderr, "host: --inject needs a COMMAND_LINK build\n");
+    return 2;
+#endif
+  }
+  if (options.csv_path != NULL) {
+    if ((Run::csv = fopen(options.csv_path, "w")) == NULL) {
+      fprintf(stderr, "host: cannot write %s\n", options.csv_path);
+      return 2;
+    }
+    fprintf(Run::csv, "t_us,q_w,q_x,q_y,q_z,trace_q_w,trace_q_x,trace_q_y,trace_q_z,error_deg,canard_1_rad,canard_2_rad,canard_3_rad,canard_4_rad\n");
+  }
+  if (options.flash_path != NULL) {
+    LoadFlash(options.flash_path);
+  }
+  if (options.eeprom_path != NULL) {
+    LoadEEPROM(options.eeprom_path);
+  }
+
+  bus_error_divider = options.bus_errors;
+  deadline_us = trace.samples.back().t_us + (uint64_t)(options.timeout_s * 1e6f);
+  on_stuck = FinishStuck;
+  Run::wall_start = std::chrono::steady_clock::now();
+
+  setup();
+#ifdef DUAL_CORE
+  setup1();
+#endif
+  while (!TraceDone()) {
+    loop();
+#ifdef DUAL_CORE
+    loop1(); // the second core, one pass after each pass of the first
+#endif
+    Run::loops++;
+    PollInterrupts();
+    Advance(options.loop_us);
+    RecordSample();
+  }
+  return Finish();
+}
@@ -0,0 +1,115 @@
+// Vector and quaternion helpers of the host build's models. Kept apart from main.cpp's own math on purpose,
+// so the models the sketch is checked against do not share its code
+#pragma once
+#include <math.h>
+#include <stdint.h>
+
+namespace Host {
+  const double PI_D = 3.14159265358979323846;
+  const float DEG2RAD_F = (float)(PI_D / 180.0);
+  const float RAD2DEG_F = (float)(180.0 / PI_D);
+
+  /** @brief q = a * b, quaternions (w, x, y, z) */
+  inline void QuatMultiply(const float a[4], const float b[4], float out[4])
+  {
+    float w = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+    float x = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+    float y = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+    float z = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+    out[0] = w; out[1] = x; out[2] = y; out[3] = z;
+  }
+
+  inline void QuatFromAxisAngle(float x, float y, float z, float angle, float q_ret[4])
+  {
+    float norm = sqrtf(x * x + y * y + z * z);
+    float s = (norm > 0.0f)? sinf(0.5f * angle) / norm : 0.0f;
+    q_ret[0] = cosf(0.5f * angle);
+    q_ret[1] = x * s;
+    q_ret[2] = y * s;
+    q_ret[3] = z * s;
+  }
+
+  inline void QuatNormalize(float q[4])
+  {
+    float norm = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int i = 0; i < 4; i++) {
+      q[i] /= norm;
+    }
+  }
+
+  /** @brief Turns q by a body rate held for dt, exact for a constant rate */
+  inline void QuatIntegrate(float q[4], const float body_rate[3], float dt)
+  {
+    float rate = sqrtf(body_rate[0] * body_rate[0] + body_rate[1] * body_rate[1] + body_rate[2] * body_rate[2]);
+    if (rate <= 0.0f) {
+      return;
+    }
+    float step[4], next[4];
+    QuatFromAxisAngle(body_rate[0], body_rate[1], body_rate[2], rate * dt, step);
+    QuatMultiply(q, step, next);
+    QuatNormalize(next);
+    for (int i = 0; i < 4; i++) {
+      q[i] = next[i];
+    }
+  }
+
+  /** @brief The rotation matrix of q, turns body vectors into world vectors */
+  inline void QuatToMatrix(const float q[4], float r[3][3])
+  {
+    float w = q[0], x = q[1], y = q[2], z = q[3];
+    r[0][0] = 1 - 2 * (y * y + z * z); r[0][1] = 2 * (x * y - w * z);     r[0][2] = 2 * (x * z + w * y);
+    r[1][0] = 2 * (x * y + w * z);     r[1][1] = 1 - 2 * (x * x + z * z); r[1][2] = 2 * (y * z - w * x);
+    r[2][0] = 2 * (x * z - w * y);     r[2][1] = 2 * (y * z + w * x);     r[2][2] = 1 - 2 * (x * x + y * y);
+  }
+
+  inline void BodyToWorld(const float q[4], const float v[3], float out[3])
+  {
+    float r[3][3];
+    QuatToMatrix(q, r);
+    for (int i = 0; i < 3; i++) {
+      out[i] = r[i][0] * v[0] + r[i][1] * v[1] + r[i][2] * v[2];
+    }
+  }
+
+  inline void WorldToBody(const float q[4], const float v[3], float out[3])
+  {
+    float r[3][3];
+    QuatToMatrix(q, r);
+    for (int i = 0; i < 3; i++) {
+      out[i] = r[0][i] * v[0] + r[1][i] * v[1] + r[2][i] * v[2];
+    }
+  }
+
+  inline void Cross(const float a[3], const float b[3], float out[3])
+  {
+    float x = a[1] * b[2] - a[2] * b[1];
+    float y = a[2] * b[0] - a[0] * b[2];
+    float z = a[0] * b[1] - a[1] * b[0];
+    out[0] = x; out[1] = y; out[2] = z;
+  }
+
+  /** @brief xorshift32 with Box-Muller on top, the same numbers for the same seed on every machine */
+  class Random {
+  public:
+    explicit Random(uint32_t seed) : state(seed? seed : 1) {}
+    /** @return Uniform in [0, 1) */
+    float Uniform() {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      return (state >> 8) * (1.0f / 16777216.0f);
+    }
+    /** @return Uniform in [low, high) */
+    float Uniform(float low, float high) { return low + (high - low) * Uniform(); }
+    /** @return Normal distributed, mean 0 and deviation 1 */
+    float Gaussian() {
+      float u = Uniform();
+      float v = Uniform();
+      return sqrtf(-2.0f * logf(u + 1e-12f)) * cosf(2.0f * (float)PI_D * v);
+    }
+  private:
+    uint32_t state;
+  };
+
+  inline float Norm3(const float v[3]) { return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]); }
+}
@@ -0,0 +1,224 @@
+// 6-DOF rocket model of the host build, see rocket_model.h
+#include <string.h>
+#include "rocket_model.h"
+
+static const float G = 9.80665f;
+static const float SEA_LEVEL_DENSITY = 1.225f; // kg/m^3
+static const float SCALE_HEIGHT = 8500.0f;     // m
+static const float MIN_AIRSPEED = 1.0f;        // m/s, under this the aerodynamics are left out
+
+Host::RocketModel::RocketModel(const RocketParams& params, const Dispersion& dispersion) : params(params), dispersion(dispersion)
+{
+  memset(&state, 0, sizeof(state));
+  // on the rail: turned to the rail azimuth, tilted off vertical by the rail tilt, rolled by the heading
+  float azimuth[4], tilt[4], roll[4], q[4];
+  QuatFromAxisAngle(0.0f, 0.0f, 1.0f, dispersion.rail_azimuth, azimuth);
+  QuatFromAxisAngle(0.0f, 1.0f, 0.0f, dispersion.rail_tilt - 0.5f * (float)PI_D, tilt);
+  QuatFromAxisAngle(1.0f, 0.0f, 0.0f, dispersion.heading, roll);
+  QuatMultiply(azimuth, tilt, q);
+  QuatMultiply(q, roll, state.q);
+  const float NOSE[3] = {1.0f, 0.0f, 0.0f};
+  BodyToWorld(state.q, NOSE, rail_direction);
+}
+
+float Host::RocketModel::Thrust(float time) const
+{
+  if (ignition_t < 0.0f || time < ignition_t || time - ignition_t >= params.burn_s) {
+    return 0.0f;
+  }
+  return params.thrust * dispersion.thrust_scale;
+}
+
+float Host::RocketModel::Mass(float time) const
+{
+  float burned = (ignition_t < 0.0f || time < ignition_t)? 0.0f : (time - ignition_t) / params.burn_s;
+  burned = (burned > 1.0f)? 1.0f : burned;
+  return params.dry_mass + params.propellant_mass * (1.0f - burned);
+}
+
+void Host::RocketModel::Wind(float time, float height, float wind_ret[3]) const
+{
+  float h = (height < 1.0f)? 1.0f : height;
+  float speed = dispersion.wind_speed * powf(h / 10.0f, 1.0f / 7.0f);
+  // two slow sines on top as gusts
+  speed *= 1.0f + dispersion.gust * 0.5f * (sinf(1.3f * time + dispersion.gust_phase[0]) + sinf(3.1f * time + dispersion.gust_phase[1]));
+  wind_ret[0] = speed * cosf(dispersion.wind_direction);
+  wind_ret[1] = speed * sinf(dispersion.wind_direction);
+  wind_ret[2] = 0.0f;
+}
+
+void Host::RocketModel::Derivatives(float time, const RocketState& s, RocketState& d, float accel_ret[3]) const
+{
+  const RocketParams& p = params;
+  float mass = Mass(time);
+  float thrust = Thrust(time);
+  float force[3] = {0.0f, 0.0f, 0.0f};  // body frame
+  float torque[3] = {0.0f, 0.0f, 0.0f}; // body frame, about the center of gravity
+
+  // the thrust is off the long axis by the misalignment and pushes at the nozzle
+  float thrust_body[3] = {
+    thrust * cosf(dispersion.thrust_misalignment),
+    thrust * sinf(dispersion.thrust_misalignment) * cosf(dispersion.thrust_misalignment_direction),
+    thrust * sinf(dispersion.thrust_misalignment) * sinf(dispersion.thrust_misalignment_direction)
+  };
+  for (int a = 0; a < 3; a++) {
+    force[a] += thrust_body[a];
+  }
+  torque[1] += p.nozzle_lever * thrust_body[2];
+  torque[2] -= p.nozzle_lever * thrust_body[1];
+
+  float wind[3], air_world[3], air[3];
+  Wind(time, s.position[2], wind);
+  for (int a = 0; a < 3; a++) {
+    air_world[a] = s.velocity[a] - wind[a];
+  }
+  WorldToBody(s.q, air_world, air);
+  float airspeed = Norm3(air);
+  if (airspeed > MIN_AIRSPEED) {
+    float density = SEA_LEVEL_DENSITY * expf(-s.position[2] / SCALE_HEIGHT);
+    float qbar = 0.5f * density * airspeed * airspeed;
+    float area = 0.25f * (float)PI_D * p.diameter * p.diameter;
+
+    // axial drag, and the normal force of the angle of attack at the center of pressure
+    force[0] -= qbar * area * p.drag_coeff * air[0] / airspeed;
+    float normal[2] = {
+      -qbar * area * p.normal_coeff_slope * air[1] / airspeed,
+      -qbar * area * p.normal_coeff_slope * air[2] / airspeed
+    };
+    force[1] += normal[0];
+    force[2] += normal[1];
+    torque[1] += p.static_margin * normal[1];
+    torque[2] -= p.static_margin * normal[0];
+
+    // damping of the fins against turning and rolling, and the roll the fin cant drives
+    float fin_lift = p.fin_count * p.fin_area * p.fin_lift_slope;
+    torque[0] -= 0.5f * density * airspeed * fin_lift * p.fin_radius * p.fin_radius * s.rate[0];
+    torque[0] += qbar * fin_lift * p.fin_radius * dispersion.fin_cant;
+    float turn_damping = 0.5f * density * airspeed * area * p.normal_coeff_slope * p.fin_lever * p.fin_lever;
+    torque[1] -= turn_damping * s.rate[1];
+    torque[2] -= turn_damping * s.rate[2];
+
+    // canard 1 (+y) pushes +z, 2 (+z) pushes -y, 3 (-y) pushes -z and 4 (-z) pushes +y for a positive rotation
+    float canard_force[4];
+    for (int i = 0; i < 4; i++) {
+      canard_force[i] = qbar * p.canard_area * p.canard_lift_slope * canards[i];
+    }
+    force[1] += canard_force[3] - canard_force[1];
+    force[2] += canard_force[0] - canard_force[2];
+    torque[0] += p.canard_radius * (canard_force[0] + canard_force[1] + canard_force[2] + canard_force[3]);
+    torque[1] += p.canard_lever * (canard_force[2] - canard_force[0]);
+    torque[2] += p.canard_lever * (canard_force[3] - canard_force[1]);
+  }
+
+  float force_world[3];
+  BodyToWorld(s.q, force, force_world);
+  for (int a = 0; a < 3; a++) {
+    accel_ret[a] = force_world[a] / mass;
+  }
+  accel_ret[2] -= G;
+
+  memcpy(d.position, s.velocity, sizeof(d.position));
+  if (on_rail) {
+    // held to the rail: moves along it only once the thrust beats gravity, and does not turn
+    float along = accel_ret[0] * rail_direction[0] + accel_ret[1] * rail_direction[1] + accel_ret[2] * rail_direction[2];
+    float speed = s.velocity[0] * rail_direction[0] + s.velocity[1] * rail_direction[1] + s.velocity[2] * rail_direction[2];
+    if (along < 0.0f && speed <= 0.0f) {
+      along = 0.0f;
+    }
+    for (int a = 0; a < 3; a++) {
+      accel_ret[a] = along * rail_direction[a];
+    }
+    memset(d.q, 0, sizeof(d.q));
+    memset(d.rate, 0, sizeof(d.rate));
+  } else {
+    // q' = q * (0, w) / 2, and Euler's equations with the yaw inertia equal to the pitch inertia
+    const float w[4] = {0.0f, s.rate[0], s.rate[1], s.rate[2]};
+    QuatMultiply(s.q, w, d.q);
+    for (int i = 0; i < 4; i++) {
+      d.q[i] *= 0.5f;
+    }
+    float inertia[3] = {p.roll_inertia, p.pitch_inertia, p.pitch_inertia};
+    float momentum[3] = {inertia[0] * s.rate[0], inertia[1] * s.rate[1], inertia[2] * s.rate[2]};
+    float gyroscopic[3];
+    Cross(s.rate, momentum, gyroscopic);
+    for (int a = 0; a < 3; a++) {
+      d.rate[a] = (torque[a] - gyroscopic[a]) / inertia[a];
+    }
+  }
+  memcpy(d.velocity, accel_ret, sizeof(d.velocity));
+}
+
+/** @brief s_ret = s + d * h, over every field of the state */
+static void AddScaled(const Host::RocketState& s, const Host::RocketState& d, float h, Host::RocketState& s_ret)
+{
+  const float* a = (const float*)&s;
+  const float* b = (const float*)&d;
+  float* out = (float*)&s_ret;
+  for (size_t i = 0; i < sizeof(Host::RocketState) / sizeof(float); i++) {
+    out[i] = a[i] + b[i] * h;
+  }
+}
+
+void Host::RocketModel::Step(float dt, const float canard_commands[4])
+{
+  // first order servos with a rate limit, held for the step
+  float max_move = params.servo_rate * dt;
+  for (int i = 0; i < 4; i++) {
+    float target = canard_commands[i];
+    target = (target > params.canard_limit)? params.canard_limit : ((target < -params.canard_limit)? -params.canard_limit : target);
+    float move = (target - canards[i]) * ((dt < params.servo_tau)? dt / params.servo_tau : 1.0f);
+    move = (move > max_move)? max_move : ((move < -max_move)? -max_move : move);
+    canards[i] += move;
+  }
+
+  RocketState k1, k2, k3, k4, mid;
+  float unused[3];
+  Derivatives(t, state, k1, unused);
+  AddScaled(state, k1, 0.5f * dt, mid);
+  Derivatives(t + 0.5f * dt, mid, k2, unused);
+  AddScaled(state, k2, 0.5f * dt, mid);
+  Derivatives(t + 0.5f * dt, mid, k3, unused);
+  AddScaled(state, k3, dt, mid);
+  Derivatives(t + dt, mid, k4, unused);
+  float* s = (float*)&state;
+  const float* d1 = (const float*)&k1;
+  const float* d2 = (const float*)&k2;
+  const float* d3 = (const float*)&k3;
+  const float* d4 = (const float*)&k4;
+  for (size_t i = 0; i < sizeof(RocketState) / sizeof(float); i++) {
+    s[i] += dt / 6.0f * (d1[i] + 2.0f * d2[i] + 2.0f * d3[i] + d4[i]);
+  }
+  QuatNormalize(state.q);
+  t += dt;
+
+  if (on_rail) {
+    // the rail starts at the origin
+    if (Norm3(state.position) >= params.rail_length) {
+      on_rail = false;
+    }
+  }
+  RocketState unused_d;
+  Derivatives(t, state, unused_d, accel);
+}
+
+void Host::RocketModel::SpecificForce(float mg_ret[3]) const
+{
+  const float gravity[3] = {0.0f, 0.0f, -G};
+  float felt[3];
+  for (int a = 0; a < 3; a++) {
+    felt[a] = (accel[a] - gravity[a]) * (1000.0f / G);
+  }
+  WorldToBody(state.q, felt, mg_ret);
+}
+
+float Host::RocketModel::AngleOfAttack() const
+{
+  float wind[3], air_world[3], air[3];
+  Wind(t, state.position[2], wind);
+  for (int a = 0; a < 3; a++) {
+    air_world[a] = state.velocity[a] - wind[a];
+  }
+  WorldToBody(state.q, air_world, air);
+  float lateral = sqrtf(air[1] * air[1] + air[2] * air[2]);
+  return (Norm3(air) > MIN_AIRSPEED)? atan2f(lateral, air[0]) : 0.0f;
+}
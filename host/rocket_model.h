@@ -0,0 +1,102 @@
+// 6-DOF rocket model for the closed loop runs of the host build (see sil_main.cpp): rigid body with thrust,
+// gravity, Barrowman style aerodynamics, finite canard servos, a launch rail and wind
+#pragma once
+#include "host_math.h"
+
+namespace Host {
+  /** @brief the airframe, motor and servos; body x is the long axis, canards as in CANARD_MIX of main.cpp */
+  struct RocketParams {
+    float dry_mass = 5.0f;            // kg
+    float propellant_mass = 1.0f;     // kg, burned at a constant rate
+    float thrust = 600.0f;            // N, average
+    float burn_s = 2.5f;
+    float roll_inertia = 0.012f;      // kg m^2
+    float pitch_inertia = 1.8f;       // kg m^2, yaw is the same
+    float diameter = 0.1f;            // m, reference length
+    float drag_coeff = 1.1f;          // with the canards, rail buttons and camera shroud, fits the flight GAIN_SCHEDULE assumes
+    float normal_coeff_slope = 9.0f;  // CN alpha of the whole rocket (1/rad)
+    float static_margin = 0.15f;      // m, center of pressure behind the center of gravity
+    float fin_count = 4.0f;
+    float fin_area = 0.012f;          // m^2 each
+    float fin_lift_slope = 3.0f;      // 1/rad
+    float fin_radius = 0.1f;          // m, from the axis to the fin center of pressure
+    float fin_lever = 0.75f;          // m, fin center of pressure behind the center of gravity
+    float canard_area = 0.0008f;      // m^2 each
+    float canard_lift_slope = 2.5f;   // 1/rad
+    float canard_radius = 0.065f;     // m, from the axis to the canard center of pressure
+    float canard_lever = 0.9f;        // m, canards ahead of the center of gravity
+    float nozzle_lever = 1.0f;        // m, nozzle behind the center of gravity
+    float rail_length = 2.0f;         // m
+    float servo_tau = 0.01f;          // s, first order lag of the servos
+    float servo_rate = 10.5f;         // rad/s, fastest the servos move (600 degrees/s)
+    float canard_limit = 15.0f * DEG2RAD_F;
+  };
+
+  /** @brief what changes from one Monte Carlo flight to the next */
+  struct Dispersion {
+    float wind_speed = 0.0f;          // m/s at 10m, grows with height (1/7 power law)
+    float wind_direction = 0.0f;      // rad, where the wind blows toward, from north
+    float gust = 0.0f;                // fraction of the wind speed the gusts add
+    float gust_phase[2] = {0.0f, 0.0f};
+    float thrust_scale = 1.0f;
+    float thrust_misalignment = 0.0f; // rad
+    float thrust_misalignment_direction = 0.0f;
+    float fin_cant = 0.0f;            // rad, average cant of the fins, rolls the rocket
+    float rail_tilt = 0.0f;           // rad from vertical
+    float rail_azimuth = 0.0f;        // rad from north
+    float heading = 0.0f;             // rad, roll of the rocket about the rail
+  };
+
+  /** @brief the state of the rocket, world frame is x north, y west, z up */
+  struct RocketState {
+    float position[3];  // m
+    float velocity[3];  // m/s
+    float q[4];         // attitude, turns body vectors into the world frame
+    float rate[3];      // body rates (rad/s)
+  };
+
+  class RocketModel {
+  public:
+    RocketModel(const RocketParams& params, const Dispersion& dispersion);
+
+    /**
+     * @brief Moves the model on by dt (fourth order Runge-Kutta), the servos toward the commanded canards first
+     * @param dt Step (s)
+     * @param canard_commands Commanded canard rotations 1 - 4 (rad)
+     */
+    void Step(float dt, const float canard_commands[4]);
+    /** @brief Lights the motor, before this the rocket sits on the rail */
+    void Ignite() { ignition_t = t; }
+
+    const RocketState& State() const { return state; }
+    float Time() const { return t; }
+    /** @return What an ideal accel reads (mg, body frame) */
+    void SpecificForce(float mg_ret[3]) const;
+    const float* Canards() const { return canards; }
+    bool OnRail() const { return on_rail; }
+    bool Burning() const { return ignition_t >= 0.0f && t - ignition_t < params.burn_s; }
+    float TimeSinceIgnition() const { return (ignition_t >= 0.0f)? t - ignition_t : 0.0f; }
+    /** @return true once the rocket has burned out and started coming down */
+    bool PastApogee() const { return ignition_t >= 0.0f && !Burning() && !on_rail && state.velocity[2] < 0.0f; }
+    float Speed() const { return Norm3(state.velocity); }
+    /** @return Angle between the long axis and the air flow (rad) */
+    float AngleOfAttack() const;
+
+  private:
+    /** @brief Derivatives of the state; accel_ret is the acceleration of the center of gravity (world) */
+    void Derivatives(float time, const RocketState& s, RocketState& d, float accel_ret[3]) const;
+    void Wind(float time, float height, float wind_ret[3]) const;
+    float Thrust(float time) const;
+    float Mass(float time) const;
+
+    RocketParams params;
+    Dispersion dispersion;
+    RocketState state;
+    float t = 0.0f;
+    float ignition_t = -1.0f;
+    float canards[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float rail_direction[3];
+    bool on_rail = true;
+    float accel[3] = {0.0f, 0.0f, 0.0f};  // last acceleration, for SpecificForce
+  };
+}
@@ -0,0 +1,531 @@
+// Closed loop runs of main.cpp against the 6-DOF model in rocket_model.cpp: the model's motion goes through
+// the sensor model into the simulated ICM, the sketch runs as it is, and the canards StabilizationSystem()
+// sets move the model's servos right away, in the same process with no serial link in between.
+// Every flight is a Monte Carlo draw of wind, thrust, misalignment, fin cant and rail, each in a forked
+// process so it starts from the sketch's power on state, as many at a time as there are cores.
+//
+//   make -C host sil                                   build (DEFINES like the host_sim build)
+//   host/build/host_sil --flights 1000 --results flights.csv
+//   host/build/host_sil --flights 1 --trajectory flight.csv
+//
+// Prints the spread of the flights to stderr; with --max-roll-rms, --max-settle or --max-tick-us it also fails
+// (exit 1) if the 95th percentile flight is worse than that, and with --max-overruns if any flight overran its
+// tasks more often, which is the gate before a build is flashed. The tick times are host CPU time and change from
+// run to run; the overruns are counted in simulated time, so they are the same on every host.
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../main.cpp"
+#include "sim_hardware.h"
+#include "trace.h"
+#include "rocket_model.h"
+
+namespace Host {
+  /** @brief runner settings from the command line */
+  struct SILOptions {
+    unsigned long flights = 200;
+    unsigned jobs = 0;                  // 0: one per core
+    uint32_t seed = 1;
+    bool open_loop = false;             // the model's canards stay at 0 whatever the sketch commands
+    bool nominal = false;               // no dispersion at all
+    float max_wind = 8.0f;              // m/s
+    float thrust_spread = 0.05f;        // deviation of the thrust scale
+    float max_misalignment_deg = 0.2f;
+    float fin_cant_deg = 0.1f;          // deviation of the fin cant
+    float max_rail_tilt_deg = 5.0f;
+    float noise = 1.0f;
+    float pad_s = 2.0f;                 // on the rail before ignition, the sketch starts up and settles in this
+    float max_flight_s = 30.0f;
+    float settle_rate_dps = 20.0f;      // the roll has settled once it stays under this
+    float aoa_speed = 30.0f;            // m/s, the angle of attack only counts above this (it grows large near apogee)
+    uint32_t loop_us = 10;
+    const char* results_path = NULL;
+    const char* trajectory_path = NULL;
+    float max_roll_rms_dps = -1.0f;
+    float max_settle_s = -1.0f;
+    float max_tick_us = -1.0f;
+    long max_overruns = -1;
+  };
+
+  /** @brief what one flight did; measured from leaving the rail to apogee, tick times over the whole run */
+  struct FlightResult {
+    uint32_t flight;
+    Dispersion dispersion;
+    bool launched;                      // the sketch detected the launch
+    bool settled;                       // the roll rate ended under settle_rate_dps
+    float roll_rms_dps;
+    float max_roll_dps;
+    float settle_s;                     // since leaving the rail, the whole window if it never settled
+    float max_rate_dps;                 // largest pitch / yaw rate
+    float max_aoa_deg;                  // while faster than aoa_speed
+    float max_canard_deg;
+    float saturated_fraction;           // of the control ticks in the window
+    float apogee_m;
+    float apogee_s;                     // since ignition
+    float burnout_s;                    // since ignition, when the sketch went to FLIGHT_PHASE_COAST (apogee_s if it never did)
+    float apogee_phase_s;               // since ignition, when it went to FLIGHT_PHASE_APOGEE (apogee_s if it never did)
+    float tick_mean_us;                 // host CPU time of one ControlTask() run
+    float tick_max_us;
+    unsigned long overruns;             // task overruns of the sketch
+  };
+
+  namespace SIL {
+    SILOptions options;
+    void (*control_task)(float) = NULL;
+    unsigned long ticks = 0;
+    double tick_ns_sum = 0.0;
+    double tick_ns_max = 0.0;
+    bool in_window = false;
+    unsigned long window_ticks = 0;
+    unsigned long saturated_ticks = 0;
+  }
+}
+
+static void PrintUsage()
+{
+  fprintf(stderr,
+    "usage: host_sil [options]\n"
+    "  --flights N          Monte Carlo flights (200)\n"
+    "  --jobs N             flights at a time (one per core)\n"
+    "  --seed N             seed of the first flight, flight i uses seed + i (1)\n"
+    "  --nominal            no dispersion, every flight the same but for the sensor noise\n"
+    "  --open-loop          ignore the canard commands, for comparison\n"
+    "  --max-wind M/S       wind at 10m drawn up to this (8)\n"
+    "  --thrust-spread X    deviation of the thrust scale (0.05)\n"
+    "  --misalignment DEG   thrust misalignment drawn up to this (0.2)\n"
+    "  --fin-cant DEG       deviation of the fin cant (0.1)\n"
+    "  --rail-tilt DEG      rail tilt drawn up to this (5)\n"
+    "  --noise X            sensor noise scale (1)\n"
+    "  --loop-us N          simulated time one loop() takes besides the clock reads (10)\n"
+    "  --settle-rate DPS    roll rate the roll counts as settled under (20)\n"
+    "  --results FILE       one CSV row per flight\n"
+    "  --trajectory FILE    CSV of the first flight at every sample\n"
+    "  --max-roll-rms DPS   exit 1 if the 95th percentile roll rate RMS exceeds DPS\n"
+    "  --max-settle S       exit 1 if the 95th percentile settling time exceeds S\n"
+    "  --max-tick-us US     exit 1 if the 95th percentile mean control tick exceeds US\n"
+    "  --max-overruns N     exit 1 if a flight has more than N task overruns\n");
+}
+
+/** @return false if an option is unknown or misses its value */
+static bool ParseOptions(int argc, char** argv, Host::SILOptions& options)
+{
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--nominal") { options.nominal = true; continue; }
+    if (arg == "--open-loop") { options.open_loop = true; continue; }
+    if (arg == "-h" || arg == "--help" || i + 1 >= argc) {
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "--flights") options.flights = strtoul(value, NULL, 0);
+    else if (arg == "--jobs") options.jobs = (unsigned)strtoul(value, NULL, 0);
+    else if (arg == "--seed") options.seed = (uint32_t)strtoul(value, NULL, 0);
+    else if (arg == "--max-wind") options.max_wind = (float)atof(value);
+    else if (arg == "--thrust-spread") options.thrust_spread = (float)atof(value);
+    else if (arg == "--misalignment") options.max_misalignment_deg = (float)atof(value);
+    else if (arg == "--fin-cant") options.fin_cant_deg = (float)atof(value);
+    else if (arg == "--rail-tilt") options.max_rail_tilt_deg = (float)atof(value);
+    else if (arg == "--noise") options.noise = (float)atof(value);
+    else if (arg == "--loop-us") options.loop_us = (uint32_t)strtoul(value, NULL, 0);
+    else if (arg == "--settle-rate") options.settle_rate_dps = (float)atof(value);
+    else if (arg == "--results") options.results_path = value;
+    else if (arg == "--trajectory") options.trajectory_path = value;
+    else if (arg == "--max-roll-rms") options.max_roll_rms_dps = (float)atof(value);
+    else if (arg == "--max-settle") options.max_settle_s = (float)atof(value);
+    else if (arg == "--max-tick-us") options.max_tick_us = (float)atof(value);
+    else if (arg == "--max-overruns") options.max_overruns = strtol(value, NULL, 0);
+    else return false;
+  }
+  return true;
+}
+
+/** @brief Draws the dispersion of one flight */
+static Host::Dispersion DrawDispersion(const Host::SILOptions& options, Host::Random& random)
+{
+  using namespace Host;
+  Dispersion d;
+  const float TWO_PI = 2.0f * (float)PI_D;
+  d.heading = random.Uniform(0.0f, TWO_PI);
+  if (options.nominal) {
+    return d;
+  }
+  d.wind_speed = random.Uniform(0.0f, options.max_wind);
+  d.wind_direction = random.Uniform(0.0f, TWO_PI);
+  d.gust = random.Uniform(0.0f, 0.4f);
+  d.gust_phase[0] = random.Uniform(0.0f, TWO_PI);
+  d.gust_phase[1] = random.Uniform(0.0f, TWO_PI);
+  d.thrust_scale = 1.0f + options.thrust_spread * random.Gaussian();
+  d.thrust_misalignment = random.Uniform(0.0f, options.max_misalignment_deg) * DEG2RAD_F;
+  d.thrust_misalignment_direction = random.Uniform(0.0f, TWO_PI);
+  d.fin_cant = options.fin_cant_deg * random.Gaussian() * DEG2RAD_F;
+  d.rail_tilt = random.Uniform(0.0f, options.max_rail_tilt_deg) * DEG2RAD_F;
+  d.rail_azimuth = random.Uniform(0.0f, TWO_PI);
+  return d;
+}
+
+/** @brief ControlTask() with its host CPU time measured, put in the sketch's task table in its place */
+static void TimedControlTask(float deltaTime)
+{
+  using namespace Host;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  SIL::control_task(deltaTime);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  SIL::ticks++;
+  SIL::tick_ns_sum += ns;
+  SIL::tick_ns_max = (ns > SIL::tick_ns_max)? ns : SIL::tick_ns_max;
+  if (SIL::in_window) {
+    SIL::window_ticks++;
+    SIL::saturated_ticks += Controller::saturated? 1 : 0;
+  }
+}
+
+/** @brief Flies one flight in this process; the sketch's globals must still be at their power on values */
+static Host::FlightResult Fly(uint32_t flight)
+{
+  using namespace Host;
+  const SILOptions& options = SIL::options;
+  const uint32_t SAMPLE_US = 1000;    // the ICM's 1kHz
+  const int MODEL_STEPS = 2;          // model steps per sample
+  const float DT = SAMPLE_US / 1e6f / MODEL_STEPS;
+
+  Random random(options.seed + flight * 2654435761u);
+  FlightResult result = FlightResult();
+  result.flight = flight;
+  result.dispersion = DrawDispersion(options, random);
+  SyntheticSettings settings;
+  settings.noise = options.noise;
+  settings.seed = options.seed + flight;
+  for (int a = 0; a < 3; a++) {
+    settings.gyro_bias_dps[a] = 0.3f * random.Gaussian();
+  }
+
+  RocketModel rocket(RocketParams(), result.dispersion);
+  SensorModel sensors(settings);
+  FILE* trajectory = NULL;
+  if (flight == 0 && options.trajectory_path != NULL) {
+    trajectory = fopen(options.trajectory_path, "w");
+    if (trajectory != NULL) {
+      fprintf(trajectory, "t_s,x_m,y_m,z_m,speed_mps,aoa_deg,roll_dps,pitch_dps,yaw_dps,canard_1_deg,canard_2_deg,canard_3_deg,canard_4_deg,launched\n");
+    }
+  }
+
+  // the model moves on a sample at a time, up to the sketch's clock; the canards are held for the sample
+  uint32_t next_sample_us = 0;
+  const float ZERO[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  float window_start_s = -1.0f;
+  double roll_sq_sum = 0.0;
+  unsigned long window_samples = 0;
+  float last_unsettled_s = 0.0f;
+  bool ignited = false;
+  bool done = false;
+  auto advance_model = [&](uint64_t until_us) {
+    while (!done && next_sample_us <= until_us) {
+      if (!ignited && next_sample_us >= options.pad_s * 1e6f) {
+        rocket.Ignite();
+        ignited = true;
+      }
+      float canards[4];
+      GetCanardRotations(canards);
+      for (int i = 0; i < MODEL_STEPS && next_sample_us > 0; i++) {
+        rocket.Step(DT, options.open_loop? ZERO : canards);
+      }
+      const RocketState& s = rocket.State();
+      float mg[3];
+      rocket.SpecificForce(mg);
+      TraceSample sample;
+      sensors.Sense(next_sample_us, s.q, s.rate, mg, sample);
+      trace.samples.push_back(sample);
+      next_sample_us += SAMPLE_US;
+
+      float roll_dps = fabsf(s.rate[0]) * RAD2DEG_F;
+      float aoa_deg = rocket.AngleOfAttack() * RAD2DEG_F;
+      if (!rocket.OnRail() && window_start_s < 0.0f) {
+        window_start_s = rocket.Time();
+        SIL::in_window = true;
+      }
+      if (SIL::in_window) {
+        float t = rocket.Time() - window_start_s;
+        window_samples++;
+        roll_sq_sum += (double)roll_dps * roll_dps;
+        result.max_roll_dps = std::max(result.max_roll_dps, roll_dps);
+        result.max_rate_dps = std::max(result.max_rate_dps, std::max(fabsf(s.rate[1]), fabsf(s.rate[2])) * RAD2DEG_F);
+        if (rocket.Speed() > options.aoa_speed) {
+          result.max_aoa_deg = std::max(result.max_aoa_deg, aoa_deg);
+        }
+        for (int i = 0; i < 4; i++) {
+          result.max_canard_deg = std::max(result.max_canard_deg, fabsf(rocket.Canards()[i]) * RAD2DEG_F);
+        }
+        if (roll_dps > options.settle_rate_dps) {
+          last_unsettled_s = t;
+        }
+        result.apogee_m = std::max(result.apogee_m, s.position[2]);
+      }
+      if (trajectory != NULL) {
+        const float* c = rocket.Canards();
+        fprintf(trajectory, "%.3f,%.2f,%.2f,%.2f,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d\n", rocket.Time(),
+                s.position[0], s.position[1], s.position[2], rocket.Speed(), aoa_deg,
+                s.rate[0] * RAD2DEG_F, s.rate[1] * RAD2DEG_F, s.rate[2] * RAD2DEG_F,
+                c[0] * RAD2DEG_F, c[1] * RAD2DEG_F, c[2] * RAD2DEG_F, c[3] * RAD2DEG_F, Flight::launched? 1 : 0);
+      }
+      if (result.burnout_s == 0.0f && Flight::phase >= FLIGHT_PHASE_COAST) {
+        result.burnout_s = rocket.TimeSinceIgnition();
+      }
+      if (result.apogee_phase_s == 0.0f && Flight::phase >= FLIGHT_PHASE_APOGEE) {
+        result.apogee_phase_s = rocket.TimeSinceIgnition();
+      }
+      bool landed = !rocket.OnRail() && s.position[2] < 0.0f;
+      if (rocket.PastApogee() || landed || rocket.Time() > options.max_flight_s) {
+        result.apogee_s = rocket.TimeSinceIgnition();
+        done = true;
+      }
+    }
+  };
+
+  // the pad up to the ignition first, nothing the sketch does moves the rocket on the rail
+  advance_model((uint64_t)(options.pad_s * 1e6f) - 1);
+  deadline_us = (uint64_t)((options.pad_s + options.max_flight_s + 5.0f) * 1e6f);
+  setup();
+#ifdef DUAL_CORE
+  setup1();
+#endif
+  for (size_t i = 0; i < TASK_COUNT; i++) {
+    if (tasks[i].run == ControlTask) {
+      SIL::control_task = tasks[i].run;
+      tasks[i].run = TimedControlTask;
+    }
+  }
+  while (!done) {
+    advance_model(now_us);
+    loop();
+#ifdef DUAL_CORE
+    loop1(); // the second core, one pass after each pass of the first
+#endif
+    PollInterrupts();
+    Advance(options.loop_us);
+  }
+  if (trajectory != NULL) {
+    fclose(trajectory);
+  }
+
+  float window_s = (window_start_s >= 0.0f)? rocket.Time() - window_start_s : 0.0f;
+  result.launched = Flight::launched;
+  result.roll_rms_dps = (window_samples > 0)? (float)sqrt(roll_sq_sum / window_samples) : 0.0f;
+  // settled if the roll was under the threshold for the last half second of the window at least
+  result.settled = window_s - last_unsettled_s > 0.5f;
+  result.settle_s = result.settled? last_unsettled_s : window_s;
+  result.burnout_s = (result.burnout_s > 0.0f)? result.burnout_s : result.apogee_s;
+  result.apogee_phase_s = (result.apogee_phase_s > 0.0f)? result.apogee_phase_s : result.apogee_s;
+  result.saturated_fraction = (SIL::window_ticks > 0)? (float)SIL::saturated_ticks / SIL::window_ticks : 0.0f;
+  result.tick_mean_us = (SIL::ticks > 0)? (float)(SIL::tick_ns_sum / SIL::ticks / 1000.0) : 0.0f;
+  result.tick_max_us = (float)(SIL::tick_ns_max / 1000.0);
+  for (size_t i = 0; i < TASK_COUNT; i++) {
+    result.overruns += tasks[i].overruns;
+  }
+  return result;
+}
+
+/** @brief One forked flight: the child flies and writes its result into the pipe */
+struct Job {
+  pid_t pid;
+  int fd;
+  uint32_t flight;
+};
+
+static bool StartFlight(uint32_t flight, Job& job_ret)
+{
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    Host::FlightResult result = Fly(flight);
+    bool written = write(fds[1], &result, sizeof(result)) == (ssize_t)sizeof(result);
+    _exit(written? 0 : 3);
+  }
+  close(fds[1]);
+  job_ret.pid = pid;
+  job_ret.fd = fds[0];
+  job_ret.flight = flight;
+  return true;
+}
+
+/** @return false if the child crashed or did not hand back a whole result */
+static bool FinishFlight(const Job& job, Host::FlightResult& result_ret)
+{
+  ssize_t got = 0;
+  while (got < (ssize_t)sizeof(result_ret)) {
+    ssize_t n = read(job.fd, (char*)&result_ret + got, sizeof(result_ret) - got);
+    if (n <= 0) {
+      break;
+    }
+    got += n;
+  }
+  close(job.fd);
+  int status = 0;
+  waitpid(job.pid, &status, 0);
+  return got == (ssize_t)sizeof(result_ret) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/** @brief mean, median, 95th percentile and max of one metric over the flights */
+struct Spread {
+  float mean, p50, p95, max;
+};
+
+static Spread SpreadOf(const std::vector<Host::FlightResult>& results, float Host::FlightResult::* field)
+{
+  std::vector<float> values;
+  double sum = 0.0;
+  for (size_t i = 0; i < results.size(); i++) {
+    values.push_back(results[i].*field);
+    sum += results[i].*field;
+  }
+  std::sort(values.begin(), values.end());
+  Spread s = {0.0f, 0.0f, 0.0f, 0.0f};
+  if (!values.empty()) {
+    s.mean = (float)(sum / values.size());
+    s.p50 = values[(values.size() - 1) / 2];
+    s.p95 = values[(size_t)((values.size() - 1) * 0.95)];
+    s.max = values.back();
+  }
+  return s;
+}
+
+static void WriteResults(const char* path, const std::vector<Host::FlightResult>& results)
+{
+  FILE* f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "sil: cannot write %s\n", path);
+    return;
+  }
+  fprintf(f, "flight,wind_mps,thrust_scale,misalignment_deg,fin_cant_deg,rail_tilt_deg,launched,settled,roll_rms_dps,max_roll_dps,"
+             "settle_s,max_rate_dps,max_aoa_deg,max_canard_deg,saturated_fraction,apogee_m,apogee_s,burnout_detected_s,apogee_detected_s,"
+             "tick_mean_us,tick_max_us,overruns\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Host::FlightResult& r = results[i];
+    fprintf(f, "%lu,%.2f,%.4f,%.3f,%.3f,%.2f,%d,%d,%.3f,%.2f,%.3f,%.2f,%.2f,%.2f,%.4f,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%lu\n",
+            (unsigned long)r.flight, r.dispersion.wind_speed, r.dispersion.thrust_scale,
+            r.dispersion.thrust_misalignment * Host::RAD2DEG_F, r.dispersion.fin_cant * Host::RAD2DEG_F,
+            r.dispersion.rail_tilt * Host::RAD2DEG_F, r.launched? 1 : 0, r.settled? 1 : 0, r.roll_rms_dps, r.max_roll_dps,
+            r.settle_s, r.max_rate_dps, r.max_aoa_deg, r.max_canard_deg, r.saturated_fraction, r.apogee_m, r.apogee_s,
+            r.burnout_s, r.apogee_phase_s, r.tick_mean_us, r.tick_max_us, r.overruns);
+  }
+  fclose(f);
+}
+
+int main(int argc, char** argv)
+{
+  using namespace Host;
+  SILOptions& options = SIL::options;
+  if (!ParseOptions(argc, argv, options) || options.flights == 0) {
+    PrintUsage();
+    return 2;
+  }
+  unsigned jobs = options.jobs;
+  if (jobs == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = (cores > 0)? (unsigned)cores : 1;
+  }
+
+  std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+  std::vector<FlightResult> results;
+  std::vector<Job> running;
+  unsigned long failed = 0;
+  uint32_t next_flight = 0;
+  while (next_flight < options.flights || !running.empty()) {
+    while (next_flight < options.flights && running.size() < jobs) {
+      Job job;
+      if (!StartFlight(next_flight, job)) {
+        fprintf(stderr, "sil: cannot start flight %lu\n", (unsigned long)next_flight);
+        return 2;
+      }
+      running.push_back(job);
+      next_flight++;
+    }
+    // the oldest first, the flights take about as long as each other
+    FlightResult result;
+    if (FinishFlight(running.front(), result)) {
+      results.push_back(result);
+    } else {
+      fprintf(stderr, "sil: flight %lu did not finish\n", (unsigned long)running.front().flight);
+      failed++;
+    }
+    running.erase(running.begin());
+  }
+  double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+  if (options.results_path != NULL) {
+    WriteResults(options.results_path, results);
+  }
+
+  unsigned long launched = 0, settled = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    launched += results[i].launched? 1 : 0;
+    settled += results[i].settled? 1 : 0;
+  }
+  fprintf(stderr, "sil: %lu flights in %.1f s (%.0f per minute, %u at a time), %s loop, %lu launches detected, %lu settled, %lu failed\n",
+          (unsigned long)options.flights, wall_s, (wall_s > 0.0)? options.flights / wall_s * 60.0 : 0.0, jobs,
+          options.open_loop? "open" : "closed", launched, settled, failed);
+  struct Row {
+    const char* name;
+    float FlightResult::* field;
+  };
+  const Row ROWS[] = {
+    {"roll rate rms (dps)", &FlightResult::roll_rms_dps},
+    {"max roll rate (dps)", &FlightResult::max_roll_dps},
+    {"settling time (s)", &FlightResult::settle_s},
+    {"max pitch/yaw rate (dps)", &FlightResult::max_rate_dps},
+    {"max angle of attack (deg)", &FlightResult::max_aoa_deg},
+    {"max canard (deg)", &FlightResult::max_canard_deg},
+    {"saturated fraction", &FlightResult::saturated_fraction},
+    {"apogee (m)", &FlightResult::apogee_m},
+    {"apogee time (s)", &FlightResult::apogee_s},
+    {"burnout detected (s)", &FlightResult::burnout_s},
+    {"apogee detected (s)", &FlightResult::apogee_phase_s},
+    {"control tick mean (us)", &FlightResult::tick_mean_us},
+    {"control tick max (us)", &FlightResult::tick_max_us},
+  };
+  fprintf(stderr, "sil: %-26s %10s %10s %10s %10s\n", "", "mean", "p50", "p95", "max");
+  for (size_t i = 0; i < sizeof(ROWS) / sizeof(ROWS[0]); i++) {
+    Spread s = SpreadOf(results, ROWS[i].field);
+    fprintf(stderr, "sil: %-26s %10.3f %10.3f %10.3f %10.3f\n", ROWS[i].name, s.mean, s.p50, s.p95, s.max);
+  }
+
+  int code = (failed > 0)? 1 : 0;
+  struct Gate {
+    const char* name;
+    float FlightResult::* field;
+    float limit;
+  };
+  const Gate GATES[] = {
+    {"roll rate rms", &FlightResult::roll_rms_dps, options.max_roll_rms_dps},
+    {"settling time", &FlightResult::settle_s, options.max_settle_s},
+    {"control tick mean", &FlightResult::tick_mean_us, options.max_tick_us},
+  };
+  for (size_t i = 0; i < sizeof(GATES) / sizeof(GATES[0]); i++) {
+    Spread s = SpreadOf(results, GATES[i].field);
+    if (GATES[i].limit >= 0.0f && s.p95 > GATES[i].limit) {
+      fprintf(stderr, "sil: FAIL, 95th percentile %s %.3f over %.3f\n", GATES[i].name, s.p95, GATES[i].limit);
+      code = 1;
+    }
+  }
+  if (options.max_overruns >= 0) {
+    unsigned long worst = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+      worst = std::max(worst, results[i].overruns);
+    }
+    if (worst > (unsigned long)options.max_overruns) {
+      fprintf(stderr, "sil: FAIL, a flight has %lu task overruns, over %ld\n", worst, options.max_overruns);
+      code = 1;
+    }
+  }
+  return code;
+}
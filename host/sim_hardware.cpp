@@ -0,0 +1,518 @@
+// Simulated board for the host build, see sim_hardware.h
+#include <stdarg.h>
+#include <deque>
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <EEPROM.h>
+#include <ICM_20948.h>
+#include "sim_hardware.h"
+
+HardwareSerial Serial;
+TwoWire Wire;
+SPIClass SPI;
+EEPROMClass EEPROM;
+
+namespace Host {
+  Trace trace;
+  uint64_t now_us = 0;
+  uint32_t call_cost_us = 1;
+  uint64_t deadline_us = UINT64_MAX;
+  void (*on_stuck)() = NULL;
+}
+
+/***************************************************************
+                          CLOCK
+***************************************************************/
+
+void Host::Advance(uint64_t us)
+{
+  now_us += us;
+  if (now_us > deadline_us) {
+    fprintf(stderr, "host: still running %.1fs past the end of the trace, stopping\n", (deadline_us - trace.samples.back().t_us) / 1e6);
+    if (on_stuck != NULL) {
+      on_stuck();
+    }
+    exit(2);
+  }
+}
+
+unsigned long millis() {
+  Host::Advance(Host::call_cost_us);
+  return (unsigned long)(Host::now_us / 1000);
+}
+
+unsigned long micros() {
+  Host::Advance(Host::call_cost_us);
+  return (unsigned long)Host::now_us; // wraps at 32 bits like the real one
+}
+
+void delay(unsigned long ms) { Host::Advance((uint64_t)ms * 1000); }
+void delayMicroseconds(unsigned int us) { Host::Advance(us); }
+
+/***************************************************************
+                          PINS
+***************************************************************/
+
+namespace Host {
+  void (*isr)() = NULL;
+  bool interrupts_on = true;
+  long isr_sample = -1;       // newest sample the INT pin has signalled
+}
+
+void pinMode(uint8_t /*pin*/, uint8_t /*mode*/) {}
+void digitalWrite(uint8_t /*pin*/, uint8_t /*value*/) {}
+int digitalRead(uint8_t /*pin*/) { return HIGH; }
+void attachInterrupt(int /*interrupt*/, void (*isr)(), int /*mode*/) { Host::isr = isr; }
+void detachInterrupt(int /*interrupt*/) { Host::isr = NULL; }
+void noInterrupts() { Host::interrupts_on = false; }
+void interrupts() { Host::interrupts_on = true; }
+
+void Host::PollInterrupts()
+{
+  long newest = NewestSample();
+  if (isr != NULL && interrupts_on && newest > isr_sample) {
+    isr_sample = newest;
+    isr();
+  }
+}
+
+/***************************************************************
+                          UART
+***************************************************************/
+
+namespace Host {
+  const int SERIAL_TX_BUFFER = 64;
+  const size_t SERIAL_RX_BUFFER = 64;
+  FILE* serial_out = NULL;
+  std::vector<uint8_t> serial_in;  // what the other end sends, in order
+  std::vector<uint64_t> serial_in_at; // earliest time each byte of it is sent
+  size_t serial_in_next = 0;       // first byte of serial_in that has not come in yet
+  uint64_t rx_last_us = 0;         // time the last byte came in
+  std::deque<uint8_t> rx_buffer;   // bytes that came in and were not read yet
+  unsigned long rx_overflows = 0;
+  unsigned long serial_baud = 9600;
+  uint64_t tx_idle_us = 0;    // time the bytes in the transmit buffer are all out
+  unsigned long serial_written = 0;
+
+  /** @return Bytes still in the transmit buffer */
+  int TxBuffered() {
+    if (tx_idle_us <= now_us) {
+      return 0;
+    }
+    // 10 bits a byte (start, 8 data, stop), rounded up so a partly sent byte still takes its slot
+    uint64_t bits = (tx_idle_us - now_us) * serial_baud;
+    return (int)((bits + 10000000ULL - 1) / 10000000ULL);
+  }
+
+  /** @brief Moves the bytes that have come in by now into the receive buffer, a full buffer loses them like the core's */
+  void ReceiveSerial() {
+    uint64_t byte_us = 10000000ULL / serial_baud;
+    while (serial_in_next < serial_in.size()) {
+      uint64_t at = rx_last_us + byte_us;
+      at = (serial_in_at[serial_in_next] > at)? serial_in_at[serial_in_next] : at;
+      if (at > now_us) {
+        break;
+      }
+      rx_last_us = at;
+      if (rx_buffer.size() < SERIAL_RX_BUFFER - 1) {
+        rx_buffer.push_back(serial_in[serial_in_next]);
+      } else {
+        rx_overflows++;
+      }
+      serial_in_next++;
+    }
+  }
+}
+
+void HardwareSerial::begin(unsigned long baud) { Host::serial_baud = baud; }
+
+size_t HardwareSerial::write(uint8_t b)
+{
+  // a full buffer blocks until the UART has made room, like the core does
+  while (Host::TxBuffered() >= Host::SERIAL_TX_BUFFER - 1) {
+    Host::Advance(10000000ULL / Host::serial_baud / 10 + 1);
+  }
+  uint64_t start = (Host::tx_idle_us > Host::now_us)? Host::tx_idle_us : Host::now_us;
+  Host::tx_idle_us = start + 10000000ULL / Host::serial_baud;
+  Host::serial_written++;
+  if (Host::serial_out != NULL) {
+    fputc(b, Host::serial_out);
+  }
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    write(data[i]);
+  }
+  return len;
+}
+
+int HardwareSerial::availableForWrite() { return Host::SERIAL_TX_BUFFER - 1 - Host::TxBuffered(); }
+
+void HardwareSerial::flush() { Host::Advance((Host::tx_idle_us > Host::now_us)? Host::tx_idle_us - Host::now_us : 0); }
+
+int HardwareSerial::available()
+{
+  Host::ReceiveSerial();
+  return (int)Host::rx_buffer.size();
+}
+
+int HardwareSerial::read()
+{
+  if (available() <= 0) {
+    return -1;
+  }
+  uint8_t b = Host::rx_buffer.front();
+  Host::rx_buffer.pop_front();
+  return b;
+}
+
+int HardwareSerial::peek() { return (available() > 0)? Host::rx_buffer.front() : -1; }
+
+size_t HardwareSerial::printf_(const char* format, ...)
+{
+  char buffer[64];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  return write((const uint8_t*)buffer, (len < (int)sizeof(buffer))? len : sizeof(buffer) - 1);
+}
+
+void Host::SetSerialOutput(FILE* out) { serial_out = out; }
+void Host::QueueSerialInput(const uint8_t* bytes, size_t len, uint64_t at_us)
+{
+  serial_in.insert(serial_in.end(), bytes, bytes + len);
+  serial_in_at.insert(serial_in_at.end(), len, at_us);
+}
+
+unsigned long Host::SerialOverflows() { return rx_overflows; }
+unsigned long Host::SerialBytesWritten() { return serial_written; }
+
+/***************************************************************
+                        LOG FLASH
+***************************************************************/
+// W25Q64 (8MB): JEDEC id, status, write enable, page program (wraps within its page like the real chip,
+// can only clear bits), read, and chip / 4KB sector erase; programming and erasing keep the chip busy
+// for their typical times
+
+namespace Flash {
+  const uint32_t SIZE = 8UL << 20;
+  const uint8_t JEDEC_ID[3] = {0xEF, 0x40, 0x17};
+  const uint64_t PAGE_PROGRAM_US = 700;
+  const uint64_t SECTOR_ERASE_US = 45000;
+  const uint64_t CHIP_ERASE_US = 20000000;
+  uint8_t* memory = NULL;
+  bool write_enabled = false;
+  uint64_t busy_until_us = 0;
+  uint32_t frame_pos = 0;     // bytes since chip select
+  uint8_t cmd = 0;
+  uint32_t address = 0;
+
+  uint8_t* Memory() {
+    if (memory == NULL) {
+      memory = (uint8_t*)malloc(SIZE);
+      memset(memory, 0xFF, SIZE);
+    }
+    return memory;
+  }
+
+  bool Busy() { return Host::now_us < busy_until_us; }
+
+  /** @brief Ends the chip select frame; a program or erase starts when the chip is deselected */
+  void Deselect() {
+    if (!Busy() && write_enabled && frame_pos >= 4 && (cmd == 0x02 || cmd == 0x20)) {
+      if (cmd == 0x20) {
+        memset(Memory() + (address & (SIZE - 1) & ~0xFFFUL), 0xFF, 4096);
+      }
+      busy_until_us = Host::now_us + ((cmd == 0x02)? PAGE_PROGRAM_US : SECTOR_ERASE_US);
+      write_enabled = false;
+    }
+    if (!Busy() && write_enabled && frame_pos == 1 && (cmd == 0xC7 || cmd == 0x60)) {
+      memset(Memory(), 0xFF, SIZE);
+      busy_until_us = Host::now_us + CHIP_ERASE_US;
+      write_enabled = false;
+    }
+    frame_pos = 0;
+  }
+
+  uint8_t Transfer(uint8_t out) {
+    uint32_t pos = frame_pos++;
+    if (pos == 0) {
+      cmd = out;
+      address = 0;
+      if (cmd == 0x06 && !Busy()) {
+        write_enabled = true;
+      } else if (cmd == 0x04) {
+        write_enabled = false;
+      }
+      return 0xFF;
+    }
+    switch (cmd) {
+    case 0x9F:
+      return (pos <= 3)? JEDEC_ID[pos - 1] : 0xFF;
+    case 0x05:
+      return (Busy()? 0x01 : 0x00) | (write_enabled? 0x02 : 0x00);
+    case 0x03:
+    case 0x02:
+    case 0x20:
+      if (pos <= 3) {
+        address = (address << 8) | out;
+        return 0xFF;
+      }
+      if (cmd == 0x03) {
+        return Busy()? 0xFF : Memory()[(address + pos - 4) & (SIZE - 1)];
+      }
+      if (cmd == 0x02 && write_enabled && !Busy()) {
+        uint32_t byte_address = (address & ~0xFFUL) | ((address + pos - 4) & 0xFF);
+        Memory()[byte_address & (SIZE - 1)] &= out;
+      }
+      return 0xFF;
+    default:
+      return 0xFF;
+    }
+  }
+}
+
+void SPIClass::beginTransaction(SPISettings /*settings*/) { Flash::frame_pos = 0; }
+void SPIClass::endTransaction() { Flash::Deselect(); }
+uint8_t SPIClass::transfer(uint8_t data) { return Flash::Transfer(data); }
+
+/**
+ * @brief Reads a file into a buffer, the rest stays as it was
+ * @return true if the file could be read
+ */
+static bool LoadImage(const char* path, uint8_t* data, size_t size)
+{
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  size_t len = fread(data, 1, size, f);
+  fclose(f);
+  return len > 0;
+}
+
+static bool SaveImage(const char* path, const uint8_t* data, size_t size)
+{
+  FILE* f = fopen(path, "wb");
+  if (f == NULL) {
+    return false;
+  }
+  bool ok = fwrite(data, 1, size, f) == size;
+  return (fclose(f) == 0) && ok;
+}
+
+bool Host::LoadFlash(const char* path) { return LoadImage(path, Flash::Memory(), Flash::SIZE); }
+bool Host::SaveFlash(const char* path) { return SaveImage(path, Flash::Memory(), Flash::SIZE); }
+bool Host::LoadEEPROM(const char* path) { return LoadImage(path, EEPROM.data, sizeof(EEPROM.data)); }
+bool Host::SaveEEPROM(const char* path) { return SaveImage(path, EEPROM.data, sizeof(EEPROM.data)); }
+
+/***************************************************************
+                          ICM_20948
+***************************************************************/
+// Polled reads and the INT pin see the newest sample of the trace; the FIFO holds every sample since
+// it was last reset or read (21 byte records, stops at 512 bytes like snapshot mode); the DMP hands
+// out the attitude of each sample as a 6 and 9 axis quaternion
+
+namespace Host {
+  const uint16_t FIFO_RECORD_BYTES = 21;
+  const uint16_t FIFO_BYTES = 512;
+  size_t trace_cursor = 0;
+  long polled_sample = -1;      // newest sample getAGMT() has handed out
+  long fifo_oldest = 0;         // oldest sample in the fifo
+  uint16_t fifo_offset = 0;     // bytes of it already read
+  long fifo_taken = -1;         // newest sample the fifo took before it filled up
+  long dmp_next = 0;            // next sample the DMP hands out
+  unsigned bus_error_divider = 0;
+  unsigned long data_reads = 0; // reads of the ICM's data, counted for bus_error_divider
+}
+
+/** @return true if this read of the ICM's data is one bus_error_divider makes fail */
+static bool BusError()
+{
+  Host::data_reads++;
+  return Host::bus_error_divider > 0 && Host::data_reads % Host::bus_error_divider == 0;
+}
+
+long Host::NewestSample()
+{
+  const std::vector<TraceSample>& s = trace.samples;
+  if (s.empty() || now_us < s[0].t_us) {
+    return -1;
+  }
+  // time only moves forward, so the cursor does too
+  while (trace_cursor + 1 < s.size() && s[trace_cursor + 1].t_us <= now_us) {
+    trace_cursor++;
+  }
+  return (long)trace_cursor;
+}
+
+bool Host::TraceDone()
+{
+  return trace.samples.empty() || now_us > trace.samples.back().t_us;
+}
+
+/** @brief The bytes of a sample as a fifo record: accel and gyro big-endian, then the mag block (ST1, X, Y, Z little-endian, TMPS, ST2) */
+static void EncodeFIFORecord(const Host::TraceSample& sample, uint8_t record[Host::FIFO_RECORD_BYTES])
+{
+  for (int i = 0; i < 3; i++) {
+    record[2 * i] = (uint8_t)(sample.acc[i] >> 8);
+    record[2 * i + 1] = (uint8_t)sample.acc[i];
+    record[6 + 2 * i] = (uint8_t)(sample.gyr[i] >> 8);
+    record[7 + 2 * i] = (uint8_t)sample.gyr[i];
+    record[13 + 2 * i] = (uint8_t)sample.mag[i];
+    record[14 + 2 * i] = (uint8_t)(sample.mag[i] >> 8);
+  }
+  record[12] = 0x01; // ST1 DRDY
+  record[19] = 0x00;
+  record[20] = 0x00;
+}
+
+/**
+ * @brief Lets the simulated time pass that a register read of the ICM takes on its bus: on I2C the address, 
+ * register and repeated start come first and every byte is 9 clocks, on SPI the register byte comes first and 
+ * a byte is 8 clocks, plus a couple of microseconds of chip select either way
+ */
+static void BusTime(const ICM_20948& icm, uint32_t bytes)
+{
+  uint64_t bits = icm.host_bus_spi? (1 + bytes) * 8ULL : (3 + bytes) * 9ULL;
+  Host::Advance(bits * 1000000ULL / icm.host_bus_hz + (icm.host_bus_spi? 2 : 0));
+}
+
+bool ICM_20948::dataReady()
+{
+  BusTime(*this, 1); // INT_STATUS_1
+  status = ICM_20948_Stat_Ok;
+  return Host::NewestSample() > Host::polled_sample;
+}
+
+ICM_20948_AGMT_t ICM_20948::getAGMT()
+{
+  BusTime(*this, 23); // accel, gyro, temperature and the 9 bytes of the mag in one burst
+  long newest = Host::NewestSample();
+  memset(&agmt, 0, sizeof(agmt));
+  if (newest >= 0) {
+    const Host::TraceSample& sample = Host::trace.samples[newest];
+    memcpy(agmt.acc.i16bit, sample.acc, sizeof(sample.acc));
+    memcpy(agmt.gyr.i16bit, sample.gyr, sizeof(sample.gyr));
+    memcpy(agmt.mag.i16bit, sample.mag, sizeof(sample.mag));
+  }
+  Host::polled_sample = newest;
+  status = ICM_20948_Stat_Ok;
+  return agmt;
+}
+
+ICM_20948_Status_e ICM_20948::read(uint8_t reg, uint8_t* data, uint32_t len)
+{
+  BusTime(*this, len);
+  memset(data, 0, len);
+  // bank 0 from ACCEL_XOUT_H: accel and gyro big-endian, the temperature, then the mag block like in a fifo record
+  const uint8_t FIRST = AGB0_REG_ACCEL_XOUT_H;
+  const uint8_t DATA_BYTES = 23;
+  long newest = Host::NewestSample();
+  if (newest < 0 || reg < FIRST || reg >= FIRST + DATA_BYTES) {
+    return status = ICM_20948_Stat_Ok;
+  }
+  if (BusError()) {
+    memset(data, 0xA5, len); // and the data ready flag stays set
+    return status = ICM_20948_Stat_Err;
+  }
+  uint8_t fifo_record[Host::FIFO_RECORD_BYTES];
+  EncodeFIFORecord(Host::trace.samples[newest], fifo_record);
+  uint8_t regs[DATA_BYTES] = {0};
+  memcpy(regs, fifo_record, 12);
+  memcpy(regs + 14, fifo_record + 12, 9);
+  for (uint32_t i = 0; i < len && reg + i < FIRST + DATA_BYTES; i++) {
+    data[i] = regs[reg - FIRST + i];
+  }
+  if (reg == FIRST) {
+    Host::polled_sample = newest; // reading the accel clears the data ready flag
+  }
+  return status = ICM_20948_Stat_Ok;
+}
+
+/** @brief Lets the fifo take the samples that came in since it was last looked at, as long as there is room */
+static void FillFIFO()
+{
+  long newest = Host::NewestSample();
+  long room = (Host::FIFO_BYTES + Host::fifo_offset) / Host::FIFO_RECORD_BYTES;
+  long last = Host::fifo_oldest + room - 1;
+  if (Host::fifo_taken < newest) {
+    Host::fifo_taken = (newest < last)? newest : last;
+  }
+}
+
+ICM_20948_Status_e ICM_20948::resetFIFO()
+{
+  Host::fifo_oldest = Host::NewestSample() + 1;
+  Host::fifo_offset = 0;
+  Host::fifo_taken = Host::fifo_oldest - 1;
+  return status = ICM_20948_Stat_Ok;
+}
+
+ICM_20948_Status_e ICM_20948::getFIFOcount(uint16_t* count)
+{
+  BusTime(*this, 2);
+  FillFIFO();
+  long bytes = (Host::fifo_taken - Host::fifo_oldest + 1) * Host::FIFO_RECORD_BYTES - Host::fifo_offset;
+  *count = (bytes < 0)? 0 : ((bytes > Host::FIFO_BYTES)? Host::FIFO_BYTES : (uint16_t)bytes);
+  return status = ICM_20948_Stat_Ok;
+}
+
+ICM_20948_Status_e ICM_20948::readFIFO(uint8_t* data, uint8_t len)
+{
+  BusTime(*this, len);
+  FillFIFO();
+  bool error = BusError(); // the bytes leave the fifo all the same
+  for (uint8_t i = 0; i < len; i++) {
+    if (Host::fifo_oldest > Host::fifo_taken) {
+      data[i] = 0xFF; // reading an empty fifo hands out junk
+      continue;
+    }
+    uint8_t record[Host::FIFO_RECORD_BYTES];
+    EncodeFIFORecord(Host::trace.samples[Host::fifo_oldest], record);
+    data[i] = record[Host::fifo_offset++];
+    if (Host::fifo_offset == Host::FIFO_RECORD_BYTES) {
+      Host::fifo_offset = 0;
+      Host::fifo_oldest++;
+    }
+  }
+  if (error) {
+    memset(data, 0xA5, len);
+    return status = ICM_20948_Stat_Err;
+  }
+  return status = ICM_20948_Stat_Ok;
+}
+
+ICM_20948_Status_e ICM_20948::readDMPdataFromFIFO(icm_20948_DMP_data_t* data)
+{
+  BusTime(*this, 2 + 2 + 6 + 14); // fifo count, header, raw accel and a quaternion with its accuracy
+  long newest = Host::NewestSample();
+  if (Host::dmp_next > newest) {
+    return status = ICM_20948_Stat_FIFONoDataAvail;
+  }
+  const Host::TraceSample& sample = Host::trace.samples[Host::dmp_next++];
+  memset(data, 0, sizeof(*data));
+  data->header = DMP_header_bitmap_Quat6 | DMP_header_bitmap_Quat9 | DMP_header_bitmap_Gyro | DMP_header_bitmap_Accel;
+  // w is left out, so the DMP keeps it positive
+  float sign = (sample.q[0] < 0.0f)? -1.0f : 1.0f;
+  int32_t q[3];
+  for (int i = 0; i < 3; i++) {
+    q[i] = (int32_t)lround(sign * sample.q[i + 1] * 1073741824.0);
+  }
+  data->Quat6.Data.Q1 = data->Quat9.Data.Q1 = q[0];
+  data->Quat6.Data.Q2 = data->Quat9.Data.Q2 = q[1];
+  data->Quat6.Data.Q3 = data->Quat9.Data.Q3 = q[2];
+  // initializeDMP puts the accel at +-4g, half the counts of the +-2g the trace is in
+  data->Raw_Accel.Data.X = sample.acc[0] / 2;
+  data->Raw_Accel.Data.Y = sample.acc[1] / 2;
+  data->Raw_Accel.Data.Z = sample.acc[2] / 2;
+  data->Raw_Gyro.Data.X = sample.gyr[0];
+  data->Raw_Gyro.Data.Y = sample.gyr[1];
+  data->Raw_Gyro.Data.Z = sample.gyr[2];
+  return status = (Host::dmp_next <= newest)? ICM_20948_Stat_FIFOMoreDataAvail : ICM_20948_Stat_Ok;
+}
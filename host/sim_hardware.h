@@ -0,0 +1,61 @@
+// Simulated board for the host build: the clock, the UART, the INT pin, the log flash, the EEPROM
+// and an ICM_20948 that plays back a trace of samples
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace Host {
+  /** @brief one sample of a trace, all in raw sensor counts as the ICM puts them in its registers */
+  struct TraceSample {
+    uint32_t t_us;       // time since the trace started
+    int16_t acc[3];      // accel counts, +-2g (16.384 per mg)
+    int16_t gyr[3];      // gyro counts, +-250dps (131 per dps)
+    int16_t mag[3];      // AK09916 counts in its own axes (0.15uT each)
+    float q[4];          // attitude the sample was taken at (w, x, y, z), if the trace has one
+  };
+
+  /** @brief a trace the simulated ICM plays back from power on */
+  struct Trace {
+    std::vector<TraceSample> samples;
+    bool has_attitude = false;   // q of the samples is known (synthetic truth, or the attitude a flight log recorded)
+  };
+
+  extern Trace trace;
+
+  // simulated time; every millis() / micros() call costs call_cost_us, as if reading the clock took that long
+  extern uint64_t now_us;
+  extern uint32_t call_cost_us;
+  extern uint64_t deadline_us;   // micros() past this means the sketch is stuck waiting on something, the run is stopped
+
+  void Advance(uint64_t us);
+
+  /** @return Index of the newest trace sample at the current time, -1 before the first */
+  long NewestSample();
+  /** @return true once the current time is past the last sample of the trace */
+  bool TraceDone();
+
+  // ICM bus faults: every bus_error_divider th read of the ICM's data fails (ICM_20948_Stat_Err and junk bytes
+  // instead of the data, like an I2C NACK halfway through), 0 for none
+  extern unsigned bus_error_divider;
+
+  // INT pin: the runner calls this after every loop(), it runs the attached interrupt once per new sample
+  void PollInterrupts();
+
+  // UART
+  void SetSerialOutput(FILE* out);
+  /** @brief Queues bytes for the sketch to receive, they come in at the baud rate once at_us has passed */
+  void QueueSerialInput(const uint8_t* bytes, size_t len, uint64_t at_us);
+  /** @return Bytes lost because the sketch did not read the receive buffer in time */
+  unsigned long SerialOverflows();
+  unsigned long SerialBytesWritten();
+
+  // log flash (8MB W25Q64) and EEPROM images, so a run can start from and leave behind the contents of the chips
+  bool LoadFlash(const char* path);
+  bool SaveFlash(const char* path);
+  bool LoadEEPROM(const char* path);
+  bool SaveEEPROM(const char* path);
+
+  // called when the deadline is hit, set by the runner so the outputs still get closed
+  extern void (*on_stuck)();
+}
@@ -0,0 +1,81 @@
+// Host stand-in for the parts of the Arduino core main.cpp uses.
+// Time is simulated (see sim_hardware.h): it only moves when the sketch asks for it or delays,
+// so a run goes as fast as the PC can execute the code and is the same every time.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+void attachInterrupt(int interrupt, void (*isr)(), int mode);
+void detachInterrupt(int interrupt);
+void noInterrupts();
+void interrupts();
+
+// no separate program memory on the host
+#define PROGMEM
+#define memcpy_P memcpy
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#define pgm_read_float(address) (*(const float*)(address))
+#define F(string) (string)
+
+/**
+ * @brief The UART; written bytes go out at the baud rate given to begin() in simulated time, through a
+ * 64 byte transmit buffer like the AVR core's, and writing to a full buffer waits for room
+ */
+class HardwareSerial {
+public:
+  void begin(unsigned long baud);
+  void end() {}
+  operator bool() { return true; }
+
+  size_t write(uint8_t b);
+  size_t write(const uint8_t* data, size_t len);
+  int availableForWrite();
+  void flush();
+
+  int available();
+  int read();
+  int peek();
+
+  size_t print(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value) { return printf_("%d", value); }
+  size_t print(unsigned int value) { return printf_("%u", value); }
+  size_t print(long value) { return printf_("%ld", value); }
+  size_t print(unsigned long value) { return printf_("%lu", value); }
+  size_t print(double value, int digits = 2) { return printf_("%.*f", digits, value); }
+  template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+  size_t println(double value, int digits) { size_t n = print(value, digits); return n + println(); }
+  size_t println() { return print("\r\n"); }
+
+private:
+  size_t printf_(const char* format, ...);
+};
+
+extern HardwareSerial Serial;
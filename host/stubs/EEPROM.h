@@ -0,0 +1,20 @@
+// Host stand-in for the Arduino EEPROM library, 4KB like the ATmega2560; erased (0xFF) unless
+// the runner loads an image into it (--eeprom)
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+struct EEPROMClass {
+  static const int SIZE = 4096;
+  uint8_t data[SIZE];
+  EEPROMClass() { memset(data, 0xFF, sizeof(data)); }
+  void begin(size_t /*size*/) {}
+  bool commit() { return true; }
+  int length() { return SIZE; }
+  uint8_t read(int address) { return data[address]; }
+  void write(int address, uint8_t value) { data[address] = value; }
+  template <typename T> T& get(int address, T& value) { memcpy(&value, data + address, sizeof(T)); return value; }
+  template <typename T> const T& put(int address, const T& value) { memcpy(data + address, &value, sizeof(T)); return value; }
+};
+
+extern EEPROMClass EEPROM;
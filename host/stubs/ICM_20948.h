@@ -0,0 +1,196 @@
+// Host stand-in for the SparkFun ICM_20948 library. Only the types and calls main.cpp uses are here;
+// the samples come from the trace the runner loaded (see sim_hardware.h), so polling, the INT pin,
+// the FIFO and the DMP all see the same readings at the same simulated times
+#pragma once
+#include "Arduino.h"
+#include "Wire.h"
+#include "SPI.h"
+
+typedef enum {
+  ICM_20948_Stat_Ok = 0x00,
+  ICM_20948_Stat_Err,
+  ICM_20948_Stat_NotImpl,
+  ICM_20948_Stat_ParamErr,
+  ICM_20948_Stat_WrongID,
+  ICM_20948_Stat_InvalSensor,
+  ICM_20948_Stat_NoData,
+  ICM_20948_Stat_SensorNotSupported,
+  ICM_20948_Stat_DMPNotSupported,
+  ICM_20948_Stat_DMPVerifyFail,
+  ICM_20948_Stat_FIFONoDataAvail,
+  ICM_20948_Stat_FIFOIncompleteData,
+  ICM_20948_Stat_FIFOMoreDataAvail,
+  ICM_20948_Stat_UnrecognisedDMPHeader,
+  ICM_20948_Stat_UnrecognisedDMPHeader2,
+  ICM_20948_Stat_InvalDMPRegister,
+} ICM_20948_Status_e;
+
+typedef union {
+  int16_t i16bit[3];
+  uint8_t u8bit[6];
+  struct { int16_t x, y, z; } axes;
+} ICM_20948_axis3named_t;
+
+typedef struct {
+  uint8_t a : 2;
+  uint8_t g : 2;
+  uint8_t reserved_0 : 4;
+} ICM_20948_fss_t;
+
+typedef struct {
+  uint16_t a;
+  uint8_t g;
+} ICM_20948_smplrt_t;
+
+typedef struct {
+  ICM_20948_axis3named_t acc;
+  ICM_20948_axis3named_t gyr;
+  ICM_20948_axis3named_t mag;
+  union { int16_t i16bit[1]; uint8_t u8bit[2]; } tmp;
+  ICM_20948_fss_t fss;
+} ICM_20948_AGMT_t;
+
+typedef enum { gpm2 = 0x00, gpm4, gpm8, gpm16 } ICM_20948_ACCEL_CONFIG_FS_SEL_e;
+typedef enum { dps250 = 0x00, dps500, dps1000, dps2000 } ICM_20948_GYRO_CONFIG_1_FS_SEL_e;
+
+typedef enum {
+  ICM_20948_Internal_Acc = (1 << 0),
+  ICM_20948_Internal_Gyr = (1 << 1),
+  ICM_20948_Internal_Mag = (1 << 2),
+  ICM_20948_Internal_Tmp = (1 << 3),
+  ICM_20948_Internal_Mst = (1 << 4),
+} ICM_20948_InternalSensorID_bm;
+
+typedef enum {
+  ICM_20948_Sample_Mode_Continuous = 0x00,
+  ICM_20948_Sample_Mode_Cycled,
+} ICM_20948_LP_CONFIG_CYCLE_e;
+
+typedef enum {
+  AGB0_REG_ACCEL_XOUT_H = 0x2D,
+  AGB0_REG_EXT_SLV_SENS_DATA_00 = 0x3B,
+  AGB0_REG_FIFO_EN_1 = 0x66,
+  AGB0_REG_FIFO_EN_2 = 0x67,
+} ICM_20948_Reg_Addr_e;
+
+// the library only has the DMP when ICM_20948_USE_DMP is set in ICM_20948_C.h, the simulation always has it
+#define ICM_20948_USE_DMP
+
+enum inv_icm20948_sensor {
+  INV_ICM20948_SENSOR_ACCELEROMETER = 0,
+  INV_ICM20948_SENSOR_GYROSCOPE,
+  INV_ICM20948_SENSOR_RAW_ACCELEROMETER,
+  INV_ICM20948_SENSOR_RAW_GYROSCOPE,
+  INV_ICM20948_SENSOR_MAGNETIC_FIELD_UNCALIBRATED,
+  INV_ICM20948_SENSOR_GYROSCOPE_UNCALIBRATED,
+  INV_ICM20948_SENSOR_ACTIVITY_CLASSIFICATON,
+  INV_ICM20948_SENSOR_STEP_DETECTOR,
+  INV_ICM20948_SENSOR_STEP_COUNTER,
+  INV_ICM20948_SENSOR_GAME_ROTATION_VECTOR,
+  INV_ICM20948_SENSOR_ROTATION_VECTOR,
+};
+
+enum DMP_ODR_Registers {
+  DMP_ODR_Reg_Accel,
+  DMP_ODR_Reg_Gyro,
+  DMP_ODR_Reg_Cpass,
+  DMP_ODR_Reg_ALS,
+  DMP_ODR_Reg_Quat6,
+  DMP_ODR_Reg_Quat9,
+  DMP_ODR_Reg_PQuat6,
+  DMP_ODR_Reg_Geomag,
+  DMP_ODR_Reg_Pressure,
+  DMP_ODR_Reg_Gyro_Calibr,
+  DMP_ODR_Reg_Cpass_Calibr,
+};
+
+#define DMP_header_bitmap_Header2 0x0008
+#define DMP_header_bitmap_Step_Detector 0x0010
+#define DMP_header_bitmap_Compass_Calibr 0x0020
+#define DMP_header_bitmap_Gyro_Calibr 0x0040
+#define DMP_header_bitmap_Pressure 0x0080
+#define DMP_header_bitmap_Geomag 0x0100
+#define DMP_header_bitmap_PQuat6 0x0200
+#define DMP_header_bitmap_Quat9 0x0400
+#define DMP_header_bitmap_Quat6 0x0800
+#define DMP_header_bitmap_ALS 0x1000
+#define DMP_header_bitmap_Compass 0x2000
+#define DMP_header_bitmap_Gyro 0x4000
+#define DMP_header_bitmap_Accel 0x8000
+
+typedef struct {
+  uint16_t header;
+  uint16_t header2;
+  struct { struct { int16_t X, Y, Z; } Data; } Raw_Accel;
+  struct { struct { int16_t X, Y, Z, BiasX, BiasY, BiasZ; } Data; } Raw_Gyro;
+  struct { struct { int32_t Q1, Q2, Q3; } Data; } Quat6;
+  struct { struct { int32_t Q1, Q2, Q3; int16_t Accuracy; } Data; } Quat9;
+} icm_20948_DMP_data_t;
+
+class ICM_20948 {
+public:
+  ICM_20948_Status_e status = ICM_20948_Stat_Ok;
+  ICM_20948_AGMT_t agmt;
+  // not in the library: the bus the chip was started on, reads take the bus time they would on it
+  uint32_t host_bus_hz = 100000;
+  bool host_bus_spi = false;
+
+  // reading, see sim_hardware.cpp
+  bool dataReady();
+  ICM_20948_AGMT_t getAGMT();
+  ICM_20948_Status_e read(uint8_t reg, uint8_t* data, uint32_t len);
+  ICM_20948_Status_e write(uint8_t /*reg*/, uint8_t* /*data*/, uint32_t /*len*/) { return status = ICM_20948_Stat_Ok; }
+  float accX() { return agmt.acc.axes.x / 16.384f; }
+  float accY() { return agmt.acc.axes.y / 16.384f; }
+  float accZ() { return agmt.acc.axes.z / 16.384f; }
+  float gyrX() { return agmt.gyr.axes.x / 131.0f; }
+  float gyrY() { return agmt.gyr.axes.y / 131.0f; }
+  float gyrZ() { return agmt.gyr.axes.z / 131.0f; }
+  float magX() { return agmt.mag.axes.x * 0.15f; }
+  float magY() { return agmt.mag.axes.y * 0.15f; }
+  float magZ() { return agmt.mag.axes.z * 0.15f; }
+
+  // configuration, the simulated chip takes everything
+  ICM_20948_Status_e setBank(uint8_t /*bank*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e setFullScale(uint8_t /*sensors*/, ICM_20948_fss_t /*fss*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e setSampleMode(uint8_t /*sensors*/, uint8_t /*mode*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e setSampleRate(uint8_t /*sensors*/, ICM_20948_smplrt_t /*smplrt*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e cfgIntActiveLow(bool /*active_low*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e cfgIntOpenDrain(bool /*open_drain*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e cfgIntLatch(bool /*latching*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e intEnableRawDataReady(bool /*enable*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e clearInterrupts() { return status = ICM_20948_Stat_Ok; }
+
+  // fifo
+  ICM_20948_Status_e setFIFOmode(bool /*snapshot*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e enableFIFO(bool /*enable*/ = true) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e resetFIFO();
+  ICM_20948_Status_e getFIFOcount(uint16_t* count);
+  ICM_20948_Status_e readFIFO(uint8_t* data, uint8_t len = 1);
+
+  // dmp
+  ICM_20948_Status_e initializeDMP() { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e enableDMP(bool /*enable*/ = true) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e resetDMP() { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e enableDMPSensor(enum inv_icm20948_sensor /*sensor*/, bool /*enable*/ = true) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e setDMPODRrate(enum DMP_ODR_Registers /*odr_reg*/, int /*interval*/) { return status = ICM_20948_Stat_Ok; }
+  ICM_20948_Status_e readDMPdataFromFIFO(icm_20948_DMP_data_t* data);
+};
+
+class ICM_20948_I2C : public ICM_20948 {
+public:
+  ICM_20948_Status_e begin(TwoWire& wire = Wire, bool /*ad0_val*/ = true) {
+    host_bus_hz = wire.clock;
+    host_bus_spi = false;
+    return status = ICM_20948_Stat_Ok;
+  }
+};
+
+class ICM_20948_SPI : public ICM_20948 {
+public:
+  ICM_20948_Status_e begin(uint8_t /*cs_pin*/, SPIClass& /*spi*/ = SPI, uint32_t spi_hz = 7000000) {
+    host_bus_hz = spi_hz;
+    host_bus_spi = true;
+    return status = ICM_20948_Stat_Ok;
+  }
+};
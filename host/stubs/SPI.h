@@ -0,0 +1,27 @@
+// Host stand-in for the Arduino SPI library. The only device on the bus is the log flash, a simulated
+// 8MB W25Q64 (see sim_hardware.cpp); every beginTransaction / endTransaction pair is one chip select frame
+#pragma once
+#include <stdint.h>
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+struct SPISettings {
+  SPISettings() {}
+  SPISettings(uint32_t /*clock*/, uint8_t /*bit_order*/, uint8_t /*data_mode*/) {}
+};
+
+class SPIClass {
+public:
+  void begin() {}
+  void end() {}
+  void beginTransaction(SPISettings settings);
+  void endTransaction();
+  uint8_t transfer(uint8_t data);
+};
+
+extern SPIClass SPI;
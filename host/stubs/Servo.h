@@ -0,0 +1,15 @@
+// Host stand-in for the Arduino Servo library, keeps the last pulse written
+#pragma once
+#include "Arduino.h"
+
+class Servo {
+public:
+  uint8_t attach(int pin) { this->pin = pin; return 0; }
+  void detach() { pin = -1; }
+  bool attached() { return pin >= 0; }
+  void writeMicroseconds(int value) { pulse_us = value; writes++; }
+  int readMicroseconds() { return pulse_us; }
+  int pin = -1;
+  int pulse_us = 1500;
+  unsigned long writes = 0;
+};
@@ -0,0 +1,12 @@
+// Host stand-in for the Arduino Wire library; nothing is on the bus, the ICM is simulated as a whole (see ICM_20948.h)
+#pragma once
+#include "Arduino.h"
+
+class TwoWire {
+public:
+  void begin() {}
+  void setClock(uint32_t clock) { this->clock = clock; }
+  uint32_t clock = 100000;
+};
+
+extern TwoWire Wire;
@@ -0,0 +1,260 @@
+// IMU traces for the host build, see trace.h
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "trace.h"
+
+// the scales main.cpp reads the sensors with
+static const float ACC_LSB_PER_MG = 16.384f;
+static const float GYR_LSB_PER_DPS = 131.0f;
+static const float MAG_UT_PER_LSB = 0.15f;
+// the AK09916 y and z axes are the other way around from the accel and gyro (MAG_AXIS_SIGN in main.cpp)
+static const float MAG_AXIS_SIGN[3] = {1.0f, -1.0f, -1.0f};
+
+/***************************************************************
+                        SYNTHETIC
+***************************************************************/
+// World frame is x north, y west, z up. The attitude q turns body vectors into world vectors, so what a
+// sensor reads is the world vector turned back by q. The rocket's long axis is body x, like in main.cpp
+
+const float Host::GRAVITY_MG[3] = {0.0f, 0.0f, 1000.0f};
+const float Host::EARTH_FIELD_UT[3] = {25.0f, 0.0f, -43.0f}; // about Texas
+
+static int16_t ToCounts(float value)
+{
+  long counts = lroundf(value);
+  return (int16_t)((counts > 32767)? 32767 : ((counts < -32768)? -32768 : counts));
+}
+
+Host::SensorModel::SensorModel(const SyntheticSettings& settings) : settings(settings), noise(settings.seed) {}
+
+void Host::SensorModel::Sense(uint32_t t_us, const float q[4], const float body_rate[3], const float specific_force_mg[3], TraceSample& sample_ret)
+{
+  float mag[3];
+  WorldToBody(q, EARTH_FIELD_UT, mag);
+  sample_ret.t_us = t_us;
+  for (int a = 0; a < 3; a++) {
+    float gyr_dps = body_rate[a] * RAD2DEG_F + settings.gyro_bias_dps[a];
+    sample_ret.acc[a] = ToCounts((specific_force_mg[a] + 2.0f * settings.noise * noise.Gaussian()) * ACC_LSB_PER_MG);
+    sample_ret.gyr[a] = ToCounts((gyr_dps + 0.05f * settings.noise * noise.Gaussian()) * GYR_LSB_PER_DPS);
+    sample_ret.mag[a] = ToCounts(MAG_AXIS_SIGN[a] * (mag[a] + 0.4f * settings.noise * noise.Gaussian()) / MAG_UT_PER_LSB);
+  }
+  memcpy(sample_ret.q, q, sizeof(sample_ret.q));
+}
+
+/** @brief what the rocket does at one time of a profile */
+struct Motion {
+  float body_rate[3];      // rad/s
+  bool at_rest;            // true: the accel only reads gravity, false: it reads specific_force
+  float specific_force[3]; // mg, body frame
+};
+
+static const float PAD_S = 2.0f;
+static const float BOOST_S = 2.5f;
+
+static void FlightMotion(float t, Motion& m)
+{
+  memset(&m, 0, sizeof(m));
+  if (t < PAD_S) {
+    m.at_rest = true;
+    return;
+  }
+  float flight_t = t - PAD_S;
+  const float CONING_RAD_S = 0.3f;
+  const float CONING_HZ = 1.5f;
+  float coning = CONING_RAD_S * ((flight_t < 1.0f)? flight_t : 1.0f);
+  m.body_rate[1] = coning * sinf(2.0f * (float)Host::PI_D * CONING_HZ * flight_t);
+  m.body_rate[2] = coning * cosf(2.0f * (float)Host::PI_D * CONING_HZ * flight_t);
+  if (flight_t < BOOST_S) {
+    // the motor pushes along the long axis, the fins roll it up
+    m.specific_force[0] = 1950.0f;
+    m.body_rate[0] = 3.0f * flight_t / BOOST_S;
+  } else {
+    // coasting, only drag is felt and the roll dies out
+    m.specific_force[0] = -250.0f;
+    m.body_rate[0] = 3.0f * expf(-(flight_t - BOOST_S) / 1.5f);
+  }
+}
+
+bool Host::MakeSyntheticTrace(const char* profile, const SyntheticSettings& settings, Trace& trace_ret)
+{
+  bool spin = strcmp(profile, "spin") == 0;
+  bool flight = strcmp(profile, "flight") == 0;
+  if (!spin && !flight && strcmp(profile, "pad") != 0) {
+    return false;
+  }
+
+  float q[4];
+  if (spin) {
+    // tilted 20 degrees, turning about the vertical
+    QuatFromAxisAngle(1.0f, 1.0f, 0.0f, 20.0f * DEG2RAD_F, q);
+  } else {
+    // nose up (body x up), pointing 30 degrees off north
+    float heading[4], nose_up[4];
+    QuatFromAxisAngle(0.0f, 0.0f, 1.0f, 30.0f * DEG2RAD_F, heading);
+    QuatFromAxisAngle(0.0f, 1.0f, 0.0f, -90.0f * DEG2RAD_F, nose_up);
+    QuatMultiply(heading, nose_up, q);
+  }
+
+  SensorModel sensors(settings);
+  float dt = 1.0f / settings.rate_hz;
+  size_t count = (size_t)(settings.duration_s * settings.rate_hz);
+  trace_ret.samples.clear();
+  trace_ret.samples.reserve(count);
+  trace_ret.has_attitude = true;
+  for (size_t i = 0; i < count; i++) {
+    float t = i * dt;
+    Motion m;
+    if (spin) {
+      memset(&m, 0, sizeof(m));
+      m.at_rest = true;
+      const float world_rate[3] = {0.0f, 0.0f, 0.5f};
+      WorldToBody(q, world_rate, m.body_rate);
+    } else if (flight) {
+      FlightMotion(t, m);
+    } else {
+      memset(&m, 0, sizeof(m));
+      m.at_rest = true;
+    }
+
+    float acc[3];
+    if (m.at_rest) {
+      WorldToBody(q, GRAVITY_MG, acc);
+    } else {
+      memcpy(acc, m.specific_force, sizeof(acc));
+    }
+    TraceSample sample;
+    sensors.Sense((uint32_t)(i * 1000000.0 / settings.rate_hz), q, m.body_rate, acc, sample);
+    trace_ret.samples.push_back(sample);
+    QuatIntegrate(q, m.body_rate, dt);
+  }
+  return true;
+}
+
+/***************************************************************
+                            CSV
+***************************************************************/
+
+static const char* const TRACE_COLUMNS[] = {
+  "timestamp_us",
+  "acc_x_mg", "acc_y_mg", "acc_z_mg",
+  "gyr_x_dps", "gyr_y_dps", "gyr_z_dps",
+  "mag_x_ut", "mag_y_ut", "mag_z_ut",
+  "q_w", "q_x", "q_y", "q_z"
+};
+static const int TRACE_COLUMN_COUNT = sizeof(TRACE_COLUMNS) / sizeof(TRACE_COLUMNS[0]);
+static const int TRACE_REQUIRED_COLUMNS = 10; // the attitude is optional
+
+/** @brief Splits a CSV line in place */
+static std::vector<char*> SplitCSV(char* line)
+{
+  std::vector<char*> fields;
+  line[strcspn(line, "\r\n")] = '\0';
+  char* field = line;
+  while (true) {
+    fields.push_back(field);
+    char* comma = strchr(field, ',');
+    if (comma == NULL) {
+      break;
+    }
+    *comma = '\0';
+    field = comma + 1;
+  }
+  return fields;
+}
+
+bool Host::LoadTrace(const char* path, Trace& trace_ret)
+{
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "host: cannot open trace %s\n", path);
+    return false;
+  }
+  char line[1024];
+  if (fgets(line, sizeof(line), f) == NULL) {
+    fclose(f);
+    fprintf(stderr, "host: trace %s is empty\n", path);
+    return false;
+  }
+
+  int column[TRACE_COLUMN_COUNT];
+  std::vector<char*> header = SplitCSV(line);
+  for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+    column[c] = -1;
+    for (size_t h = 0; h < header.size(); h++) {
+      if (strcmp(header[h], TRACE_COLUMNS[c]) == 0) {
+        column[c] = (int)h;
+      }
+    }
+    if (column[c] < 0 && c < TRACE_REQUIRED_COLUMNS) {
+      fclose(f);
+      fprintf(stderr, "host: trace %s has no %s column\n", path, TRACE_COLUMNS[c]);
+      return false;
+    }
+  }
+  trace_ret.has_attitude = (column[TRACE_REQUIRED_COLUMNS] >= 0);
+
+  trace_ret.samples.clear();
+  double first_us = 0.0, last_us = 0.0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    std::vector<char*> fields = SplitCSV(line);
+    double v[TRACE_COLUMN_COUNT] = {0.0};
+    for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+      if (column[c] >= 0 && column[c] < (int)fields.size()) {
+        v[c] = strtod(fields[column[c]], NULL);
+      }
+    }
+    if (trace_ret.samples.empty()) {
+      first_us = v[0];
+    } else if (v[0] < last_us) {
+      fprintf(stderr, "host: timestamps of %s go backwards after %zu samples, the rest is left out\n", path, trace_ret.samples.size());
+      break;
+    }
+    last_us = v[0];
+
+    TraceSample sample;
+    sample.t_us = (uint32_t)(v[0] - first_us);
+    for (int a = 0; a < 3; a++) {
+      sample.acc[a] = ToCounts((float)v[1 + a] * ACC_LSB_PER_MG);
+      sample.gyr[a] = ToCounts((float)v[4 + a] * GYR_LSB_PER_DPS);
+      sample.mag[a] = ToCounts((float)v[7 + a] / MAG_UT_PER_LSB);
+    }
+    sample.q[0] = trace_ret.has_attitude? (float)v[10] : 1.0f;
+    for (int c = 1; c < 4; c++) {
+      sample.q[c] = trace_ret.has_attitude? (float)v[10 + c] : 0.0f;
+    }
+    trace_ret.samples.push_back(sample);
+  }
+  fclose(f);
+  if (trace_ret.samples.empty()) {
+    fprintf(stderr, "host: trace %s has no samples\n", path);
+    return false;
+  }
+  return true;
+}
+
+bool Host::SaveTrace(const char* path, const Trace& trace)
+{
+  FILE* f = fopen(path, "w");
+  if (f == NULL) {
+    return false;
+  }
+  int columns = trace.has_attitude? TRACE_COLUMN_COUNT : TRACE_REQUIRED_COLUMNS;
+  for (int c = 0; c < columns; c++) {
+    fprintf(f, (c == 0)? "%s" : ",%s", TRACE_COLUMNS[c]);
+  }
+  fprintf(f, "\n");
+  for (size_t i = 0; i < trace.samples.size(); i++) {
+    const TraceSample& s = trace.samples[i];
+    fprintf(f, "%lu,%.2f,%.2f,%.2f,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f", (unsigned long)s.t_us,
+            s.acc[0] / ACC_LSB_PER_MG, s.acc[1] / ACC_LSB_PER_MG, s.acc[2] / ACC_LSB_PER_MG,
+            s.gyr[0] / GYR_LSB_PER_DPS, s.gyr[1] / GYR_LSB_PER_DPS, s.gyr[2] / GYR_LSB_PER_DPS,
+            s.mag[0] * MAG_UT_PER_LSB, s.mag[1] * MAG_UT_PER_LSB, s.mag[2] * MAG_UT_PER_LSB);
+    if (trace.has_attitude) {
+      fprintf(f, ",%.5f,%.5f,%.5f,%.5f", s.q[0], s.q[1], s.q[2], s.q[3]);
+    }
+    fprintf(f, "\n");
+  }
+  return fclose(f) == 0;
+}
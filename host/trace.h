@@ -0,0 +1,57 @@
+// IMU traces for the host build: CSV files (the columns tools/decode_flight_log.py writes) and synthetic flights
+#pragma once
+#include "sim_hardware.h"
+#include "host_math.h"
+
+namespace Host {
+  /** @brief settings of a synthetic trace */
+  struct SyntheticSettings {
+    float duration_s = 10.0f;
+    float rate_hz = 1000.0f;
+    float noise = 1.0f;          // scale of the sensor noise, 0 for clean readings
+    float gyro_bias_dps[3] = {0.4f, -0.3f, 0.2f};
+    uint32_t seed = 1;
+  };
+
+  /** @brief turns the motion of the rocket into sensor samples, with the noise and gyro bias of the settings */
+  class SensorModel {
+  public:
+    explicit SensorModel(const SyntheticSettings& settings);
+    /**
+     * @brief Makes the sample the ICM would read
+     * @param t_us Time of the sample
+     * @param q Attitude (w, x, y, z), turns body vectors into the world frame (x north, y west, z up)
+     * @param body_rate Body rates (rad/s)
+     * @param specific_force_mg What an ideal accel would read (mg, body frame), the acceleration without gravity
+     * @param sample_ret The sample
+     */
+    void Sense(uint32_t t_us, const float q[4], const float body_rate[3], const float specific_force_mg[3], TraceSample& sample_ret);
+  private:
+    SyntheticSettings settings;
+    Random noise;
+  };
+
+  // what the accel reads standing still and the earth's field, world frame
+  extern const float GRAVITY_MG[3];
+  extern const float EARTH_FIELD_UT[3];
+
+  /**
+   * @brief Makes a synthetic trace
+   * @param profile "pad" (standing on the rail), "spin" (tilted and turning, gravity only, for the estimators)
+   * or "flight" (pad, boost with a roll up, then a coast with coning)
+   * @param settings The settings
+   * @param trace_ret The trace
+   * @return false if the profile is unknown
+   */
+  bool MakeSyntheticTrace(const char* profile, const SyntheticSettings& settings, Trace& trace_ret);
+
+  /**
+   * @brief Loads a CSV trace; needs timestamp_us, acc_[xyz]_mg, gyr_[xyz]_dps, mag_[xyz]_ut and optionally q_[wxyz] columns,
+   * other columns are skipped. Time starts at the first row, a timestamp going backwards (the board rebooted) ends the trace
+   * @return false if the file could not be read or misses a column
+   */
+  bool LoadTrace(const char* path, Trace& trace_ret);
+
+  /** @brief Writes a trace as CSV in the same columns LoadTrace reads */
+  bool SaveTrace(const char* path, const Trace& trace);
+}
@@ -1,277 +1,4479 @@
-// Made by Dominick O'Hara
-// April 30, 2024
-
-// PINS FOR HARDWARE AND DEALING WITH ICM_20948
-// GND PIN TO GND ON ARDUINO
-// VIN PIN TO 5V PIN ON ARDUINO
-// DA PIN TO SDA PIN ON ARDUINO
-// CL PIN TO SCL PIN ON ARDUINO
-
-// MAKE SURE TO DO 
-//  Serial.println(Serial.paritytype());
-//  Serial.println(Serial.stopbits());
-// to figure out the parity and stop bits used by
-// the arduino. This is to make sure that the sim
-// uses the correct end bits and parity.
-// the parity value 0 is even, and 1 is odd
-// Although, it seems to work with the wrong end bits
-// and the serial library used in the sim dose not support 0 end bits
-// but it still reads serial data despite it being set to one
-
-#include <ICM_20948.h>
-#include <stdlib.h>
-#include <math.h>
-
-
-/***************************************************************
-                  CONSTANTS / MACROS
-***************************************************************/
-// uncomment #define SIM_MODE_ON to send data to serial so the simulation can recieve it;
-// if commented, project will compile for the actual rocket and actuate the servo-motors on the canards
-#define SIM_MODE_ON 
-// uncomment #define DEBUG if debugging -> this will enable console messages for issues or errors
-#define DEBUG
-#define AD0_VAL 1
-ICM_20948_I2C ICM_Obj;
-// PI is a macro which is defined somewhere; im not sure.
-// this just makes sure PI is defined if it is not present
-#ifndef PI
-#define PI 3.1415926535897932384626433832795f
-#endif
-const float DEG2RAD = PI / 180.0f;
-const float RAD2DEG = 180.0f / PI;
-const float PI2 = 2 * PI;
-
-/** @brief enum which stores the pin used to rotate each canard fin */
-enum CANARD {
-  CANARD_PIN_1 = 15, // SET TO ACTUAL PIN NUMBER
-  CANARD_PIN_2 = 15, // SET TO ACTUAL PIN NUMBER
-  CANARD_PIN_3 = 15, // SET TO ACTUAL PIN NUMBER
-  CANARD_PIN_4 = 15  // SET TO ACTUAL PIN NUMBER
-};
-
-
-/***************************************************************
-                    UTILITY FUNCTIONS
-***************************************************************/
-/**
- * @brief Converts a given array of floats into a string
- * If there is not enough room, it will not pack the remaining floats  
- *
- * @param str The C-String to store the floats
- * @param str_size The length of the string
- * @param floats The array of floats
- * @param float_c The amount of floats in the floats array
- * @param float_chars The amount of characters for each float
- */
-void PackFloatsInStr(char* str, size_t str_size, float* floats, size_t float_c, size_t float_chars) 
-{
-  const char* FORMAT = "%f";
-  for (int i = 0; i < float_c && str_size >= float_chars; i++) {
-      snprintf(str, str_size, FORMAT, floats[i]);
-      str_size -= float_chars;
-      str += float_chars;
-  }
-}
-
-/**
- * @brief makes sure that the degree measure is between 0 and 360
- * @param degrees A refrence to the degree measure
- */
-inline void fixDegree(float& degrees) {
-  degrees = (degrees < 0.0f)? degrees + 180.0f : degrees; // add half full rotation if negative
-  degrees = fabsf(degrees); // float absolute value func
-  degrees = fmodf(degrees, 360.0f); // float modulo func (% for integers) 
-}
-
-/**
- * @brief makes sure that the radian measure is between 0 and 2PI
- * @param radians A refrence to the radian measure
- */
-inline void fixRadian (float& radians) {
-  radians = (radians < 0.0f)? radians + PI : radians; // add half full rotation if negative
-  radians = fabsf(radians); // float absolute value func
-  radians = fmodf(radians, PI2); // float modulo func (% for integers)
-}
-
-
-/***************************************************************
-              ROCKET MANIPULATION / FUNCTIONS
-***************************************************************/
-/** 
- * @brief namespace that holds all the data of the rocket
- */
-namespace Rocket {
-  float pitch = 0.0f;
-  float roll = 0.0f;
-  float yaw = 0.0f;
-  float canard_rotations[4] = {0.0f};
-}
-
-/** 
- * @brief Sends the rocket data over serial; 
- * floats 0, 1, 2 are orientation, 
- * floats 3, 4, 5, 6 are canard fin rotations (radians) 
- */
-void SendDataToSerial()
-{
-  float float_data_arr[] = {
-    Rocket::pitch,
-    Rocket::roll,
-    Rocket::yaw,
-    Rocket::canard_rotations[0],
-    Rocket::canard_rotations[1],
-    Rocket::canard_rotations[2],
-    Rocket::canard_rotations[3]
-  };
-
-  const int FLOAT_CHARS = 8; // amount of characters used for each float
-  const int FLOAT_ARR_ELEMS = sizeof(float_data_arr) / sizeof(float); // amount of elements in the array 'float_data_arr'
-  const int DATA_STR_SIZE = FLOAT_CHARS * FLOAT_ARR_ELEMS + 1; // +1 for null terminator
-
-  char rocketDataStr[DATA_STR_SIZE] = { 0 };
-  PackFloatsInStr(rocketDataStr, DATA_STR_SIZE, float_data_arr, FLOAT_ARR_ELEMS, FLOAT_CHARS);
-  Serial.println(rocketDataStr);
-}
-
-/**
- * @param pitch Pitch angle in radians (x-axis)
- * @param roll Roll angle in radians (y-axis)
- * @param yaw Yaw angle in radians (z-axis)
- */
-inline void SetOrientation(float& pitch, float& roll, float& yaw) {
-  Rocket::pitch = pitch;
-  Rocket::roll = roll;
-  Rocket::yaw = yaw;
-}
-
-/**
- * @param pitch_ret refrence used to retrieve the pitch angle in radians (x-axis)
- * @param roll_ret refrence used to retrieve the roll angle in radians (y-axis)
- * @param yaw_ret refrence used to retrieve the yaw angle in radians (z-axis)
- */
-inline void GetOrientation(float& pitch_ret, float& roll_ret, float& yaw_ret) {
-  pitch_ret = Rocket::pitch;
-  roll_ret = Rocket::roll;
-  yaw_ret = Rocket::yaw;
-}
-
-/**
- * @brief Sets the new rotations (in radians) 
- * to the canard fins and makes sure each rot within 0 - 2PI
- * @param rad The 4 new rotations to the canard fins (in radians)
- */
-void SetCanardRotations(float rad[4]) {
-  for (int i = 0; i < 4; i++) {
-    fixRadian(rad[i]);
-    Rocket::canard_rotations[i] = rad[i];
-  }
-}
-
-/**
- * @brief Gets the orientation from the sensors and sets the orientation
- * @param deltaTime the time inbetween each loop itteration
- */
-void SetOrientationFromSensors(float deltaTime)
-{
-  if (ICM_Obj.dataReady())
-  {
-    ICM_Obj.getAGMT();
-    // equations from https://stackoverflow.com/questions/23009549/roll-pitch-yaw-calculation
-    float accX = ICM_Obj.accX();
-    float accY = ICM_Obj.accY();
-    float accZ = ICM_Obj.accZ();
-
-    float magX = ICM_Obj.magX();
-    float magY = ICM_Obj.magY();
-    float magZ = ICM_Obj.magZ();
-
-    float roll_a = atan2f(accY, accZ);
-    float pitch_a = atan2f(-accX, sqrt(accY*accY + accZ*accZ));
-    float yaw_m = atan2f(magY, magX);
-
-
-    // we use + as pitch roll and yaw are negative
-    float pitch = roll_a;//Rocket::pitch + pitchAcc * deltaTime;
-    float roll = roll_a;//Rocket::roll + rollAcc * deltaTime;
-    float yaw = yaw_m;//Rocket::yaw + yawAcc * deltaTime;
-    fixRadian(pitch);
-    fixRadian(roll);
-    fixRadian(yaw);
-    SetOrientation(pitch, roll, yaw);
-  }
-}
-
-/**
- * @brief Sends an electrical signal to rotate a 
- * servo-motor for the specific canard fin
- * @param canardPin The canard pin to actuate
- * @param radians The radian measure to rotate the canard fin
- */
-void ActuateCanard(CANARD canardPin, float radians)
-{
-  // canard fins take degrees, not radians -> convert to degrees
-  float degrees = radians * RAD2DEG;
-  // TODO write code to actuate the specific servo motor
-}
-
-
-/***************************************************************
-                ARDUINO ENTRY POINT / LOOP
-***************************************************************/
-unsigned long last_tick = 0;
-
-void StabilizationSystem(float deltaTime)
-{
-  for (int i = 0; i < 4; i++) {
-    // rotate each canard 24 degrees per second -> converts to radians
-    Rocket::canard_rotations[i] += 24.0f * DEG2RAD * deltaTime;
-    fixRadian(Rocket::canard_rotations[i]); // make sure radians are within bounds
-  }
-}
-
-void setup() {
-  // initalize serial and wire
-  Serial.begin(9600);
-  while (!Serial)
-    ;
-  Wire.begin();
-  Wire.setClock(400000);
-
-  bool init = false;
-  while (!init) {
-    ICM_Obj.begin(Wire, AD0_VAL);
-    if (ICM_Obj.status != ICM_20948_Stat_Ok) {
-      #ifdef DEBUG
-        Serial.println("Failed to init ICM, trying again...");
-      #endif
-      delay(100);
-    } else {
-      init = true;
-    }
-  }
-
-  // init last_tick so delta_time can be calculated
-  last_tick = millis();
-}
-
-
-void loop() {
-  // get delta time
-  unsigned long current_tick = millis();
-  float deltaTime = (current_tick - last_tick) / 1000.0f;
-  last_tick = current_tick;
-  SetOrientationFromSensors(deltaTime);
-  StabilizationSystem(deltaTime);
-  // send data to serial (if compiled to work with simulation)
-  #ifdef SIM_MODE_ON
-    SendDataToSerial();
-  // Actuate the Canard fins (rotate servos) (if compiled to work with actual rocket)
-  #else
-    ActuateCanard(CANARD_PIN_1, Rocket::canard_rotations[0]);
-    ActuateCanard(CANARD_PIN_2, Rocket::canard_rotations[1]);
-    ActuateCanard(CANARD_PIN_3, Rocket::canard_rotations[2]);
-    ActuateCanard(CANARD_PIN_4, Rocket::canard_rotations[3]);
-  #endif
-  delay(1);
+// Made by Dominick O'Hara
+// April 30, 2024
+
+// PINS FOR HARDWARE AND DEALING WITH ICM_20948
+// GND PIN TO GND ON ARDUINO
+// VIN PIN TO 5V PIN ON ARDUINO
+// DA PIN TO SDA PIN ON ARDUINO
+// CL PIN TO SCL PIN ON ARDUINO
+// INT PIN TO ICM_INT_PIN ON ARDUINO (only needed with ICM_DRDY_INTERRUPT)
+// with ICM_TRANSPORT_SPI instead of DA / CL:
+// SDO PIN TO MISO, SDA PIN TO MOSI, SCL PIN TO SCK AND CS PIN TO ICM_CS_PIN ON ARDUINO
+
+// MAKE SURE TO DO 
+//  Serial.println(Serial.paritytype());
+//  Serial.println(Serial.stopbits());
+// to figure out the parity and stop bits used by
+// the arduino. This is to make sure that the sim
+// uses the correct end bits and parity.
+// the parity value 0 is even, and 1 is odd
+// Although, it seems to work with the wrong end bits
+// and the serial library used in the sim dose not support 0 end bits
+// but it still reads serial data despite it being set to one
+
+#include <ICM_20948.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <SPI.h>
+#include <EEPROM.h>
+#if !defined(__AVR_ATmega2560__) && !defined(__AVR_ATmega1280__)
+#include <Servo.h>
+#endif
+
+
+/***************************************************************
+                  CONSTANTS / MACROS
+***************************************************************/
+// set SIM_MODE_ON to 1 to send data to serial so the simulation can recieve it;
+// 0 compiles the project for the actual rocket and actuates the servo-motors on the canards.
+// builds that pass their own SIM_MODE_ON or DEBUG (the host build, see host/Makefile) keep theirs
+#ifndef SIM_MODE_ON
+#define SIM_MODE_ON 1
+#endif
+// uncomment #define TELEMETRY_BINARY to send the sim compact binary frames (see TELEMETRY FRAMES) instead of ASCII floats;
+// uncomment #define TELEMETRY_FIXED_POINT as well to pack the payload as int16 (radians * 4096) instead of float32
+// uncomment #define TELEMETRY_DELTA as well to send only the changes of the fields picked by TELEMETRY_FIELD_MASK, each at
+// its TELEMETRY_FIELD_DIVIDER rate, as variable length ints (see TELEMETRY DELTA)
+// #define TELEMETRY_BINARY
+// #define TELEMETRY_FIXED_POINT
+// #define TELEMETRY_DELTA
+// uncomment #define COMMAND_LINK to take commands from the sim over serial (see COMMAND LINK): IMU samples in place 
+// of the ICM's for hardware in the loop runs, gain overrides, the telemetry rate and mode switches
+// #define COMMAND_LINK
+// set DEBUG to 1 to enable console messages for issues or errors
+#ifndef DEBUG
+#define DEBUG 1
+#endif
+// set ICM_TRANSPORT to pick the bus the ICM is read over, the sensor code is the same on each;
+// builds that pass their own ICM_TRANSPORT (the host build, see host/Makefile) keep theirs
+#define ICM_TRANSPORT_I2C 0     // I2C at 400kHz, what the ICM is rated for; a full AGMT read is about 600us of bus time
+#define ICM_TRANSPORT_I2C_FMP 1 // I2C at 1MHz (Fast-mode Plus), about 250us; past the ICM's 400kHz rating, so only
+                                // on boards whose Wire does 1MHz (not AVR), with short wires, and after a bench test
+#define ICM_TRANSPORT_SPI 2     // SPI at 7MHz on ICM_CS_PIN, about 30us; the log flash can share the bus
+#ifndef ICM_TRANSPORT
+#define ICM_TRANSPORT ICM_TRANSPORT_I2C
+#endif
+#define ICM_CS_PIN 49 // only used with ICM_TRANSPORT_SPI
+// uncomment #define ICM_DRDY_INTERRUPT to read the ICM when its INT pin signals a new sample instead of polling dataReady();
+// each sample is then timestamped in the interrupt so the sample latency and the true time between samples are known
+// #define ICM_DRDY_INTERRUPT
+#define ICM_INT_PIN 2 // must be an interrupt capable pin
+// set ESTIMATOR to pick how the orientation is estimated from the sensor samples (not used with ICM_DMP_MODE);
+// builds that pass their own ESTIMATOR (the host build, see host/Makefile) keep theirs
+#define ESTIMATOR_RAW 0     // accelerometer tilt and magnetometer heading of each sample on their own, no fusion
+#define ESTIMATOR_MAHONY 1  // Mahony filter: integrates the gyro, corrects it with the accel and mag and learns the gyro bias
+#ifndef ESTIMATOR
+#define ESTIMATOR ESTIMATOR_MAHONY
+#endif
+// uncomment #define MATH_FIXED_POINT on AVR boards (no FPU) to run the orientation and canard paths in integer math;
+// CORDIC atan2, integer sqrt and binary angles instead of soft-float atan2f, sqrt and fmodf (needs ESTIMATOR_RAW)
+// #define MATH_FIXED_POINT
+// uncomment #define FAST_MATH to use the bounded-error atan2 and inverse sqrt kernels (see FAST MATH) on the
+// sensor path instead of libm
+// #define FAST_MATH
+// uncomment #define BENCH_MODE_ON to run the microbenchmarks (see BENCHMARKS) once at startup and print the results
+// over serial as CSV, nothing else runs in this mode
+// #define BENCH_MODE_ON
+// uncomment #define PROFILE_ON to time the loop stages (see PROFILER) and send their min / mean / max and a
+// histogram over telemetry; the probes compile out when it is commented
+// #define PROFILE_ON
+// uncomment #define DUAL_CORE on ESP32 and RP2040 boards to run the sensor, control and actuation tasks on a core of
+// their own and telemetry, logging and status on the other one (see DUAL CORE), so the control loop does not wait on them
+// #define DUAL_CORE
+// uncomment #define ICM_FIFO_MODE to let the ICM queue every accel/gyro/mag sample in its FIFO and read them in bursts,
+// so samples produced while the loop is busy are not lost (cannot be combined with ICM_DRDY_INTERRUPT)
+// #define ICM_FIFO_MODE
+#define FIFO_BURST_SAMPLES 4    // most samples drained from the FIFO per loop itteration
+#define FIFO_SAMPLE_RATE_DIV 1  // gyro ODR = 1100Hz / (1 + div), accel uses the same divider
+// uncomment #define ICM_DMP_MODE to let the ICM's onboard DMP fuse the sensors and read its quaternions from the FIFO
+// instead of computing the orientation on the arduino; needs ICM_20948_USE_DMP uncommented in the library's ICM_20948_C.h
+// uncomment #define DMP_9_AXIS as well to fuse the magnetometer (rotation vector) instead of accel + gyro only (game rotation vector)
+// #define ICM_DMP_MODE
+// #define DMP_9_AXIS
+// uncomment #define FLIGHT_LOG to record the raw samples, attitude, canards and loop timing to a SPI NOR flash chip 
+// (W25Q series) on LOG_FLASH_CS_PIN, see FLIGHT LOG; tools/decode_flight_log.py turns a dump into CSV
+// uncomment #define LOG_DUMP_MODE as well to only serve the log over serial: send 'd' to dump it, 'e' to erase the chip
+// #define FLIGHT_LOG
+// #define LOG_DUMP_MODE
+#define LOG_FLASH_CS_PIN 53
+// uncomment #define CALIBRATION_MODE to fit the accel and mag corrections (see SENSOR CALIBRATION) instead of flying;
+// turn the rocket slowly through every orientation until it prints the result, which is saved to EEPROM
+// #define CALIBRATION_MODE
+// PI is a macro which is defined somewhere; im not sure.
+// this just makes sure PI is defined if it is not present
+#ifndef PI
+#define PI 3.1415926535897932384626433832795f
+#endif
+constexpr float DEG2RAD = PI / 180.0f;
+constexpr float RAD2DEG = 180.0f / PI;
+constexpr float PI2 = 2 * PI;
+#if defined(ICM_FIFO_MODE) && defined(ICM_DRDY_INTERRUPT)
+#error "ICM_FIFO_MODE and ICM_DRDY_INTERRUPT cannot be used together"
+#endif
+#if defined(ICM_DMP_MODE) && (defined(ICM_FIFO_MODE) || defined(ICM_DRDY_INTERRUPT))
+#error "ICM_DMP_MODE uses the FIFO itself, it cannot be used with ICM_FIFO_MODE or ICM_DRDY_INTERRUPT"
+#endif
+#if defined(MATH_FIXED_POINT) && (ESTIMATOR != ESTIMATOR_RAW || defined(ICM_DMP_MODE))
+#error "MATH_FIXED_POINT only covers the raw estimator, set ESTIMATOR to ESTIMATOR_RAW and do not use ICM_DMP_MODE"
+#endif
+#if defined(LOG_DUMP_MODE) && !defined(FLIGHT_LOG)
+#error "LOG_DUMP_MODE needs FLIGHT_LOG"
+#endif
+#if ICM_TRANSPORT != ICM_TRANSPORT_I2C && ICM_TRANSPORT != ICM_TRANSPORT_I2C_FMP && ICM_TRANSPORT != ICM_TRANSPORT_SPI
+#error "ICM_TRANSPORT must be ICM_TRANSPORT_I2C, ICM_TRANSPORT_I2C_FMP or ICM_TRANSPORT_SPI"
+#endif
+#if ICM_TRANSPORT == ICM_TRANSPORT_I2C_FMP && defined(__AVR__)
+#error "the AVR TWI does not do 1MHz reliably, use ICM_TRANSPORT_I2C or ICM_TRANSPORT_SPI on AVR boards"
+#endif
+#if ICM_TRANSPORT == ICM_TRANSPORT_SPI && defined(FLIGHT_LOG) && ICM_CS_PIN == LOG_FLASH_CS_PIN
+#error "the ICM and the log flash share the SPI bus, they need their own chip select pins"
+#endif
+#if defined(DUAL_CORE) && !defined(ESP32) && !defined(ARDUINO_ARCH_RP2040)
+#error "DUAL_CORE needs an ESP32 or RP2040 board"
+#endif
+#if defined(DUAL_CORE) && defined(PROFILE_ON)
+#error "the PROFILE_ON stats are not shared between the cores, profile a build without DUAL_CORE"
+#endif
+#if defined(DUAL_CORE) && ICM_TRANSPORT == ICM_TRANSPORT_SPI && defined(FLIGHT_LOG)
+#error "with DUAL_CORE the ICM and the log flash would use the SPI bus from both cores, use ICM_TRANSPORT_I2C or ICM_TRANSPORT_I2C_FMP"
+#endif
+#if defined(TELEMETRY_DELTA) && !defined(TELEMETRY_BINARY)
+#error "TELEMETRY_DELTA frames are binary, it needs TELEMETRY_BINARY"
+#endif
+#if defined(COMMAND_LINK) && defined(DUAL_CORE)
+#error "the COMMAND_LINK commands change the control path's state from the serial side, it cannot be used with DUAL_CORE"
+#endif
+#if defined(ICM_DMP_MODE) && !defined(ICM_20948_USE_DMP)
+#error "ICM_DMP_MODE needs ICM_20948_USE_DMP to be defined in the ICM library (ICM_20948_C.h)"
+#endif
+
+// the Mega drives the servos straight from its 16 bit timers, other boards go through the Servo library
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+#define SERVO_HW_TIMERS
+#endif
+
+/***************************************************************
+                    BUILD CONFIGURATION
+***************************************************************/
+// the toggles above are read once here into BuildConfig, and what depends on the board into its traits (the pins and
+// the servo driver). The code below picks its path from them at compile time, through a template specialized for 
+// each choice (the ICM bus, the math kernels, the telemetry encoder, the servo driver) or an if on a constant the 
+// compiler drops, so a build carries only the path it uses. These toggles stay behind #if on purpose:
+//  - SERVO_HW_TIMERS (the ServoOutput specializations), ICM_DMP_MODE and DUAL_CORE need what only some boards or 
+//    builds have: Servo.h is left out on the Mega (it would take timers 3 and 4 from OCR3A and OCR4A-C), the DMP code
+//    is only in a library built with ICM_20948_USE_DMP, std::atomic and setup1/loop1 only on the dual core cores;
+//    the path a build does not use would not compile there
+//  - FLIGHT_LOG, PROFILE_ON and COMMAND_LINK each add a task to tasks[], which sets TASK_COUNT and so the status
+//    frame, and each brings state (the log pages, the stage stats, the command parser) the Mega's 8KB of RAM should 
+//    not carry when it is off
+//  - MATH_FIXED_POINT changes the types of the controller and canard state, not only the code that uses them
+//  - ICM_FIFO_MODE, ICM_DRDY_INTERRUPT, BENCH_MODE_ON, CALIBRATION_MODE and LOG_DUMP_MODE change what setup() starts
+//    and bring their own state (the FIFO parser, the data ready ISR, the benchmarks, the calibration fit)
+// tools/size_report.py builds each configuration and reports its flash and RAM.
+
+/** @brief enum which stores how the state goes to the sim (see SendDataToSerial) */
+enum TELEMETRY_ENCODING {
+  TELEMETRY_ENCODING_ASCII = 0, // a line of floats
+  TELEMETRY_ENCODING_F32,       // TELEMETRY_FRAME_STATE_F32 frames
+  TELEMETRY_ENCODING_Q12,       // TELEMETRY_FRAME_STATE_Q12 frames
+  TELEMETRY_ENCODING_DELTA      // TELEMETRY_FRAME_STATE_DELTA frames
+};
+
+/** @brief enum which stores what makes the servo pulses */
+enum SERVO_DRIVER {
+  SERVO_DRIVER_LIBRARY = 0,     // the Servo library
+  SERVO_DRIVER_TIMERS           // the timer compare outputs of the Mega, no interrupts at all
+};
+
+/** @brief the wiring of the Mega; it drives the servos straight from its 16 bit timers */
+struct MegaBoard {
+  static constexpr SERVO_DRIVER SERVO = SERVO_DRIVER_TIMERS;
+  // canards 1 - 4, the timer compare outputs (OC4A, OC4B, OC4C, OC3A) so they cannot be moved;
+  // pins 2 and 3 (the rest of timer 3) are left free for the ICM INT pin
+  static constexpr uint8_t CANARD_PINS[4] = {6, 7, 8, 5};
+  static constexpr uint8_t ICM_AD0 = 1; // the ICM's AD0 jumper, 1 for I2C address 0x69
+  static constexpr uint8_t SERVO_TICKS_PER_US = 2; // the timer clock is the 16MHz clock / 8
+};
+constexpr uint8_t MegaBoard::CANARD_PINS[4];
+
+/** @brief the wiring of every other board, the servos go through the Servo library */
+struct ServoLibraryBoard {
+  static constexpr SERVO_DRIVER SERVO = SERVO_DRIVER_LIBRARY;
+  static constexpr uint8_t CANARD_PINS[4] = {6, 7, 8, 5}; // canards 1 - 4, any pin the Servo library can drive
+  static constexpr uint8_t ICM_AD0 = 1;
+  static constexpr uint8_t SERVO_TICKS_PER_US = 1; // Servo.writeMicroseconds takes microseconds
+};
+constexpr uint8_t ServoLibraryBoard::CANARD_PINS[4];
+
+#ifdef SERVO_HW_TIMERS
+typedef MegaBoard Board;
+#else
+typedef ServoLibraryBoard Board;
+#endif
+
+/** @brief the toggles of this build as constants */
+struct BuildConfig {
+  static constexpr bool SIM_MODE = SIM_MODE_ON;
+  static constexpr bool DEBUG_MESSAGES = DEBUG;
+  static constexpr uint8_t TRANSPORT = ICM_TRANSPORT;
+#ifdef FAST_MATH
+  static constexpr bool FAST_KERNELS = true;
+#else
+  static constexpr bool FAST_KERNELS = false;
+#endif
+#if defined(TELEMETRY_DELTA)
+  static constexpr TELEMETRY_ENCODING TELEMETRY = TELEMETRY_ENCODING_DELTA;
+#elif defined(TELEMETRY_BINARY) && defined(TELEMETRY_FIXED_POINT)
+  static constexpr TELEMETRY_ENCODING TELEMETRY = TELEMETRY_ENCODING_Q12;
+#elif defined(TELEMETRY_BINARY)
+  static constexpr TELEMETRY_ENCODING TELEMETRY = TELEMETRY_ENCODING_F32;
+#else
+  static constexpr TELEMETRY_ENCODING TELEMETRY = TELEMETRY_ENCODING_ASCII;
+#endif
+  static constexpr SERVO_DRIVER SERVO = Board::SERVO;
+  // the binary frames keep up with the control loop, which 9600 baud cannot do (see the link budget in 
+  // TASK SCHEDULER); the sim has to open the port with the same baud rate
+#if defined(TELEMETRY_BINARY)
+  static constexpr unsigned long BAUD = 500000;
+#elif defined(LOG_DUMP_MODE)
+  static constexpr unsigned long BAUD = 250000;
+#else
+  static constexpr unsigned long BAUD = 9600;
+#endif
+};
+
+/** @brief the ICM over I2C, at 400kHz or 1MHz */
+template <uint8_t TRANSPORT>
+struct IcmBus {
+  typedef ICM_20948_I2C Device;
+  static constexpr uint32_t CLOCK = (TRANSPORT == ICM_TRANSPORT_I2C_FMP)? 1000000 : 400000;
+  static void Begin() {
+    Wire.begin();
+    Wire.setClock(CLOCK);
+  }
+  static void Connect(Device& icm) { icm.begin(Wire, Board::ICM_AD0); }
+};
+
+/** @brief the ICM over SPI on ICM_CS_PIN */
+template <>
+struct IcmBus<ICM_TRANSPORT_SPI> {
+  typedef ICM_20948_SPI Device;
+  static constexpr uint32_t CLOCK = 7000000; // the ICM's SPI limit
+  static void Begin() { SPI.begin(); }
+  static void Connect(Device& icm) { icm.begin(ICM_CS_PIN, SPI, CLOCK); }
+};
+
+typedef IcmBus<BuildConfig::TRANSPORT> Icm;
+Icm::Device ICM_Obj;
+
+
+/***************************************************************
+                        FAST MATH
+***************************************************************/
+// atan2 and 1 / sqrt dominate the per-sample cost of the orientation math, and both are long
+// soft-float routines on AVR. mathAtan2 and mathInvSqrt pick the kernels below or libm depending on FAST_MATH.
+
+/**
+ * @brief atan2 approximation: reduces to an octant so the ratio is within [0, 1], then a 
+ * 9th order minimax polynomial of atan; one divide and five multiply-adds
+ * Max error is 1.2e-5 radians (0.0007 degrees)
+ * @param y The y coordinate
+ * @param x The x coordinate
+ * @return The angle of (x, y) in radians, within -PI to PI
+ */
+inline float fastAtan2f(float y, float x) {
+  float abs_x = fabsf(x);
+  float abs_y = fabsf(y);
+  float big = (abs_x > abs_y)? abs_x : abs_y;
+  float small = (abs_x > abs_y)? abs_y : abs_x;
+  if (big == 0.0f) {
+    return 0.0f;
+  }
+
+  float a = small / big;
+  float s = a * a;
+  float angle = ((((0.0208351f * s - 0.0851330f) * s + 0.1801410f) * s - 0.3302995f) * s + 0.9998660f) * a;
+  angle = (abs_y > abs_x)? 0.5f * PI - angle : angle;
+  angle = (x < 0.0f)? PI - angle : angle;
+  return (y < 0.0f)? -angle : angle;
+}
+
+/**
+ * @brief 1 / sqrt approximation: exponent bit trick for the first guess and one tuned newton step
+ * (constants from Moroz et al, "Fast calculation of inverse square root with the use of magic constant")
+ * Max relative error is 6.5e-4
+ * @param x The number, must be positive
+ * @return 1 / sqrt(x)
+ */
+inline float fastInvSqrtf(float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits = 0x5F1FFFF9UL - (bits >> 1);
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  return 0.703952253f * y * (2.38924456f - x * y * y);
+}
+
+/** @brief the kernels of the orientation math, libm unless FAST_KERNELS */
+template <bool FAST_KERNELS>
+struct MathKernels {
+  static inline float Atan2(float y, float x) { return atan2f(y, x); }
+  static inline float InvSqrt(float x) { return 1.0f / sqrtf(x); }
+};
+
+template <>
+struct MathKernels<true> {
+  static inline float Atan2(float y, float x) { return fastAtan2f(y, x); }
+  static inline float InvSqrt(float x) { return fastInvSqrtf(x); }
+};
+
+/** @brief atan2 used by the orientation math, fastAtan2f with FAST_MATH or libm */
+inline float mathAtan2(float y, float x) { return MathKernels<BuildConfig::FAST_KERNELS>::Atan2(y, x); }
+
+/** @brief 1 / sqrt used by the orientation math, fastInvSqrtf with FAST_MATH or libm */
+inline float mathInvSqrt(float x) { return MathKernels<BuildConfig::FAST_KERNELS>::InvSqrt(x); }
+
+
+/***************************************************************
+                    UTILITY FUNCTIONS
+***************************************************************/
+/**
+ * @brief Converts a given array of floats into a string
+ * If there is not enough room, it will not pack the remaining floats  
+ *
+ * @param str The C-String to store the floats
+ * @param str_size The length of the string
+ * @param floats The array of floats
+ * @param float_c The amount of floats in the floats array
+ * @param float_chars The amount of characters for each float
+ */
+void PackFloatsInStr(char* str, size_t str_size, float* floats, size_t float_c, size_t float_chars) 
+{
+  const char* FORMAT = "%f";
+  for (size_t i = 0; i < float_c && str_size >= float_chars; i++) {
+      snprintf(str, str_size, FORMAT, floats[i]);
+      str_size -= float_chars;
+      str += float_chars;
+  }
+}
+
+/**
+ * @brief Wraps an angle into [lower, lower + period)
+ * Angles within one period of the range (all of them on the hot path) only cost a compare and 
+ * an add or subtract; fmodf is a slow soft-float call on AVR, so the floorf path is only for 
+ * angles that are several revolutions out
+ *
+ * @param angle The angle to wrap
+ * @param lower The lowest angle of the range
+ * @param period One full revolution in the angle's unit (2PI or 360)
+ * @return The wrapped angle
+ */
+inline float wrapAngle(float angle, float lower, float period) {
+  float upper = lower + period;
+  if (angle >= upper) {
+    angle -= period;
+    if (angle >= upper) {
+      angle -= period * floorf((angle - lower) / period);
+    }
+  } else if (angle < lower) {
+    angle += period;
+    if (angle < lower) {
+      angle -= period * floorf((angle - lower) / period);
+    }
+  }
+  // rounding right at the edge of the range can land on upper or a hair below lower
+  return (angle >= upper || angle < lower)? lower : angle;
+}
+
+/** @brief wraps radians into [0, 2PI) */
+inline float wrapTwoPi(float radians) { return wrapAngle(radians, 0.0f, PI2); }
+/** @brief wraps radians into [-PI, PI) */
+inline float wrapPi(float radians) { return wrapAngle(radians, -PI, PI2); }
+/** @brief wraps degrees into [0, 360) */
+inline float wrap360(float degrees) { return wrapAngle(degrees, 0.0f, 360.0f); }
+/** @brief wraps degrees into [-180, 180) */
+inline float wrap180(float degrees) { return wrapAngle(degrees, -180.0f, 360.0f); }
+
+/**
+ * @brief makes sure that the degree measure is between 0 and 360
+ * @param degrees A refrence to the degree measure
+ */
+inline void fixDegree(float& degrees) {
+  degrees = wrap360(degrees);
+}
+
+/**
+ * @brief makes sure that the radian measure is between 0 and 2PI
+ * @param radians A refrence to the radian measure
+ */
+inline void fixRadian (float& radians) {
+  radians = wrapTwoPi(radians);
+}
+
+// binary angle measure: a full revolution is 65536, so wrapping is free integer overflow
+// and angles add and subtract as plain integers (LSB is about 0.0055 degrees)
+typedef uint16_t bam16_t;
+const float RAD2BAM = 65536.0f / PI2;
+const float BAM2RAD = PI2 / 65536.0f;
+
+/** @brief converts radians (within +-32768 rad) to a binary angle */
+inline bam16_t radToBam(float radians) { return (bam16_t)(int32_t)(radians * RAD2BAM); }
+/** @brief converts a binary angle to radians in [0, 2PI) */
+inline float bamToRad(bam16_t bam) { return bam * BAM2RAD; }
+/** @brief converts a binary angle to radians in [-PI, PI) */
+inline float bamToRadSigned(bam16_t bam) { return (int16_t)bam * BAM2RAD; }
+
+
+/***************************************************************
+                    FIXED-POINT MATH
+***************************************************************/
+// integer replacements for atan2f and sqrt, used by MATH_FIXED_POINT builds
+
+// atan(2^-i) as binary angles, the rotation of each CORDIC step
+const int16_t CORDIC_ATAN_BAM[] = {8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1};
+const uint8_t CORDIC_STEPS = sizeof(CORDIC_ATAN_BAM) / sizeof(int16_t);
+
+/**
+ * @brief Integer atan2; CORDIC in vectoring mode, rotates (x, y) onto the x axis and adds up the rotations.
+ * Max error is 4 binary angle LSBs (about 0.022 degrees)
+ * @param y The y coordinate, within +-65535, the length of (x, y) must stay under 79000 (both at +-55000 is the limit)
+ * @param x The x coordinate, within +-65535
+ * @return The angle of (x, y) as a binary angle
+ */
+bam16_t atan2Bam(int32_t y, int32_t x)
+{
+  bam16_t angle = 0;
+  // CORDIC only converges within +-90 degrees, so turn the left half plane around first
+  if (x < 0) {
+    x = -x;
+    y = -y;
+    angle = 32768;
+  }
+  // room for 14 fractional bits; the vector grows by 1.65 over the steps, which still fits in 31 bits
+  x <<= 14;
+  y <<= 14;
+  for (uint8_t i = 0; i < CORDIC_STEPS; i++) {
+    int32_t dx = x >> i;
+    int32_t dy = y >> i;
+    if (y > 0) {
+      x += dy;
+      y -= dx;
+      angle += CORDIC_ATAN_BAM[i];
+    } else {
+      x -= dy;
+      y += dx;
+      angle -= CORDIC_ATAN_BAM[i];
+    }
+  }
+  return angle;
+}
+
+/**
+ * @brief Integer square root, rounded down
+ * @param n The number
+ * @return floor(sqrt(n))
+ */
+uint16_t isqrt32(uint32_t n)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > n) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (n >= root + bit) {
+      n -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint16_t)root;
+}
+
+/** @brief converts a binary angle in [0, 2PI) to the radians * 4096 telemetry format without floats */
+inline int16_t BamToQ12(bam16_t bam) { return (int16_t)(((uint32_t)bam * 25736UL) >> 16); }
+
+/** @brief x * 2^shift rounded to the nearest int32, works out the fixed-point constants at compile time */
+constexpr int32_t ToFixed(float x, uint8_t shift) {
+  return (int32_t)(x * (float)(1ULL << shift) + ((x < 0.0f)? -0.5f : 0.5f));
+}
+
+// MATH_FIXED_POINT builds keep the canard commands as canard radians * 2^CANARD_Q, steps of 1e-6 radians
+const uint8_t CANARD_Q = 20;
+
+/**
+ * @brief Converts a unit quaternion to euler angles
+ * @param q The quaternion (w, x, y, z)
+ * @param pitch_ret refrence used to retrieve the pitch angle in radians (rotation about y)
+ * @param roll_ret refrence used to retrieve the roll angle in radians (rotation about x)
+ * @param yaw_ret refrence used to retrieve the yaw angle in radians (rotation about z)
+ */
+void QuaternionToEuler(const float q[4], float& pitch_ret, float& roll_ret, float& yaw_ret)
+{
+  float sin_pitch = 2.0f * (q[0] * q[2] - q[3] * q[1]);
+  sin_pitch = (sin_pitch > 1.0f)? 1.0f : ((sin_pitch < -1.0f)? -1.0f : sin_pitch); // rounding can push it past +-1
+  roll_ret = mathAtan2(2.0f * (q[0] * q[1] + q[2] * q[3]), 1.0f - 2.0f * (q[1] * q[1] + q[2] * q[2]));
+  pitch_ret = asinf(sin_pitch);
+  yaw_ret = mathAtan2(2.0f * (q[0] * q[3] + q[1] * q[2]), 1.0f - 2.0f * (q[2] * q[2] + q[3] * q[3]));
+}
+
+/**
+ * @brief Converts euler angles to a unit quaternion, the inverse of QuaternionToEuler
+ * @param pitch Pitch angle in radians (rotation about y)
+ * @param roll Roll angle in radians (rotation about x)
+ * @param yaw Yaw angle in radians (rotation about z)
+ * @param q_ret Array used to retrieve the quaternion (w, x, y, z)
+ */
+void EulerToQuaternion(float pitch, float roll, float yaw, float q_ret[4])
+{
+  float cr = cosf(roll * 0.5f), sr = sinf(roll * 0.5f);
+  float cp = cosf(pitch * 0.5f), sp = sinf(pitch * 0.5f);
+  float cy = cosf(yaw * 0.5f), sy = sinf(yaw * 0.5f);
+  q_ret[0] = cr * cp * cy + sr * sp * sy;
+  q_ret[1] = sr * cp * cy - cr * sp * sy;
+  q_ret[2] = cr * sp * cy + sr * cp * sy;
+  q_ret[3] = cr * cp * sy - sr * sp * cy;
+}
+
+
+/***************************************************************
+                    TELEMETRY FRAMES
+***************************************************************/
+// Binary frame layout, multi-byte fields are little-endian (native on AVR and ARM):
+//  [0..1]   sync word 0xAA 0x55
+//  [2]      frame type (see TELEMETRY_FRAME)
+//  [3]      payload length in bytes
+//  [4]      sequence number, wraps at 255 so the sim can count lost frames
+//  [5..8]   timestamp, micros() when the frame was built
+//  [9..]    payload
+//  [last 2] CRC16-CCITT (poly 0x1021, init 0xFFFF) over bytes 2 up to the end of the payload
+const uint8_t TELEMETRY_SYNC_0 = 0xAA;
+const uint8_t TELEMETRY_SYNC_1 = 0x55;
+const uint8_t TELEMETRY_HEADER_SIZE = 9;
+const uint8_t TELEMETRY_CRC_SIZE = 2;
+const uint8_t TELEMETRY_MAX_PAYLOAD = 32;
+const uint8_t TELEMETRY_MAX_FRAME = TELEMETRY_HEADER_SIZE + TELEMETRY_MAX_PAYLOAD + TELEMETRY_CRC_SIZE;
+const float TELEMETRY_Q12_SCALE = 4096.0f; // int16 payload LSB is 1/4096 radians
+
+/** @brief enum which stores the type byte of each binary frame; the payload layout is fixed per type */
+enum TELEMETRY_FRAME {
+  TELEMETRY_FRAME_STATE_F32 = 0x01, // 7 float32: pitch, roll, yaw, canard 1-4 (radians)
+  TELEMETRY_FRAME_STATE_Q12 = 0x02, // 7 int16: same fields as STATE_F32 in radians * 4096
+  TELEMETRY_FRAME_STATUS = 0x03,    // uint16s: frames dropped, fifo overflows, overruns of each task, servo commits and suppressed writes, last and longest ICM read (us), FLIGHT_PHASE, compression * 100 (TELEMETRY_DELTA)
+  TELEMETRY_FRAME_PROFILE = 0x04,   // uint8 stage, uint16s: runs, min, mean and max micros, then the histogram buckets (see PROFILER)
+  TELEMETRY_FRAME_ACK = 0x05,       // uint8 command type, uint8 command sequence number, uint8 COMMAND_RESULT (see COMMAND LINK)
+  TELEMETRY_FRAME_STATE_DELTA = 0x06 // uint8 field flags, then a varint per flagged STATE_Q12 field (see TELEMETRY DELTA)
+};
+
+/**
+ * @brief Computes the CRC16-CCITT of a block of bytes
+ * @param data The bytes to checksum
+ * @param len The amount of bytes
+ * @param crc The running crc, pass the previous result to continue a checksum
+ * @return The updated crc
+ */
+uint16_t Crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF)
+{
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+/**
+ * @brief Converts radians to the int16 fixed-point format used by TELEMETRY_FRAME_STATE_Q12
+ * @param radians The radian measure, must be within +-8 radians
+ */
+inline int16_t RadToQ12(float radians) {
+  return (int16_t)(radians * TELEMETRY_Q12_SCALE + ((radians < 0.0f)? -0.5f : 0.5f));
+}
+
+/**
+ * @brief Wraps a payload in a binary frame (header, payload and crc)
+ *
+ * @param frame The buffer for the frame, must hold at least TELEMETRY_MAX_FRAME bytes
+ * @param type The frame type
+ * @param payload The payload bytes
+ * @param payload_len The amount of payload bytes, at most TELEMETRY_MAX_PAYLOAD
+ * @return The total length of the frame in bytes, 0 if the payload is too long (nothing is written, 
+ * TxEnqueue counts it as dropped)
+ */
+size_t BuildTelemetryFrame(uint8_t* frame, TELEMETRY_FRAME type, const void* payload, uint8_t payload_len)
+{
+  static uint8_t sequence = 0;
+  if (payload_len > TELEMETRY_MAX_PAYLOAD) {
+    return 0;
+  }
+  uint32_t timestamp = micros();
+
+  frame[0] = TELEMETRY_SYNC_0;
+  frame[1] = TELEMETRY_SYNC_1;
+  frame[2] = type;
+  frame[3] = payload_len;
+  frame[4] = sequence++;
+  memcpy(frame + 5, &timestamp, sizeof(timestamp));
+  memcpy(frame + TELEMETRY_HEADER_SIZE, payload, payload_len);
+
+  uint16_t crc = Crc16(frame + 2, TELEMETRY_HEADER_SIZE - 2 + payload_len);
+  memcpy(frame + TELEMETRY_HEADER_SIZE + payload_len, &crc, sizeof(crc));
+  return TELEMETRY_HEADER_SIZE + payload_len + TELEMETRY_CRC_SIZE;
+}
+
+
+/***************************************************************
+                  SERIAL TRANSMIT QUEUE
+***************************************************************/
+// Serial.write blocks loop() once the core's TX buffer is full, so frames are queued here and
+// handed to Serial only as fast as Serial.availableForWrite() has room. The core's UART interrupt
+// drains its own buffer in the background, so the control loop only ever pays for a memcpy.
+// When the queue is full the oldest frame that has not started sending is dropped (the newest
+// state always wins); a half sent frame is never dropped so the receiver does not see a torn frame.
+const uint8_t TX_QUEUE_SLOTS = 4;  // frames that can wait for the link
+const uint8_t TX_SLOT_BYTES = 64;  // largest frame, the ASCII line is 59 bytes
+
+/** 
+ * @brief namespace that holds the queued frames waiting for serial
+ */
+namespace TxQueue {
+  uint8_t slots[TX_QUEUE_SLOTS][TX_SLOT_BYTES];
+  uint8_t lengths[TX_QUEUE_SLOTS] = {0};
+  uint8_t head = 0;  // next slot to fill
+  uint8_t tail = 0;  // oldest slot, the one being sent
+  uint8_t count = 0; // amount of queued frames
+  uint8_t sent = 0;  // bytes of the tail slot already handed to Serial
+  unsigned long dropped = 0; // frames dropped because the link could not keep up
+}
+
+/**
+ * @brief Queues a frame for serial without blocking;
+ * drops the oldest unsent frame if the queue is full
+ * @param data The frame bytes
+ * @param len The amount of bytes, at most TX_SLOT_BYTES
+ * @return false if the frame was too big to queue or empty (a frame BuildTelemetryFrame could not build)
+ */
+bool TxEnqueue(const uint8_t* data, uint8_t len)
+{
+  if (len == 0 || len > TX_SLOT_BYTES) {
+    TxQueue::dropped++;
+    return false;
+  }
+
+  if (TxQueue::count == TX_QUEUE_SLOTS) {
+    TxQueue::dropped++;
+    uint8_t next = (TxQueue::tail + 1) % TX_QUEUE_SLOTS;
+    if (TxQueue::sent > 0) {
+      // the tail is half sent, so drop the frame behind it by moving the tail forward into its slot
+      memcpy(TxQueue::slots[next], TxQueue::slots[TxQueue::tail], TxQueue::lengths[TxQueue::tail]);
+      TxQueue::lengths[next] = TxQueue::lengths[TxQueue::tail];
+    }
+    TxQueue::tail = next;
+    TxQueue::count--;
+  }
+
+  memcpy(TxQueue::slots[TxQueue::head], data, len);
+  TxQueue::lengths[TxQueue::head] = len;
+  TxQueue::head = (TxQueue::head + 1) % TX_QUEUE_SLOTS;
+  TxQueue::count++;
+  return true;
+}
+
+/**
+ * @brief Hands queued bytes to Serial, only as many as fit without blocking;
+ * call every loop itteration
+ */
+void TxPump()
+{
+  while (TxQueue::count > 0) {
+    int room = Serial.availableForWrite();
+    if (room <= 0) {
+      return;
+    }
+
+    uint8_t remaining = TxQueue::lengths[TxQueue::tail] - TxQueue::sent;
+    uint8_t n = (room < remaining)? (uint8_t)room : remaining;
+    Serial.write(TxQueue::slots[TxQueue::tail] + TxQueue::sent, n);
+    TxQueue::sent += n;
+
+    if (TxQueue::sent == TxQueue::lengths[TxQueue::tail]) {
+      TxQueue::tail = (TxQueue::tail + 1) % TX_QUEUE_SLOTS;
+      TxQueue::count--;
+      TxQueue::sent = 0;
+    }
+  }
+}
+
+
+/***************************************************************
+                      TELEMETRY DELTA
+***************************************************************/
+// TELEMETRY_DELTA builds send the STATE_Q12 fields as TELEMETRY_FRAME_STATE_DELTA frames. At 1kHz the attitude and the
+// canards only move a few LSB from one frame to the next, so a field is sent as its change from the value the sim got
+// last, zigzag varint coded (a change of up to +-63 LSB is one byte instead of two). Payload:
+//  [0]      field flags: bit i set if field i of STATE_Q12 follows, bit 7 set on a key frame
+//  [1..]    a varint per flagged field in field order: the value itself on a key frame, the change (int16 wrapping) otherwise
+// A field is left out of a frame when it is not picked in the field mask, is not due at its divider or did not change,
+// so the sim keeps its last value. Every TELEMETRY_KEY_PERIOD th frame is a key frame with every picked field, as is the
+// frame after the TX queue dropped one (the sim's values no longer match) or after the fields changed; the sim should
+// ignore delta frames after a gap in the sequence numbers until the next key frame. tools/decode_telemetry.py decodes them.
+/** @brief enum which stores the fields of the state frames, in payload order */
+enum TELEMETRY_FIELD {
+  TELEMETRY_FIELD_PITCH = 0,
+  TELEMETRY_FIELD_ROLL,
+  TELEMETRY_FIELD_YAW,
+  TELEMETRY_FIELD_CANARD_1,
+  TELEMETRY_FIELD_CANARD_2,
+  TELEMETRY_FIELD_CANARD_3,
+  TELEMETRY_FIELD_CANARD_4,
+  TELEMETRY_FIELD_COUNT
+};
+
+const uint8_t TELEMETRY_FLOAT_CHARS = 8; // characters of each float of the ASCII line
+// the most bytes one state takes on the link as BuildConfig::TELEMETRY, a delta frame at most has every field
+const uint8_t TELEMETRY_STATE_BYTES =
+  (BuildConfig::TELEMETRY == TELEMETRY_ENCODING_ASCII)? TELEMETRY_FLOAT_CHARS * TELEMETRY_FIELD_COUNT + 2 :
+  (BuildConfig::TELEMETRY == TELEMETRY_ENCODING_F32)? TELEMETRY_HEADER_SIZE + TELEMETRY_FIELD_COUNT * sizeof(float) + TELEMETRY_CRC_SIZE :
+  (BuildConfig::TELEMETRY == TELEMETRY_ENCODING_Q12)? TELEMETRY_HEADER_SIZE + TELEMETRY_FIELD_COUNT * sizeof(int16_t) + TELEMETRY_CRC_SIZE :
+  TELEMETRY_HEADER_SIZE + 1 + 3 * TELEMETRY_FIELD_COUNT + TELEMETRY_CRC_SIZE;
+
+#ifdef TELEMETRY_DELTA
+
+const uint8_t TELEMETRY_KEY_FLAG = 0x80;
+const uint8_t TELEMETRY_KEY_PERIOD = 32; // frames, a sim that lost one is back in step within 32ms at 1kHz
+// fields sent, bit i is field i; clear the bits of what is not being looked at to give the link to the rest
+const uint8_t TELEMETRY_FIELD_MASK = (1 << TELEMETRY_FIELD_COUNT) - 1;
+// field i goes out every TELEMETRY_FIELD_DIVIDER[i] th frame (key frames carry every picked field)
+const uint8_t TELEMETRY_FIELD_DIVIDER[TELEMETRY_FIELD_COUNT] = {1, 1, 1, 1, 1, 1, 1};
+const uint8_t TELEMETRY_STATE_Q12_FRAME = TELEMETRY_HEADER_SIZE + TELEMETRY_FIELD_COUNT * sizeof(int16_t) + TELEMETRY_CRC_SIZE;
+
+/** 
+ * @brief namespace that holds the field selection and what the sim was last sent
+ */
+namespace TelemetryDelta {
+  uint8_t mask = TELEMETRY_FIELD_MASK;      // COMMAND_FRAME_TELEMETRY_FIELDS can change these
+  uint8_t divider[TELEMETRY_FIELD_COUNT];
+  int16_t last[TELEMETRY_FIELD_COUNT];      // what the sim has of each field
+  uint8_t frames_to_key = 0;                // 0 makes the next frame a key frame
+  unsigned long dropped_seen = 0;           // TxQueue::dropped at the last frame
+  unsigned long state_q12_bytes = 0;        // what the frames would have taken as STATE_Q12 frames
+  unsigned long sent_bytes = 0;             // what they took
+}
+
+/** @brief Loads the default field selection */
+void TelemetryDeltaBegin()
+{
+  TelemetryDelta::mask = TELEMETRY_FIELD_MASK;
+  memcpy(TelemetryDelta::divider, TELEMETRY_FIELD_DIVIDER, sizeof(TelemetryDelta::divider));
+  TelemetryDelta::frames_to_key = 0;
+}
+
+/**
+ * @brief Writes a value as a zigzag varint (0, -1, 1, -2 ... as 0, 1, 2, 3 ..., then 7 bits a byte, low bits 
+ * first, the top bit set on all but the last byte)
+ * @return The amount of bytes written, 1 - 3
+ */
+inline uint8_t PutZigzagVarint(uint8_t* out, int16_t value) {
+  uint16_t zigzag = ((uint16_t)value << 1) ^ (uint16_t)(value >> 15);
+  uint8_t n = 0;
+  while (zigzag >= 0x80) {
+    out[n++] = (uint8_t)(zigzag | 0x80);
+    zigzag >>= 7;
+  }
+  out[n++] = (uint8_t)zigzag;
+  return n;
+}
+
+/**
+ * @brief Queues a TELEMETRY_FRAME_STATE_DELTA frame of the state fields
+ * @param values The STATE_Q12 fields, TELEMETRY_FIELD_COUNT of them
+ */
+void SendDeltaFrame(const int16_t* values)
+{
+  bool key = TelemetryDelta::frames_to_key == 0 || TxQueue::dropped != TelemetryDelta::dropped_seen;
+  uint8_t frame_index = TELEMETRY_KEY_PERIOD - TelemetryDelta::frames_to_key; // frames since the last key frame
+  uint8_t payload[1 + 3 * TELEMETRY_FIELD_COUNT];
+  static_assert(sizeof(payload) <= TELEMETRY_MAX_PAYLOAD, "a delta frame with every field must fit a frame");
+  uint8_t len = 1;
+  payload[0] = key? TELEMETRY_KEY_FLAG : 0;
+  for (uint8_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    if (!(TelemetryDelta::mask & (1 << i))) {
+      continue;
+    }
+    int16_t change = (int16_t)(uint16_t)(values[i] - TelemetryDelta::last[i]);
+    if (!key && (change == 0 || frame_index % TelemetryDelta::divider[i] != 0)) {
+      continue;
+    }
+    payload[0] |= 1 << i;
+    len += PutZigzagVarint(payload + len, key? values[i] : change);
+  }
+
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t frame_len = BuildTelemetryFrame(frame, TELEMETRY_FRAME_STATE_DELTA, payload, len);
+  unsigned long dropped = TxQueue::dropped; // a frame this one pushes out of the queue makes the next one a key frame
+  if (!TxEnqueue(frame, frame_len)) {
+    return;
+  }
+  for (uint8_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    if (payload[0] & (1 << i)) {
+      TelemetryDelta::last[i] = values[i];
+    }
+  }
+  TelemetryDelta::frames_to_key = (key? TELEMETRY_KEY_PERIOD : TelemetryDelta::frames_to_key) - 1;
+  TelemetryDelta::dropped_seen = dropped;
+  TelemetryDelta::state_q12_bytes += TELEMETRY_STATE_Q12_FRAME;
+  TelemetryDelta::sent_bytes += frame_len;
+}
+
+/** @return How many times smaller the delta frames are than STATE_Q12 frames, * 100 */
+inline uint16_t TelemetryCompressionPercent() {
+  if (TelemetryDelta::sent_bytes == 0) {
+    return 100;
+  }
+  return (uint16_t)((100ULL * TelemetryDelta::state_q12_bytes) / TelemetryDelta::sent_bytes);
+}
+#endif
+
+
+/***************************************************************
+                        PROFILER
+***************************************************************/
+// PROFILE_SCOPE(stage) times the rest of the enclosing block and adds it to that stage's stats;
+// ProfileTask sends the stats of one stage at a time and starts them over. Without PROFILE_ON 
+// the probes expand to nothing.
+
+// cycle clock: the DWT cycle counter on Cortex-M3/M4/M7, otherwise micros() scaled by the clock
+// (4us resolution on AVR, so short stages only show up in the mean)
+#if defined(F_CPU)
+const uint32_t CYCLES_PER_US = F_CPU / 1000000UL;
+#else
+const uint32_t CYCLES_PER_US = 1;
+#endif
+
+/** @brief The cycle clock, see CYCLES_PER_US */
+inline uint32_t CycleCount() {
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  return *(volatile uint32_t*)0xE0001004; // DWT_CYCCNT
+#else
+  return micros() * CYCLES_PER_US;
+#endif
+}
+
+/** @brief starts the cycle counter when the board has one */
+void StartCycleCounter() {
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  *(volatile uint32_t*)0xE000EDFC |= 0x01000000; // DEMCR TRCENA
+  *(volatile uint32_t*)0xE0001004 = 0;           // DWT_CYCCNT
+  *(volatile uint32_t*)0xE0001000 |= 1;          // DWT_CTRL CYCCNTENA
+#endif
+}
+
+#ifdef PROFILE_ON
+/** @brief enum of the timed stages */
+enum PROFILE_STAGE {
+  PROFILE_SENSORS = 0,     // SetOrientationFromSensors, reads and estimation
+  PROFILE_ICM_READ,        // the I2C reads on their own
+  PROFILE_CONTROL,         // StabilizationSystem
+  PROFILE_TELEMETRY,       // SendDataToSerial
+  PROFILE_ACTUATION,       // UpdateActuators
+  PROFILE_LOG,             // LogTask
+  PROFILE_TX_PUMP,         // TxPump
+  PROFILE_LOOP,            // a whole loop() itteration
+  PROFILE_STAGE_COUNT
+};
+
+// histogram bucket i counts runs under PROFILE_BUCKET_0_US << i micros, the last one everything longer
+const uint8_t PROFILE_BUCKETS = 8;
+const uint16_t PROFILE_BUCKET_0_US = 16;
+
+/** @brief timing of one stage since it was last reported */
+struct ProfileStats {
+  uint32_t count;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint32_t total_cycles;
+  uint16_t histogram[PROFILE_BUCKETS];
+};
+
+/** 
+ * @brief namespace that holds the stats of every stage
+ */
+namespace Profile {
+  ProfileStats stats[PROFILE_STAGE_COUNT];
+  uint8_t next_report = 0; // stage ProfileTask sends next
+}
+
+/** @brief Starts a stage's stats over */
+inline void ProfileReset(ProfileStats& stats) {
+  memset(&stats, 0, sizeof(stats));
+  stats.min_cycles = 0xFFFFFFFFUL;
+}
+
+/**
+ * @brief Adds one run to a stage
+ * @param stage The stage
+ * @param cycles The cycles the run took
+ */
+inline void ProfileAdd(uint8_t stage, uint32_t cycles) {
+  ProfileStats& stats = Profile::stats[stage];
+  stats.count++;
+  stats.total_cycles += cycles;
+  stats.min_cycles = (cycles < stats.min_cycles)? cycles : stats.min_cycles;
+  stats.max_cycles = (cycles > stats.max_cycles)? cycles : stats.max_cycles;
+  uint32_t limit = (uint32_t)PROFILE_BUCKET_0_US * CYCLES_PER_US;
+  uint8_t bucket = 0;
+  while (bucket < PROFILE_BUCKETS - 1 && cycles >= limit) {
+    limit <<= 1;
+    bucket++;
+  }
+  if (stats.histogram[bucket] < 0xFFFF) {
+    stats.histogram[bucket]++;
+  }
+}
+
+/** @brief times its own lifetime into a stage */
+struct ProfileScope {
+  uint8_t stage;
+  uint32_t start;
+  ProfileScope(uint8_t s) : stage(s), start(CycleCount()) {}
+  ~ProfileScope() { ProfileAdd(stage, CycleCount() - start); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
+#else
+#define PROFILE_SCOPE(stage)
+#endif
+
+
+/***************************************************************
+              ROCKET MANIPULATION / FUNCTIONS
+***************************************************************/
+/** 
+ * @brief namespace that holds all the data of the rocket
+ */
+namespace Rocket {
+  uint16_t canard_pulses[4] = {0}; // servo pulse widths for canard_rotations in SERVO_TICKS_PER_US ticks, set by SetCanardRotations
+  float attitude[4] = {1.0f, 0.0f, 0.0f, 0.0f}; // orientation as a unit quaternion (w, x, y, z), the primary state
+#ifdef MATH_FIXED_POINT
+  // fixed-point builds keep the orientation as binary angles instead and only work out the quaternion when asked
+  bam16_t pitch_bam = 0;
+  bam16_t roll_bam = 0;
+  bam16_t yaw_bam = 0;
+  bool attitude_stale = false;
+  uint32_t canard_bam[4] = {0}; // canard rotations as 32 bit binary angles, wrap on their own
+#endif
+  // euler angles of attitude, only worked out when someone asks for them through GetOrientation
+  float pitch = 0.0f;
+  float roll = 0.0f;
+  float yaw = 0.0f;
+  bool euler_stale = false; // attitude changed since pitch, roll and yaw were worked out
+#ifndef MATH_FIXED_POINT
+  float canard_rotations[4] = {0.0f}; // fixed-point builds only have canard_bam, see GetCanardRotations
+#endif
+}
+
+/**
+ * @brief Renormalizes a quaternion; the estimators only drift a tiny bit off unit length per update,
+ * so one newton step of 1 / sqrt around 1 is enough and saves the sqrt and divide
+ * @param q The quaternion (w, x, y, z)
+ */
+inline void NormalizeQuaternion(float q[4]) {
+  float norm_sq = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+  float scale = (fabsf(norm_sq - 1.0f) < 0.01f)? 1.5f - 0.5f * norm_sq : mathInvSqrt(norm_sq);
+  for (int i = 0; i < 4; i++) {
+    q[i] *= scale;
+  }
+}
+
+/**
+ * @brief Sets the orientation
+ * @param q Unit quaternion (w, x, y, z)
+ */
+inline void SetAttitude(const float q[4]) {
+  for (int i = 0; i < 4; i++) {
+    Rocket::attitude[i] = q[i];
+  }
+  Rocket::euler_stale = true;
+}
+
+/**
+ * @param q_ret Array used to retrieve the orientation as a unit quaternion (w, x, y, z)
+ */
+inline void GetAttitude(float q_ret[4]) {
+#ifdef MATH_FIXED_POINT
+  if (Rocket::attitude_stale) {
+    EulerToQuaternion(bamToRadSigned(Rocket::pitch_bam), bamToRadSigned(Rocket::roll_bam), bamToRadSigned(Rocket::yaw_bam), Rocket::attitude);
+    Rocket::attitude_stale = false;
+  }
+#endif
+  for (int i = 0; i < 4; i++) {
+    q_ret[i] = Rocket::attitude[i];
+  }
+}
+
+/**
+ * @brief Sets the orientation from euler angles
+ * @param pitch Pitch angle in radians (x-axis)
+ * @param roll Roll angle in radians (y-axis)
+ * @param yaw Yaw angle in radians (z-axis)
+ */
+inline void SetOrientation(float& pitch, float& roll, float& yaw) {
+  EulerToQuaternion(pitch, roll, yaw, Rocket::attitude);
+  Rocket::pitch = pitch;
+  Rocket::roll = roll;
+  Rocket::yaw = yaw;
+  fixRadian(Rocket::pitch);
+  fixRadian(Rocket::roll);
+  fixRadian(Rocket::yaw);
+  Rocket::euler_stale = false;
+}
+
+#ifdef MATH_FIXED_POINT
+/**
+ * @brief Sets the orientation from binary angles (fixed-point builds)
+ * @param pitch Pitch angle
+ * @param roll Roll angle
+ * @param yaw Yaw angle
+ */
+inline void SetOrientationBam(bam16_t pitch, bam16_t roll, bam16_t yaw) {
+  Rocket::pitch_bam = pitch;
+  Rocket::roll_bam = roll;
+  Rocket::yaw_bam = yaw;
+  Rocket::euler_stale = true;
+  Rocket::attitude_stale = true;
+}
+#endif
+
+/**
+ * @brief Gets the orientation as euler angles (each within 0 - 2PI);
+ * they are only worked out from the quaternion here, when someone actually needs them
+ * @param pitch_ret refrence used to retrieve the pitch angle in radians (x-axis)
+ * @param roll_ret refrence used to retrieve the roll angle in radians (y-axis)
+ * @param yaw_ret refrence used to retrieve the yaw angle in radians (z-axis)
+ */
+inline void GetOrientation(float& pitch_ret, float& roll_ret, float& yaw_ret) {
+#ifdef MATH_FIXED_POINT
+  if (Rocket::euler_stale) {
+    // binary angles are already within 0 - 2PI
+    Rocket::pitch = bamToRad(Rocket::pitch_bam);
+    Rocket::roll = bamToRad(Rocket::roll_bam);
+    Rocket::yaw = bamToRad(Rocket::yaw_bam);
+    Rocket::euler_stale = false;
+  }
+#endif
+  if (Rocket::euler_stale) {
+    QuaternionToEuler(Rocket::attitude, Rocket::pitch, Rocket::roll, Rocket::yaw);
+    fixRadian(Rocket::pitch);
+    fixRadian(Rocket::roll);
+    fixRadian(Rocket::yaw);
+    Rocket::euler_stale = false;
+  }
+  pitch_ret = Rocket::pitch;
+  roll_ret = Rocket::roll;
+  yaw_ret = Rocket::yaw;
+}
+
+/** @brief one reading of the ICM, in the units the ICM library returns */
+struct IMUSample {
+  float accX, accY, accZ; // milli g
+  float gyrX, gyrY, gyrZ; // degrees per second
+  float magX, magY, magZ; // micro tesla, turned into the accel / gyro axes (see MAG_AXIS_SIGN)
+  int16_t accRaw[3], gyrRaw[3], magRaw[3]; // the same readings in raw sensor counts (x, y, z); MATH_FIXED_POINT builds correct acc and mag in place with the calibration
+  unsigned long timestamp; // micros() when the sample was ready
+};
+
+/** 
+ * @brief namespace that holds the latest sensor sample and its timing
+ */
+namespace Sensor {
+  IMUSample sample;                    // latest sample
+  unsigned long sample_count = 0;      // amount of samples read since power on
+  unsigned long latency = 0;           // micros from the INT pin edge to the end of the read (last sample)
+  unsigned long max_latency = 0;       // worst latency seen
+  volatile unsigned long drdy_timestamp = 0; // set by ICM_DataReadyISR
+  volatile bool drdy_pending = false;        // set by ICM_DataReadyISR, cleared once the sample is read
+  unsigned long fifo_overflows = 0;    // times the FIFO filled up and had to be reset (samples lost)
+  unsigned long read_errors = 0;       // ICM reads that failed, their samples were skipped
+  float dmp_quat[4] = {1.0f, 0.0f, 0.0f, 0.0f}; // latest DMP quaternion (w, x, y, z)
+  unsigned long dmp_timestamp = 0;     // micros() when dmp_quat was read
+  unsigned long read_us = 0;           // micros the last read of the ICM took, bus time over ICM_TRANSPORT
+  unsigned long max_read_us = 0;       // longest read seen
+  int16_t mag_cache[3] = {0};          // raw mag counts of the last mag read, see MAG_READ_DIVIDER
+  uint8_t mag_countdown = 0;           // samples until the mag is read again
+}
+
+/**
+ * @brief Records how long a read of the ICM took
+ * @param start micros() when the read started
+ */
+inline void RecordReadTime(unsigned long start)
+{
+  Sensor::read_us = micros() - start;
+  if (Sensor::read_us > Sensor::max_read_us) {
+    Sensor::max_read_us = Sensor::read_us;
+  }
+}
+
+/** 
+ * @brief copy of namespace Rocket and the sensor / flight state the telemetry and log tasks report;
+ * with DUAL_CORE those run on the other core and only ever see one of these (see CORE HANDOFF)
+ */
+struct RocketSnapshot {
+  float attitude[4];
+  float pitch, roll, yaw;
+  bool euler_stale;
+#ifdef MATH_FIXED_POINT
+  bam16_t pitch_bam, roll_bam, yaw_bam;
+  bool attitude_stale;
+  uint32_t canard_bam[4];
+#endif
+  float canard_rotations[4];
+  IMUSample sample;           // Sensor::sample
+  unsigned long sample_count; // Sensor::sample_count
+  bool launched;              // Flight::launched
+  uint8_t phase;              // Flight::phase
+};
+
+/**
+ * @brief GetAttitude of a snapshot, without touching the snapshot
+ * @param state The snapshot
+ * @param q_ret Array used to retrieve the orientation as a unit quaternion (w, x, y, z)
+ */
+inline void SnapshotAttitude(const RocketSnapshot& state, float q_ret[4]) {
+#ifdef MATH_FIXED_POINT
+  if (state.attitude_stale) {
+    EulerToQuaternion(bamToRadSigned(state.pitch_bam), bamToRadSigned(state.roll_bam), bamToRadSigned(state.yaw_bam), q_ret);
+    return;
+  }
+#endif
+  for (int i = 0; i < 4; i++) {
+    q_ret[i] = state.attitude[i];
+  }
+}
+
+/**
+ * @brief GetOrientation of a snapshot, without touching the snapshot
+ * @param state The snapshot
+ * @param pitch_ret refrence used to retrieve the pitch angle in radians (x-axis)
+ * @param roll_ret refrence used to retrieve the roll angle in radians (y-axis)
+ * @param yaw_ret refrence used to retrieve the yaw angle in radians (z-axis)
+ */
+inline void SnapshotOrientation(const RocketSnapshot& state, float& pitch_ret, float& roll_ret, float& yaw_ret) {
+#ifdef MATH_FIXED_POINT
+  if (state.euler_stale) {
+    pitch_ret = bamToRad(state.pitch_bam);
+    roll_ret = bamToRad(state.roll_bam);
+    yaw_ret = bamToRad(state.yaw_bam);
+    return;
+  }
+#endif
+  if (state.euler_stale) {
+    QuaternionToEuler(state.attitude, pitch_ret, roll_ret, yaw_ret);
+    fixRadian(pitch_ret);
+    fixRadian(roll_ret);
+    fixRadian(yaw_ret);
+    return;
+  }
+  pitch_ret = state.pitch;
+  roll_ret = state.roll;
+  yaw_ret = state.yaw;
+}
+
+/**
+ * @brief The state fields in the order the telemetry sends them; 
+ * floats 0, 1, 2 are orientation, 
+ * floats 3, 4, 5, 6 are canard fin rotations (radians) 
+ * @param state The state
+ * @param floats_ret Array used to retrieve the 7 fields
+ */
+inline void StateToFloats(const RocketSnapshot& state, float floats_ret[TELEMETRY_FIELD_COUNT]) {
+  SnapshotOrientation(state, floats_ret[0], floats_ret[1], floats_ret[2]);
+  for (int i = 0; i < 4; i++) {
+    floats_ret[3 + i] = state.canard_rotations[i];
+  }
+}
+
+/**
+ * @brief The state fields as STATE_Q12 int16s; with TELEMETRY_FIXED_POINT and MATH_FIXED_POINT 
+ * the binary angles convert straight to them, no floats at all
+ * @param state The state
+ * @param q12_ret Array used to retrieve the 7 fields
+ */
+inline void StateToQ12(const RocketSnapshot& state, int16_t q12_ret[TELEMETRY_FIELD_COUNT]) {
+#if defined(TELEMETRY_FIXED_POINT) && defined(MATH_FIXED_POINT)
+  q12_ret[0] = BamToQ12(state.pitch_bam);
+  q12_ret[1] = BamToQ12(state.roll_bam);
+  q12_ret[2] = BamToQ12(state.yaw_bam);
+  for (int i = 0; i < 4; i++) {
+    // the canards are signed deflections around neutral, so unlike the angles they do not go through [0, 2PI)
+    q12_ret[3 + i] = (int16_t)(((int32_t)(int16_t)(state.canard_bam[i] >> 16) * 25736L) >> 16);
+  }
+#else
+  float floats[TELEMETRY_FIELD_COUNT];
+  StateToFloats(state, floats);
+  for (int i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    q12_ret[i] = RadToQ12(floats[i]);
+  }
+#endif
+}
+
+/** @brief queues the state, one specialization per TELEMETRY_ENCODING */
+template <TELEMETRY_ENCODING ENCODING>
+struct TelemetryEncoder;
+
+/** @brief a line of floats, what the sim reads without TELEMETRY_BINARY */
+template <>
+struct TelemetryEncoder<TELEMETRY_ENCODING_ASCII> {
+  static void Send(const RocketSnapshot& state) {
+    float float_data_arr[TELEMETRY_FIELD_COUNT];
+    StateToFloats(state, float_data_arr);
+
+    const int DATA_STR_SIZE = TELEMETRY_FLOAT_CHARS * TELEMETRY_FIELD_COUNT + 1; // +1 for null terminator
+
+    char rocketDataStr[DATA_STR_SIZE + 2] = { 0 }; // +2 for the line ending println used to add
+    PackFloatsInStr(rocketDataStr, DATA_STR_SIZE, float_data_arr, TELEMETRY_FIELD_COUNT, TELEMETRY_FLOAT_CHARS);
+    size_t str_len = strlen(rocketDataStr);
+    rocketDataStr[str_len++] = '\r';
+    rocketDataStr[str_len++] = '\n';
+    TxEnqueue((const uint8_t*)rocketDataStr, str_len);
+  }
+};
+
+/** @brief a TELEMETRY_FRAME_STATE_F32 frame */
+template <>
+struct TelemetryEncoder<TELEMETRY_ENCODING_F32> {
+  static void Send(const RocketSnapshot& state) {
+    float float_data_arr[TELEMETRY_FIELD_COUNT];
+    static_assert(sizeof(float_data_arr) <= TELEMETRY_MAX_PAYLOAD, "STATE_F32 must fit a frame");
+    StateToFloats(state, float_data_arr);
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    size_t frame_len = BuildTelemetryFrame(frame, TELEMETRY_FRAME_STATE_F32, float_data_arr, sizeof(float_data_arr));
+    TxEnqueue(frame, frame_len);
+  }
+};
+
+/** @brief a TELEMETRY_FRAME_STATE_Q12 frame */
+template <>
+struct TelemetryEncoder<TELEMETRY_ENCODING_Q12> {
+  static void Send(const RocketSnapshot& state) {
+    int16_t fixed_data_arr[TELEMETRY_FIELD_COUNT];
+    static_assert(sizeof(fixed_data_arr) <= TELEMETRY_MAX_PAYLOAD, "STATE_Q12 must fit a frame");
+    StateToQ12(state, fixed_data_arr);
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    size_t frame_len = BuildTelemetryFrame(frame, TELEMETRY_FRAME_STATE_Q12, fixed_data_arr, sizeof(fixed_data_arr));
+    TxEnqueue(frame, frame_len);
+  }
+};
+
+#ifdef TELEMETRY_DELTA
+/** @brief a TELEMETRY_FRAME_STATE_DELTA frame, the STATE_Q12 fields as the changes since the last frame */
+template <>
+struct TelemetryEncoder<TELEMETRY_ENCODING_DELTA> {
+  static void Send(const RocketSnapshot& state) {
+    int16_t fixed_data_arr[TELEMETRY_FIELD_COUNT];
+    StateToQ12(state, fixed_data_arr);
+    SendDeltaFrame(fixed_data_arr);
+  }
+};
+#endif
+
+/** 
+ * @brief Sends the rocket data over serial, encoded as BuildConfig::TELEMETRY 
+ * (ASCII floats, or with TELEMETRY_BINARY one binary frame, with TELEMETRY_DELTA the changes since the last frame)
+ * @param state The state to send
+ */
+void SendDataToSerial(const RocketSnapshot& state)
+{
+  PROFILE_SCOPE(PROFILE_TELEMETRY);
+  TelemetryEncoder<BuildConfig::TELEMETRY>::Send(state);
+}
+
+constexpr float CANARD_MAX_DEFLECTION = 15.0f * DEG2RAD; // mechanical limit of the canards either way from neutral
+
+// servo pulse for a canard rotation, pulse = center + rotation * SERVO_US_PER_RAD
+const uint16_t SERVO_CENTER_US = 1500;              // canard at neutral
+constexpr float SERVO_US_PER_RAD = 10.0f * RAD2DEG; // 10 us per degree, most hobby servos
+const uint16_t SERVO_FRAME_US = 20000;              // 50Hz, raise for digital servos that take faster frames
+const uint8_t SERVO_TICKS_PER_US = Board::SERVO_TICKS_PER_US;
+
+/**
+ * @brief Converts a canard rotation to the servo pulse width
+ * @param radians The rotation from neutral (radians)
+ * @return The pulse width in SERVO_TICKS_PER_US ticks
+ */
+inline uint16_t RadToServoTicks(float radians) {
+  return (uint16_t)((SERVO_CENTER_US + radians * SERVO_US_PER_RAD) * SERVO_TICKS_PER_US + 0.5f);
+}
+
+#ifdef MATH_FIXED_POINT
+const int32_t CANARD_MAX_DEFLECTION_Q = ToFixed(CANARD_MAX_DEFLECTION, CANARD_Q);
+const uint16_t SERVO_CENTER_TICKS = SERVO_CENTER_US * SERVO_TICKS_PER_US;
+// pulse ticks per canard radian * 2^8; taken against the command at 2^14 (CANARD_Q - 6) so the product fits 31 bits
+const int32_t SERVO_TICKS_PER_RAD_Q8 = ToFixed(SERVO_US_PER_RAD * SERVO_TICKS_PER_US, 8);
+// 32 bit binary angle per canard radian * 2^-CANARD_Q, * 2^3 (651.9 turns into 5215 >> 3)
+const int32_t BAM32_PER_CANARD_Q3 = ToFixed(4294967296.0f / PI2 / (1UL << CANARD_Q), 3);
+
+/**
+ * @brief Integer version of SetCanardRotations for MATH_FIXED_POINT builds: 
+ * sets the canard fins from commands in canard radians * 2^CANARD_Q, each held within +-CANARD_MAX_DEFLECTION
+ * @param q The 4 new rotations to the canard fins (canard radians * 2^CANARD_Q)
+ */
+void SetCanardDeflections(const int32_t q[4]) {
+  for (int i = 0; i < 4; i++) {
+    int32_t rotation = (q[i] > CANARD_MAX_DEFLECTION_Q)? CANARD_MAX_DEFLECTION_Q : ((q[i] < -CANARD_MAX_DEFLECTION_Q)? -CANARD_MAX_DEFLECTION_Q : q[i]);
+    Rocket::canard_pulses[i] = (uint16_t)(SERVO_CENTER_TICKS + (((rotation >> 6) * SERVO_TICKS_PER_RAD_Q8 + (1L << 21)) >> 22));
+    Rocket::canard_bam[i] = (uint32_t)((rotation * BAM32_PER_CANARD_Q3) >> 3);
+  }
+}
+#endif
+
+/**
+ * @brief Sets the new rotations (in radians) 
+ * to the canard fins and makes sure each rot is within +-CANARD_MAX_DEFLECTION of neutral
+ * @param rad The 4 new rotations to the canard fins (in radians)
+ */
+void SetCanardRotations(float rad[4]) {
+#ifdef MATH_FIXED_POINT
+  int32_t q[4];
+#endif
+  for (int i = 0; i < 4; i++) {
+    rad[i] = (rad[i] > CANARD_MAX_DEFLECTION)? CANARD_MAX_DEFLECTION : ((rad[i] < -CANARD_MAX_DEFLECTION)? -CANARD_MAX_DEFLECTION : rad[i]);
+#ifdef MATH_FIXED_POINT
+    q[i] = ToFixed(rad[i], CANARD_Q);
+#else
+    Rocket::canard_rotations[i] = rad[i];
+    Rocket::canard_pulses[i] = RadToServoTicks(rad[i]); // converted once here, the actuation task only copies them out
+#endif
+  }
+#ifdef MATH_FIXED_POINT
+  SetCanardDeflections(q);
+#endif
+}
+
+/**
+ * @brief Gets the canard rotations last set
+ * @param rad_ret Array used to retrieve the 4 rotations (in radians)
+ */
+inline void GetCanardRotations(float rad_ret[4]) {
+  for (int i = 0; i < 4; i++) {
+#ifdef MATH_FIXED_POINT
+    rad_ret[i] = bamToRadSigned((bam16_t)(Rocket::canard_bam[i] >> 16));
+#else
+    rad_ret[i] = Rocket::canard_rotations[i];
+#endif
+  }
+}
+
+/**
+ * @brief Heading of the magnetic field with the tilt taken out: the field is turned back to level with
+ * the roll and pitch first, so the heading stays right on a tilted launch rail. Takes the sines and cosines
+ * the caller already has instead of working them out again (equations from NXP AN4248)
+ * @param magX The field along x
+ * @param magY The field along y
+ * @param magZ The field along z
+ * @param sin_roll The sine of the roll
+ * @param cos_roll The cosine of the roll
+ * @param sin_pitch The sine of the pitch
+ * @param cos_pitch The cosine of the pitch
+ * @return The heading in radians, atan2(-magY, magX) when level
+ */
+inline float TiltCompensatedHeading(float magX, float magY, float magZ, float sin_roll, float cos_roll, float sin_pitch, float cos_pitch) {
+  float level_x = magX * cos_pitch + (magY * sin_roll + magZ * cos_roll) * sin_pitch;
+  float level_y = magY * cos_roll - magZ * sin_roll;
+  return mathAtan2(-level_y, level_x);
+}
+
+/**
+ * @brief Computes the orientation of a single sample from the direction of gravity and the magnetic field,
+ * only valid when the rocket is not accelerating
+ * @param sample The sensor sample
+ * @param pitch_ret refrence used to retrieve the pitch angle in radians
+ * @param roll_ret refrence used to retrieve the roll angle in radians
+ * @param yaw_ret refrence used to retrieve the yaw angle in radians
+ */
+void RawOrientation(const IMUSample& sample, float& pitch_ret, float& roll_ret, float& yaw_ret)
+{
+  // equations from https://stackoverflow.com/questions/23009549/roll-pitch-yaw-calculation
+  float accX = sample.accX;
+  float accY = sample.accY;
+  float accZ = sample.accZ;
+
+  float yz_sq = accY*accY + accZ*accZ;
+  float norm_sq = yz_sq + accX*accX;
+  float inv_yz = (yz_sq > 0.0f)? mathInvSqrt(yz_sq) : 0.0f;
+  float inv_norm = (norm_sq > 0.0f)? mathInvSqrt(norm_sq) : 0.0f;
+  float yz = yz_sq * inv_yz; // x / sqrt(x) = sqrt(x)
+  roll_ret = mathAtan2(accY, accZ);
+  pitch_ret = mathAtan2(-accX, yz);
+
+  // the sines and cosines of roll and pitch are just the gravity direction
+  float sin_roll = (yz_sq > 0.0f)? accY * inv_yz : 0.0f;
+  float cos_roll = (yz_sq > 0.0f)? accZ * inv_yz : 1.0f;
+  yaw_ret = TiltCompensatedHeading(sample.magX, sample.magY, sample.magZ, sin_roll, cos_roll, -accX * inv_norm, yz * inv_norm);
+}
+
+/**
+ * @brief Integer version of RawOrientation for MATH_FIXED_POINT builds, works on the raw counts
+ * @param sample The sensor sample
+ * @param pitch_ret refrence used to retrieve the pitch angle
+ * @param roll_ret refrence used to retrieve the roll angle
+ * @param yaw_ret refrence used to retrieve the yaw angle
+ */
+void RawOrientationBam(const IMUSample& sample, bam16_t& pitch_ret, bam16_t& roll_ret, bam16_t& yaw_ret)
+{
+  int32_t accX = sample.accRaw[0];
+  int32_t accY = sample.accRaw[1];
+  int32_t accZ = sample.accRaw[2];
+
+  uint32_t yz = isqrt32((uint32_t)(accY * accY) + (uint32_t)(accZ * accZ));
+  roll_ret = atan2Bam(accY, accZ);
+  pitch_ret = atan2Bam(-accX, yz);
+
+  // TiltCompensatedHeading with both sides multiplied by |g| * |g_yz| so there is nothing to divide:
+  // y = (mz gy - my gz) |g|, x = mx |g_yz|^2 - gx (my gy + mz gz). Gravity is cut to ~9 bits and
+  // the mag to +-1024 counts (150uT) so the products stay in 31 bits
+  int32_t gx = accX >> 6, gy = accY >> 6, gz = accZ >> 6;
+  int32_t mx = sample.magRaw[0], my = sample.magRaw[1], mz = sample.magRaw[2];
+  mx = (mx > 1024)? 1024 : ((mx < -1024)? -1024 : mx);
+  my = (my > 1024)? 1024 : ((my < -1024)? -1024 : my);
+  mz = (mz > 1024)? 1024 : ((mz < -1024)? -1024 : mz);
+  int32_t g = (int32_t)isqrt32((uint32_t)(gx * gx + gy * gy + gz * gz));
+  int32_t level_y = (mz * gy - my * gz) * g;
+  int32_t level_x = mx * (gy * gy + gz * gz) - gx * (my * gy + mz * gz);
+  // only the ratio matters; cut to +-32767 so the CORDIC vector cannot outgrow 31 bits even at 45 degrees
+  while (level_y > 32767 || level_y < -32767 || level_x > 32767 || level_x < -32767) {
+    level_y /= 2;
+    level_x /= 2;
+  }
+  yaw_ret = atan2Bam(level_y, level_x);
+}
+
+/***************************************************************
+                    ORIENTATION FILTER
+***************************************************************/
+// Mahony filter: the gyro is integrated into the quaternion every sample and the error between the
+// measured and the estimated gravity (and heading) is fed back as a rotation rate, its integral 
+// is the learned gyro bias. Constant time per sample and no allocation.
+const float MAHONY_KP = 2.0f;              // proportional gain (rad/s per unit error), how hard accel/mag pull on the gyro
+const float MAHONY_KI = 0.1f;              // integral gain, how fast the gyro bias is learned
+const float MAHONY_HEADING_GAIN = 0.5f;    // weight of the mag heading error compared to the accel error
+const float MAHONY_MAX_BIAS = 0.1f;        // largest gyro bias that can be learned (rad/s)
+const float ACCEL_TRUST_MG = 150.0f;       // the accel only corrects when its magnitude is this close to 1g, not under thrust
+const float MAHONY_MAX_DT = 0.05f;         // longer gaps between samples are not integrated (seconds)
+const unsigned long MAG_FUSION_PERIOD_US = 10000; // the AK09916 only makes a new reading at 100Hz, the heading error is reused in between
+
+/** 
+ * @brief namespace that holds the state of the Mahony filter
+ */
+namespace Mahony {
+  float q[4] = {1.0f, 0.0f, 0.0f, 0.0f}; // orientation (w, x, y, z)
+  float bias_integral[3] = {0.0f};       // integral feedback, the negative of the learned gyro bias (rad/s)
+  bool initialized = false;
+  float heading_err = 0.0f;              // last heading error (rad) * MAHONY_HEADING_GAIN
+  unsigned long heading_timestamp = 0;   // sample timestamp heading_err was worked out at
+  bool heading_valid = false;
+}
+
+/**
+ * @brief Runs one sample through the Mahony filter
+ * @param sample The sensor sample
+ * @param sampleDt The time between this sample and the previous one (seconds)
+ */
+void MahonyUpdate(const IMUSample& sample, float sampleDt)
+{
+  float* q = Mahony::q;
+  if (!Mahony::initialized) {
+    // start from the raw orientation so the filter does not have to converge from level
+    float pitch, roll, yaw;
+    RawOrientation(sample, pitch, roll, yaw);
+    EulerToQuaternion(pitch, roll, yaw, q);
+    Mahony::initialized = true;
+    return;
+  }
+  if (sampleDt <= 0.0f || sampleDt > MAHONY_MAX_DT) {
+    return;
+  }
+
+  float gx = sample.gyrX * DEG2RAD;
+  float gy = sample.gyrY * DEG2RAD;
+  float gz = sample.gyrZ * DEG2RAD;
+
+  // estimated direction of gravity in the body frame
+  float vx = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+  float vy = 2.0f * (q[0] * q[1] + q[2] * q[3]);
+  float vz = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+
+  float ex = 0.0f, ey = 0.0f, ez = 0.0f;
+  bool has_error = false;
+
+  float acc_norm_sq = sample.accX * sample.accX + sample.accY * sample.accY + sample.accZ * sample.accZ;
+  float inv_norm = (acc_norm_sq > 0.0f)? mathInvSqrt(acc_norm_sq) : 0.0f;
+  float acc_norm = acc_norm_sq * inv_norm;
+  if (fabsf(acc_norm - 1000.0f) < ACCEL_TRUST_MG) {
+    // error is the cross product between the measured and the estimated gravity
+    float ax = sample.accX * inv_norm;
+    float ay = sample.accY * inv_norm;
+    float az = sample.accZ * inv_norm;
+    ex = ay * vz - az * vy;
+    ey = az * vx - ax * vz;
+    ez = ax * vy - ay * vx;
+    has_error = true;
+  }
+
+  if (sample.magX != 0.0f || sample.magY != 0.0f) {
+    if (!Mahony::heading_valid || sample.timestamp - Mahony::heading_timestamp >= MAG_FUSION_PERIOD_US) {
+      // tilt compensated with the estimated roll and pitch, whose sines and cosines are the gravity direction v
+      float yz_sq = vy * vy + vz * vz;
+      float inv_yz = (yz_sq > 0.0f)? mathInvSqrt(yz_sq) : 0.0f;
+      float sin_roll = (yz_sq > 0.0f)? vy * inv_yz : 0.0f;
+      float cos_roll = (yz_sq > 0.0f)? vz * inv_yz : 1.0f;
+      float yaw_m = TiltCompensatedHeading(sample.magX, sample.magY, sample.magZ, sin_roll, cos_roll, -vx, yz_sq * inv_yz);
+      float yaw_est = mathAtan2(2.0f * (q[0] * q[3] + q[1] * q[2]), 1.0f - 2.0f * (q[2] * q[2] + q[3] * q[3]));
+      Mahony::heading_err = wrapPi(yaw_m - yaw_est) * MAHONY_HEADING_GAIN;
+      Mahony::heading_timestamp = sample.timestamp;
+      Mahony::heading_valid = true;
+    }
+    // heading error is a rotation about the vertical, which is the gravity direction in the body frame
+    ex += Mahony::heading_err * vx;
+    ey += Mahony::heading_err * vy;
+    ez += Mahony::heading_err * vz;
+    has_error = true;
+  }
+
+  if (has_error) {
+    float* bias = Mahony::bias_integral;
+    bias[0] += MAHONY_KI * ex * sampleDt;
+    bias[1] += MAHONY_KI * ey * sampleDt;
+    bias[2] += MAHONY_KI * ez * sampleDt;
+    for (int i = 0; i < 3; i++) {
+      bias[i] = (bias[i] > MAHONY_MAX_BIAS)? MAHONY_MAX_BIAS : ((bias[i] < -MAHONY_MAX_BIAS)? -MAHONY_MAX_BIAS : bias[i]);
+    }
+    gx += MAHONY_KP * ex;
+    gy += MAHONY_KP * ey;
+    gz += MAHONY_KP * ez;
+  }
+  gx += Mahony::bias_integral[0];
+  gy += Mahony::bias_integral[1];
+  gz += Mahony::bias_integral[2];
+
+  // integrate q' = 0.5 * q * (0, g)
+  gx *= 0.5f * sampleDt;
+  gy *= 0.5f * sampleDt;
+  gz *= 0.5f * sampleDt;
+  float qw = q[0], qx = q[1], qy = q[2];
+  q[0] += -qx * gx - qy * gy - q[3] * gz;
+  q[1] += qw * gx + qy * gz - q[3] * gy;
+  q[2] += qw * gy - qx * gz + q[3] * gx;
+  q[3] += qw * gz + qx * gy - qy * gx;
+
+  NormalizeQuaternion(q);
+}
+
+/**
+ * @brief Sets the orientation from one sensor sample using the selected ESTIMATOR
+ * @param sample The sensor sample
+ * @param sampleDt The time between this sample and the previous one (seconds)
+ */
+void EstimateOrientation(const IMUSample& sample, float sampleDt)
+{
+#if ESTIMATOR == ESTIMATOR_MAHONY
+  MahonyUpdate(sample, sampleDt);
+  SetAttitude(Mahony::q);
+#elif defined(MATH_FIXED_POINT)
+  bam16_t pitch, roll, yaw;
+  RawOrientationBam(sample, pitch, roll, yaw);
+  SetOrientationBam(pitch, roll, yaw);
+  (void)sampleDt;
+#else
+  float pitch, roll, yaw;
+  RawOrientation(sample, pitch, roll, yaw);
+  SetOrientation(pitch, roll, yaw);
+  (void)sampleDt;
+#endif
+}
+
+// raw sensor scales for the full scale ranges the ICM starts up with (ConfigureFIFO sets the same ones)
+constexpr float ACC_LSB_PER_MG = 16.384f;  // +-2g
+constexpr float GYR_LSB_PER_DPS = 131.0f;  // +-250 degrees per second
+constexpr float MAG_UT_PER_LSB = 0.15f;    // AK09916, fixed range
+
+/***************************************************************
+                    SENSOR CALIBRATION
+***************************************************************/
+// The accel and mag are corrected as corrected = matrix * (reading - offset): the offset is the accel bias or 
+// the hard iron of the airframe, the matrix the scale, cross axis and soft iron errors. CALIBRATION_MODE fits 
+// both by fitting an ellipsoid to readings in every orientation and mapping it back onto a sphere, and 
+// saves them to EEPROM. At runtime the units, matrix and offset are folded into one gain and bias per axis
+// (PrepareCalibration) so correcting a sample is a single multiply-add pass over the raw counts.
+const uint16_t CAL_EEPROM_ADDRESS = 0;
+const uint16_t CAL_MAGIC = 0xCA11;
+// the AK09916 inside the ICM has its y and z axes the other way around from the accel and gyro;
+// folded into the mag gain, so the corrected mag is in the same body axes as the rest
+const float MAG_AXIS_SIGN[3] = {1.0f, -1.0f, -1.0f};
+
+/** @brief the calibration as it is saved in EEPROM, in sensor units (mg, uT) */
+struct CalibrationData {
+  uint16_t magic;             // CAL_MAGIC if the EEPROM holds a calibration
+  float acc_offset[3];        // mg
+  float acc_matrix[3][3];
+  float mag_offset[3];        // uT
+  float mag_matrix[3][3];
+  uint16_t crc;               // Crc16 of everything before it
+};
+
+/** 
+ * @brief namespace that holds the calibration and the fused corrections worked out from it
+ */
+namespace Calibration {
+  CalibrationData data = {CAL_MAGIC, {0.0f, 0.0f, 0.0f}, {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}}, 
+                          {0.0f, 0.0f, 0.0f}, {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}}, 0};
+  bool loaded = false;        // the EEPROM held a calibration, identity is used otherwise
+#ifdef MATH_FIXED_POINT
+  // corrected counts = (gain * raw) >> 14 + bias
+  int16_t acc_gain[3][3];     // matrix * 16384
+  int16_t acc_bias[3];        // counts
+  int16_t mag_gain[3][3];
+  int16_t mag_bias[3];
+#else
+  // corrected reading = gain * raw + bias
+  float acc_gain[3][3];       // mg per count
+  float acc_bias[3];          // mg
+  float mag_gain[3][3];       // uT per count
+  float mag_bias[3];          // uT
+#endif
+}
+
+/**
+ * @brief Folds the units, matrix and offset of one sensor into the gain and bias applied to the raw counts
+ * @param matrix The correction matrix
+ * @param offset The offset (sensor units)
+ * @param units_per_lsb Sensor units per raw count
+ * @param axis_sign Sign of each corrected axis, turns the sensor axes into the body axes
+ * @param gain_ret The gain matrix
+ * @param bias_ret The bias
+ */
+template <typename T>
+void FuseCorrection(const float matrix[3][3], const float offset[3], float units_per_lsb, const float axis_sign[3], T gain_ret[3][3], T bias_ret[3])
+{
+  for (int r = 0; r < 3; r++) {
+    float bias = 0.0f;
+    for (int c = 0; c < 3; c++) {
+      float m = matrix[r][c] * axis_sign[r];
+      bias -= m * offset[c];
+#ifdef MATH_FIXED_POINT
+      gain_ret[r][c] = (T)(m * 16384.0f + ((m < 0.0f)? -0.5f : 0.5f));
+#else
+      gain_ret[r][c] = (T)(m * units_per_lsb);
+#endif
+    }
+#ifdef MATH_FIXED_POINT
+    bias /= units_per_lsb;
+    bias_ret[r] = (T)(bias + ((bias < 0.0f)? -0.5f : 0.5f));
+#else
+    bias_ret[r] = (T)bias;
+#endif
+  }
+}
+
+/** @brief Works out the fused gains and biases from Calibration::data */
+void PrepareCalibration()
+{
+  const float ACC_AXIS_SIGN[3] = {1.0f, 1.0f, 1.0f};
+  FuseCorrection(Calibration::data.acc_matrix, Calibration::data.acc_offset, 1.0f / ACC_LSB_PER_MG, ACC_AXIS_SIGN, Calibration::acc_gain, Calibration::acc_bias);
+  FuseCorrection(Calibration::data.mag_matrix, Calibration::data.mag_offset, MAG_UT_PER_LSB, MAG_AXIS_SIGN, Calibration::mag_gain, Calibration::mag_bias);
+}
+
+/** @brief Loads the calibration from EEPROM if one was saved, keeps identity otherwise */
+void LoadCalibration()
+{
+#if defined(ESP32) || defined(ARDUINO_ARCH_RP2040)
+  EEPROM.begin(sizeof(CalibrationData)); // these emulate the EEPROM in flash and need to know the size
+#endif
+  CalibrationData stored;
+  EEPROM.get(CAL_EEPROM_ADDRESS, stored);
+  Calibration::loaded = (stored.magic == CAL_MAGIC) 
+    && (Crc16((const uint8_t*)&stored, offsetof(CalibrationData, crc)) == stored.crc);
+  if (Calibration::loaded) {
+    Calibration::data = stored;
+  }
+  PrepareCalibration();
+}
+
+/** @brief Saves Calibration::data to EEPROM */
+void SaveCalibration()
+{
+  Calibration::data.magic = CAL_MAGIC;
+  Calibration::data.crc = Crc16((const uint8_t*)&Calibration::data, offsetof(CalibrationData, crc));
+  EEPROM.put(CAL_EEPROM_ADDRESS, Calibration::data);
+#if defined(ESP32) || defined(ARDUINO_ARCH_RP2040)
+  EEPROM.commit();
+#endif
+}
+
+#ifdef MATH_FIXED_POINT
+/**
+ * @brief Corrects raw counts in place, integer gain and bias
+ * @param raw The raw counts (x, y, z)
+ * @param gain The Q14 gain
+ * @param bias The bias in counts
+ */
+inline void CorrectCounts(int16_t raw[3], const int16_t gain[3][3], const int16_t bias[3]) {
+  int32_t in[3] = {raw[0], raw[1], raw[2]};
+  for (int r = 0; r < 3; r++) {
+    int32_t out = ((gain[r][0] * in[0] + gain[r][1] * in[1] + gain[r][2] * in[2]) >> 14) + bias[r];
+    raw[r] = (int16_t)((out > 32767)? 32767 : ((out < -32768)? -32768 : out));
+  }
+}
+#endif
+
+/**
+ * @brief Fills in the calibrated float readings of a sample from its raw counts, one multiply-add pass;
+ * fixed-point builds do not use the floats, so they correct the acc and mag counts in place instead
+ * @param sample The sample
+ */
+inline void ScaleRawSample(IMUSample& sample) {
+#ifdef MATH_FIXED_POINT
+  CorrectCounts(sample.accRaw, Calibration::acc_gain, Calibration::acc_bias);
+  CorrectCounts(sample.magRaw, Calibration::mag_gain, Calibration::mag_bias);
+#else
+  const float GYR_DPS_PER_LSB = 1.0f / GYR_LSB_PER_DPS;
+  const float (*ag)[3] = Calibration::acc_gain;
+  const float (*mg)[3] = Calibration::mag_gain;
+  const int16_t* a = sample.accRaw;
+  const int16_t* m = sample.magRaw;
+  sample.accX = ag[0][0] * a[0] + ag[0][1] * a[1] + ag[0][2] * a[2] + Calibration::acc_bias[0];
+  sample.accY = ag[1][0] * a[0] + ag[1][1] * a[1] + ag[1][2] * a[2] + Calibration::acc_bias[1];
+  sample.accZ = ag[2][0] * a[0] + ag[2][1] * a[1] + ag[2][2] * a[2] + Calibration::acc_bias[2];
+  sample.gyrX = sample.gyrRaw[0] * GYR_DPS_PER_LSB;
+  sample.gyrY = sample.gyrRaw[1] * GYR_DPS_PER_LSB;
+  sample.gyrZ = sample.gyrRaw[2] * GYR_DPS_PER_LSB;
+  sample.magX = mg[0][0] * m[0] + mg[0][1] * m[1] + mg[0][2] * m[2] + Calibration::mag_bias[0];
+  sample.magY = mg[1][0] * m[0] + mg[1][1] * m[1] + mg[1][2] * m[2] + Calibration::mag_bias[1];
+  sample.magZ = mg[2][0] * m[0] + mg[2][1] * m[1] + mg[2][2] * m[2] + Calibration::mag_bias[2];
+#endif
+}
+
+#ifdef CALIBRATION_MODE
+const uint16_t CAL_SAMPLES = 1500;            // mag samples to fit, 30 seconds at CAL_SAMPLE_PERIOD_MS
+const unsigned long CAL_SAMPLE_PERIOD_MS = 20;
+const float CAL_STILL_DPS = 20.0f;            // the accel only counts while turning slower than this, so it only sees gravity
+const float CAL_ACC_RADIUS_MG = 1000.0f;      // 1g in every direction
+
+/** @brief the normal equations of the ellipsoid fit, built up one reading at a time so no readings are kept */
+struct EllipsoidFit {
+  float ata[9][9];
+  float atb[9];
+  float scale;      // readings are divided by this so the sums stay in a range floats can hold
+  uint16_t count;
+};
+
+/**
+ * @brief Adds a reading to the fit of A x^2 + B y^2 + C z^2 + 2D xy + 2E xz + 2F yz + 2G x + 2H y + 2I z = 1
+ * @param fit The fit
+ * @param x The reading (x, y, z)
+ */
+void AddToEllipsoidFit(EllipsoidFit& fit, const float x[3])
+{
+  float u = x[0] / fit.scale, v = x[1] / fit.scale, w = x[2] / fit.scale;
+  float row[9] = {u * u, v * v, w * w, 2.0f * u * v, 2.0f * u * w, 2.0f * v * w, 2.0f * u, 2.0f * v, 2.0f * w};
+  for (int i = 0; i < 9; i++) {
+    for (int j = i; j < 9; j++) {
+      fit.ata[i][j] += row[i] * row[j];
+    }
+    fit.atb[i] += row[i];
+  }
+  fit.count++;
+}
+
+/**
+ * @brief Solves a x = b by gaussian elimination with partial pivoting
+ * @param a The n x n matrix (row major), destroyed
+ * @param b The right side, the solution on return
+ * @param n The size
+ * @return false if the matrix is singular
+ */
+bool SolveLinear(float* a, float* b, uint8_t n)
+{
+  for (uint8_t col = 0; col < n; col++) {
+    uint8_t pivot = col;
+    for (uint8_t r = col + 1; r < n; r++) {
+      pivot = (fabsf(a[r * n + col]) > fabsf(a[pivot * n + col]))? r : pivot;
+    }
+    if (fabsf(a[pivot * n + col]) < 1e-12f) {
+      return false;
+    }
+    if (pivot != col) {
+      for (uint8_t c = 0; c < n; c++) {
+        float t = a[col * n + c]; a[col * n + c] = a[pivot * n + c]; a[pivot * n + c] = t;
+      }
+      float t = b[col]; b[col] = b[pivot]; b[pivot] = t;
+    }
+    for (uint8_t r = col + 1; r < n; r++) {
+      float f = a[r * n + col] / a[col * n + col];
+      for (uint8_t c = col; c < n; c++) {
+        a[r * n + c] -= f * a[col * n + c];
+      }
+      b[r] -= f * b[col];
+    }
+  }
+  for (int8_t r = n - 1; r >= 0; r--) {
+    float sum = b[r];
+    for (uint8_t c = r + 1; c < n; c++) {
+      sum -= a[r * n + c] * b[c];
+    }
+    b[r] = sum / a[r * n + r];
+  }
+  return true;
+}
+
+/**
+ * @brief Eigen decomposition of a symmetric 3x3 matrix by cyclic jacobi rotations
+ * @param a The matrix, destroyed (ends up diagonal)
+ * @param vectors_ret The eigenvectors as columns
+ * @param values_ret The eigenvalues
+ */
+void SymmetricEigen3(float a[3][3], float vectors_ret[3][3], float values_ret[3])
+{
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      vectors_ret[i][j] = (i == j)? 1.0f : 0.0f;
+    }
+  }
+  for (int sweep = 0; sweep < 16; sweep++) {
+    if (fabsf(a[0][1]) + fabsf(a[0][2]) + fabsf(a[1][2]) < 1e-9f) {
+      break;
+    }
+    for (int p = 0; p < 2; p++) {
+      for (int q = p + 1; q < 3; q++) {
+        if (a[p][q] == 0.0f) {
+          continue;
+        }
+        // rotation that zeroes a[p][q]
+        float theta = (a[q][q] - a[p][p]) / (2.0f * a[p][q]);
+        float t = ((theta >= 0.0f)? 1.0f : -1.0f) / (fabsf(theta) + sqrtf(theta * theta + 1.0f));
+        float c = 1.0f / sqrtf(t * t + 1.0f);
+        float s = t * c;
+        for (int k = 0; k < 3; k++) {
+          float akp = a[k][p], akq = a[k][q];
+          a[k][p] = c * akp - s * akq;
+          a[k][q] = s * akp + c * akq;
+        }
+        for (int k = 0; k < 3; k++) {
+          float apk = a[p][k], aqk = a[q][k];
+          a[p][k] = c * apk - s * aqk;
+          a[q][k] = s * apk + c * aqk;
+        }
+        for (int k = 0; k < 3; k++) {
+          float vkp = vectors_ret[k][p], vkq = vectors_ret[k][q];
+          vectors_ret[k][p] = c * vkp - s * vkq;
+          vectors_ret[k][q] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    values_ret[i] = a[i][i];
+  }
+}
+
+/**
+ * @brief Solves the ellipsoid fit and works out the offset and matrix that map the ellipsoid onto a sphere
+ * @param fit The fit
+ * @param radius Radius of the sphere (sensor units), 0 to keep the volume of the ellipsoid (keeps the field strength)
+ * @param offset_ret The center of the ellipsoid
+ * @param matrix_ret The correction matrix
+ * @return false if the readings do not make an ellipsoid (too few orientations)
+ */
+bool SolveEllipsoidFit(EllipsoidFit& fit, float radius, float offset_ret[3], float matrix_ret[3][3])
+{
+  if (fit.count < 9) {
+    return false;
+  }
+  for (int i = 0; i < 9; i++) {
+    for (int j = 0; j < i; j++) {
+      fit.ata[i][j] = fit.ata[j][i];
+    }
+  }
+  float v[9];
+  memcpy(v, fit.atb, sizeof(v));
+  if (!SolveLinear(&fit.ata[0][0], v, 9)) {
+    return false;
+  }
+
+  // (u - c)' M (u - c) = k with the center c = -M^-1 (G, H, I) and k = 1 + c' M c
+  float m[3][3] = {{v[0], v[3], v[4]}, {v[3], v[1], v[5]}, {v[4], v[5], v[2]}};
+  float center[3] = {-v[6], -v[7], -v[8]};
+  float m_copy[3][3];
+  memcpy(m_copy, m, sizeof(m));
+  if (!SolveLinear(&m_copy[0][0], center, 3)) {
+    return false;
+  }
+  float k = 1.0f;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      k += center[i] * m[i][j] * center[j];
+    }
+  }
+  if (k <= 0.0f) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      m[i][j] /= k;
+    }
+  }
+
+  // the matrix square root of M / k maps the ellipsoid onto the unit sphere
+  float vectors[3][3], values[3];
+  SymmetricEigen3(m, vectors, values);
+  if (values[0] <= 0.0f || values[1] <= 0.0f || values[2] <= 0.0f) {
+    return false;
+  }
+  float radius_scaled = (radius > 0.0f)? radius / fit.scale : powf(values[0] * values[1] * values[2], -1.0f / 6.0f);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      float sum = 0.0f;
+      for (int e = 0; e < 3; e++) {
+        sum += vectors[i][e] * sqrtf(values[e]) * vectors[j][e];
+      }
+      matrix_ret[i][j] = radius_scaled * sum;
+    }
+    offset_ret[i] = center[i] * fit.scale;
+  }
+  return true;
+}
+
+/** @brief Prints one sensor's calibration */
+void PrintCalibration(const char* name, const float offset[3], const float matrix[3][3])
+{
+  Serial.print("# ");
+  Serial.print(name);
+  Serial.print(" offset");
+  for (int i = 0; i < 3; i++) {
+    Serial.print(" ");
+    Serial.print(offset[i], 3);
+  }
+  Serial.print(" matrix");
+  for (int i = 0; i < 9; i++) {
+    Serial.print(" ");
+    Serial.print(matrix[i / 3][i % 3], 4);
+  }
+  Serial.println();
+}
+
+/**
+ * @brief Collects readings while the rocket is turned through every orientation, fits the accel and mag 
+ * corrections and saves them to EEPROM; blocks until it is done, only used by CALIBRATION_MODE
+ */
+void RunCalibration()
+{
+  static EllipsoidFit acc_fit, mag_fit; // too big for the AVR stack
+  memset(&acc_fit, 0, sizeof(acc_fit));
+  memset(&mag_fit, 0, sizeof(mag_fit));
+  acc_fit.scale = CAL_ACC_RADIUS_MG;
+  mag_fit.scale = 50.0f; // about the earth's field in uT
+
+  Serial.println("# calibrating: turn the rocket slowly through every orientation");
+  unsigned long next_sample = millis();
+  while (mag_fit.count < CAL_SAMPLES) {
+    if ((long)(millis() - next_sample) < 0 || !ICM_Obj.dataReady()) {
+      continue;
+    }
+    next_sample += CAL_SAMPLE_PERIOD_MS;
+    ICM_Obj.getAGMT();
+    float acc[3], mag[3], gyr_sq = 0.0f;
+    for (int i = 0; i < 3; i++) {
+      acc[i] = ICM_Obj.agmt.acc.i16bit[i] / ACC_LSB_PER_MG;
+      mag[i] = ICM_Obj.agmt.mag.i16bit[i] * MAG_UT_PER_LSB;
+      float gyr = ICM_Obj.agmt.gyr.i16bit[i] / GYR_LSB_PER_DPS;
+      gyr_sq += gyr * gyr;
+    }
+    AddToEllipsoidFit(mag_fit, mag);
+    if (gyr_sq < CAL_STILL_DPS * CAL_STILL_DPS) {
+      AddToEllipsoidFit(acc_fit, acc);
+    }
+    if (mag_fit.count % 250 == 0) {
+      Serial.print("# ");
+      Serial.print((unsigned long)mag_fit.count);
+      Serial.print(" / ");
+      Serial.println((unsigned long)CAL_SAMPLES);
+    }
+  }
+
+  CalibrationData result = Calibration::data;
+  bool acc_ok = SolveEllipsoidFit(acc_fit, CAL_ACC_RADIUS_MG, result.acc_offset, result.acc_matrix);
+  bool mag_ok = SolveEllipsoidFit(mag_fit, 0.0f, result.mag_offset, result.mag_matrix);
+  if (!acc_ok || !mag_ok) {
+    Serial.println(acc_ok? "# mag fit failed, cover more orientations and try again" : "# accel fit failed, hold still in more orientations and try again");
+    return;
+  }
+  Calibration::data = result;
+  SaveCalibration();
+  PrepareCalibration();
+  PrintCalibration("acc", result.acc_offset, result.acc_matrix);
+  PrintCalibration("mag", result.mag_offset, result.mag_matrix);
+  Serial.println("# calibration saved");
+}
+#endif
+
+// the ICM's registers from ACCEL_XOUT_H on are accel and gyro (12 bytes, big-endian), the temperature (2 bytes) 
+// and then from EXT_SLV_SENS_DATA_00 the 9 bytes its I2C master copies from the magnetometer: ST1, X, Y, Z 
+// (little-endian), TMPS, ST2. getAGMT() reads all 23 every time; the temperature is never used and the 
+// AK09916 only makes a new reading every 10ms (100Hz continuous mode), so only accel and gyro are read every 
+// sample and the mag every MAG_READ_DIVIDER th (at the 1kHz sensor rate), the last mag reading is kept in between
+const uint8_t ICM_ACC_GYR_BYTES = 12;
+const uint8_t ICM_MAG_BYTES = 9;
+const uint8_t MAG_READ_DIVIDER = 10;
+
+/**
+ * @brief Reads the latest values of the ICM into a sample, the mag only every MAG_READ_DIVIDER th call
+ * @param sample The sample to fill (everything but the timestamp)
+ * @return false if the accel and gyro read failed, the sample is not filled then and has to be skipped
+ */
+bool ReadSampleFromICM(IMUSample& sample)
+{
+  uint8_t regs[ICM_ACC_GYR_BYTES] = {0};
+  bool read_mag = (Sensor::mag_countdown == 0);
+  bool read_ok;
+  {
+    PROFILE_SCOPE(PROFILE_ICM_READ);
+    unsigned long start = micros();
+    // setBank only writes the bank register when it is not already 0
+    read_ok = ICM_Obj.setBank(0) == ICM_20948_Stat_Ok
+           && ICM_Obj.read(AGB0_REG_ACCEL_XOUT_H, regs, sizeof(regs)) == ICM_20948_Stat_Ok;
+    if (read_ok && read_mag) {
+      uint8_t mag[ICM_MAG_BYTES];
+      if (ICM_Obj.read(AGB0_REG_EXT_SLV_SENS_DATA_00, mag, sizeof(mag)) == ICM_20948_Stat_Ok) {
+        for (int i = 0; i < 3; i++) {
+          Sensor::mag_cache[i] = (int16_t)((mag[2 + 2 * i] << 8) | mag[1 + 2 * i]);
+        }
+      }
+    }
+    RecordReadTime(start);
+  }
+  if (!read_ok) {
+    // the last sample stands, like getAGMT() keeps its values when a read fails; the mag is read the next time
+    Sensor::read_errors++;
+    return false;
+  }
+  Sensor::mag_countdown = read_mag? MAG_READ_DIVIDER - 1 : Sensor::mag_countdown - 1;
+
+  for (int i = 0; i < 3; i++) {
+    sample.accRaw[i] = (int16_t)((regs[2 * i] << 8) | regs[2 * i + 1]);
+    sample.gyrRaw[i] = (int16_t)((regs[6 + 2 * i] << 8) | regs[7 + 2 * i]);
+    sample.magRaw[i] = Sensor::mag_cache[i];
+  }
+  ScaleRawSample(sample);
+  return true;
+}
+
+// one FIFO record is accel (6 bytes, big-endian), gyro (6 bytes, big-endian) and the 9 bytes the ICM's
+// I2C master copies from the magnetometer: ST1, X, Y, Z (little-endian), TMPS, ST2
+const uint8_t FIFO_SAMPLE_BYTES = 21;
+const uint16_t FIFO_SIZE = 512;
+// SPI has no buffer limit, a burst of samples at a time; the AVR Wire buffer is 32 bytes, so longer reads are split
+const uint8_t FIFO_READ_CHUNK = (BuildConfig::TRANSPORT == ICM_TRANSPORT_SPI)? 4 * FIFO_SAMPLE_BYTES : 32;
+const unsigned long FIFO_SAMPLE_PERIOD_US = (1000000UL * (1 + FIFO_SAMPLE_RATE_DIV)) / 1100;
+
+/**
+ * @brief Sets the ICM to write accel, gyro and mag samples into its fifo at a fixed rate
+ */
+void ConfigureFIFO()
+{
+  ICM_20948_fss_t fss;
+  fss.a = gpm2;
+  fss.g = dps250;
+  ICM_Obj.setFullScale(ICM_20948_Internal_Acc | ICM_20948_Internal_Gyr, fss);
+  ICM_Obj.setSampleMode(ICM_20948_Internal_Acc | ICM_20948_Internal_Gyr, ICM_20948_Sample_Mode_Continuous);
+
+  ICM_20948_smplrt_t smplrt;
+  smplrt.a = FIFO_SAMPLE_RATE_DIV;
+  smplrt.g = FIFO_SAMPLE_RATE_DIV;
+  ICM_Obj.setSampleRate(ICM_20948_Internal_Acc | ICM_20948_Internal_Gyr, smplrt);
+
+  ICM_Obj.setBank(0);
+  uint8_t fifo_en_1 = 0x01; // SLV_0_FIFO_EN, the magnetometer data
+  uint8_t fifo_en_2 = 0x1E; // ACCEL_FIFO_EN and GYRO_X/Y/Z_FIFO_EN
+  ICM_Obj.write(AGB0_REG_FIFO_EN_1, &fifo_en_1, 1);
+  ICM_Obj.write(AGB0_REG_FIFO_EN_2, &fifo_en_2, 1);
+
+  // snapshot mode stops writing when full instead of overwriting, so records never get misaligned
+  ICM_Obj.setFIFOmode(true);
+  ICM_Obj.enableFIFO(true);
+  ICM_Obj.resetFIFO();
+}
+
+/**
+ * @brief Converts one FIFO record into a sample (everything but the timestamp)
+ * @param record The FIFO_SAMPLE_BYTES bytes of the record
+ * @param sample The sample to fill
+ */
+void ParseFIFORecord(const uint8_t* record, IMUSample& sample)
+{
+  for (int i = 0; i < 3; i++) {
+    sample.accRaw[i] = (int16_t)((record[2 * i] << 8) | record[2 * i + 1]);
+    sample.gyrRaw[i] = (int16_t)((record[6 + 2 * i] << 8) | record[7 + 2 * i]);
+    sample.magRaw[i] = (int16_t)((record[14 + 2 * i] << 8) | record[13 + 2 * i]);
+  }
+  ScaleRawSample(sample);
+}
+
+/**
+ * @brief Reads up to FIFO_BURST_SAMPLES samples from the ICM fifo, oldest first
+ * @param samples Array of FIFO_BURST_SAMPLES samples to fill
+ * @return The amount of samples read
+ */
+uint8_t ReadSamplesFromFIFO(IMUSample* samples)
+{
+  PROFILE_SCOPE(PROFILE_ICM_READ);
+  unsigned long start = micros();
+  uint16_t fifo_bytes = 0;
+  if (ICM_Obj.getFIFOcount(&fifo_bytes) != ICM_20948_Stat_Ok) {
+    return 0;
+  }
+  if (fifo_bytes > FIFO_SIZE - FIFO_SAMPLE_BYTES) {
+    // full, the chip stopped writing; start over rather than hand out a gap as if it were continuous
+    ICM_Obj.resetFIFO();
+    Sensor::fifo_overflows++;
+    return 0;
+  }
+
+  uint16_t available = fifo_bytes / FIFO_SAMPLE_BYTES;
+  uint8_t count = (available < FIFO_BURST_SAMPLES)? (uint8_t)available : FIFO_BURST_SAMPLES;
+  if (count == 0) {
+    return 0;
+  }
+
+  uint8_t records[FIFO_BURST_SAMPLES * FIFO_SAMPLE_BYTES] = {0};
+  uint16_t total = count * FIFO_SAMPLE_BYTES;
+  for (uint16_t offset = 0; offset < total; offset += FIFO_READ_CHUNK) {
+    uint16_t chunk = total - offset;
+    if (ICM_Obj.readFIFO(records + offset, (chunk < FIFO_READ_CHUNK)? (uint8_t)chunk : FIFO_READ_CHUNK) != ICM_20948_Stat_Ok) {
+      // nothing says how much of the chunk left the fifo, so the records are out of step for good (snapshot 
+      // mode never drops one to line them up again); start over like on an overflow
+      ICM_Obj.resetFIFO();
+      Sensor::read_errors++;
+      return 0;
+    }
+  }
+  RecordReadTime(start);
+
+  // the newest sample in the fifo is about as old as now, the rest are one sample period apart;
+  // samples left in the fifo for next time are newer than the ones read here
+  unsigned long now = micros();
+  for (uint8_t i = 0; i < count; i++) {
+    ParseFIFORecord(records + i * FIFO_SAMPLE_BYTES, samples[i]);
+    samples[i].timestamp = now - (available - 1 - i) * FIFO_SAMPLE_PERIOD_US;
+  }
+  return count;
+}
+
+/**
+ * @brief Stores a new sample and runs it through the orientation estimate
+ * @param sample The new sample
+ * @param deltaTime The loop time, only used for the very first sample
+ */
+void ProcessSample(const IMUSample& sample, float deltaTime)
+{
+  // the time between samples is known from the timestamps; before the first one only the loop time is
+  float sampleDt = (Sensor::sample_count > 0)? (sample.timestamp - Sensor::sample.timestamp) / 1000000.0f : deltaTime;
+  Sensor::sample = sample;
+  Sensor::sample_count++;
+  EstimateOrientation(sample, sampleDt);
+}
+
+#ifdef ICM_DMP_MODE
+/**
+ * @brief Starts the DMP quaternion output into the ICM fifo
+ * @return true if every step of the DMP setup worked
+ */
+bool ConfigureDMP()
+{
+  #ifdef DMP_9_AXIS
+    const enum inv_icm20948_sensor DMP_SENSOR = INV_ICM20948_SENSOR_ROTATION_VECTOR;
+    const enum DMP_ODR_Registers DMP_ODR_REG = DMP_ODR_Reg_Quat9;
+  #else
+    const enum inv_icm20948_sensor DMP_SENSOR = INV_ICM20948_SENSOR_GAME_ROTATION_VECTOR;
+    const enum DMP_ODR_Registers DMP_ODR_REG = DMP_ODR_Reg_Quat6;
+  #endif
+  bool success = true;
+  success &= (ICM_Obj.initializeDMP() == ICM_20948_Stat_Ok);
+  success &= (ICM_Obj.enableDMPSensor(DMP_SENSOR) == ICM_20948_Stat_Ok);
+  success &= (ICM_Obj.setDMPODRrate(DMP_ODR_REG, 0) == ICM_20948_Stat_Ok); // 0 is the fastest rate
+  // the raw accel as well, the flight phases are detected on it (see FLIGHT PHASES)
+  success &= (ICM_Obj.enableDMPSensor(INV_ICM20948_SENSOR_RAW_ACCELEROMETER) == ICM_20948_Stat_Ok);
+  success &= (ICM_Obj.setDMPODRrate(DMP_ODR_Reg_Accel, 0) == ICM_20948_Stat_Ok);
+  success &= (ICM_Obj.enableFIFO() == ICM_20948_Stat_Ok);
+  success &= (ICM_Obj.enableDMP() == ICM_20948_Stat_Ok);
+  success &= (ICM_Obj.resetDMP() == ICM_20948_Stat_Ok);
+  success &= (ICM_Obj.resetFIFO() == ICM_20948_Stat_Ok);
+  return success;
+}
+
+/**
+ * @brief Reads the DMP quaternions waiting in the fifo (up to FIFO_BURST_SAMPLES) and keeps the newest
+ * @return true if a new quaternion was read into Sensor::dmp_quat
+ */
+bool ReadQuaternionFromDMP()
+{
+  PROFILE_SCOPE(PROFILE_ICM_READ);
+  // DMP quaternion components are fixed-point with 30 fractional bits; w is left out as the quaternion is unit length
+  const float DMP_QUAT_SCALE = 1.0f / 1073741824.0f;
+  unsigned long start = micros();
+  bool found = false;
+  for (uint8_t i = 0; i < FIFO_BURST_SAMPLES; i++) {
+    icm_20948_DMP_data_t data;
+    ICM_Obj.readDMPdataFromFIFO(&data);
+    if (ICM_Obj.status != ICM_20948_Stat_Ok && ICM_Obj.status != ICM_20948_Stat_FIFOMoreDataAvail) {
+      break;
+    }
+
+  #ifdef DMP_9_AXIS
+    if ((data.header & DMP_header_bitmap_Quat9) > 0) {
+      float q1 = data.Quat9.Data.Q1 * DMP_QUAT_SCALE;
+      float q2 = data.Quat9.Data.Q2 * DMP_QUAT_SCALE;
+      float q3 = data.Quat9.Data.Q3 * DMP_QUAT_SCALE;
+  #else
+    if ((data.header & DMP_header_bitmap_Quat6) > 0) {
+      float q1 = data.Quat6.Data.Q1 * DMP_QUAT_SCALE;
+      float q2 = data.Quat6.Data.Q2 * DMP_QUAT_SCALE;
+      float q3 = data.Quat6.Data.Q3 * DMP_QUAT_SCALE;
+  #endif
+      float w2 = 1.0f - (q1 * q1 + q2 * q2 + q3 * q3);
+      Sensor::dmp_quat[0] = (w2 > 0.0f)? sqrtf(w2) : 0.0f;
+      Sensor::dmp_quat[1] = q1;
+      Sensor::dmp_quat[2] = q2;
+      Sensor::dmp_quat[3] = q3;
+      found = true;
+    }
+    if ((data.header & DMP_header_bitmap_Accel) > 0) {
+      // only the raw counts are filled in, all UpdateFlightPhase needs (at the DMP's +-4g, see PHASE_ACC_LSB_PER_MG)
+      Sensor::sample.accRaw[0] = data.Raw_Accel.Data.X;
+      Sensor::sample.accRaw[1] = data.Raw_Accel.Data.Y;
+      Sensor::sample.accRaw[2] = data.Raw_Accel.Data.Z;
+      Sensor::sample.timestamp = micros();
+      Sensor::sample_count++;
+    }
+
+    if (ICM_Obj.status != ICM_20948_Stat_FIFOMoreDataAvail) {
+      break;
+    }
+  }
+  RecordReadTime(start);
+  if (found) {
+    Sensor::dmp_timestamp = micros();
+  }
+  return found;
+}
+#endif
+
+/**
+ * @brief Interrupt for the ICM INT pin; timestamps the new sample and 
+ * flags it for the main loop, the I2C read happens outside the interrupt
+ */
+void ICM_DataReadyISR()
+{
+  Sensor::drdy_timestamp = micros();
+  Sensor::drdy_pending = true;
+}
+
+/**
+ * @brief Gets the orientation from the sensors and sets the orientation
+ * @param deltaTime the time inbetween each loop itteration
+ */
+void SetOrientationFromSensors(float deltaTime)
+{
+  PROFILE_SCOPE(PROFILE_SENSORS);
+#if defined(ICM_DMP_MODE)
+  // the DMP already fused the sensors, its newest quaternion is the orientation
+  if (ReadQuaternionFromDMP()) {
+    SetAttitude(Sensor::dmp_quat);
+  }
+  (void)deltaTime;
+#elif defined(ICM_FIFO_MODE)
+  IMUSample samples[FIFO_BURST_SAMPLES];
+  uint8_t count = ReadSamplesFromFIFO(samples);
+  for (uint8_t i = 0; i < count; i++) {
+    ProcessSample(samples[i], deltaTime);
+  }
+#elif defined(ICM_DRDY_INTERRUPT)
+  IMUSample sample;
+  if (!Sensor::drdy_pending) {
+    return;
+  }
+  // the timestamp is 4 bytes, so the interrupt must not update it halfway through the copy on AVR
+  noInterrupts();
+  sample.timestamp = Sensor::drdy_timestamp;
+  Sensor::drdy_pending = false;
+  interrupts();
+
+  bool read_ok = ReadSampleFromICM(sample);
+  ICM_Obj.clearInterrupts(); // release the latched INT pin so the next sample makes a new edge
+  if (!read_ok) {
+    return;
+  }
+  Sensor::latency = micros() - sample.timestamp;
+  if (Sensor::latency > Sensor::max_latency) {
+    Sensor::max_latency = Sensor::latency;
+  }
+  ProcessSample(sample, deltaTime);
+#else
+  if (!ICM_Obj.dataReady()) {
+    return;
+  }
+  IMUSample sample;
+  sample.timestamp = micros();
+  if (!ReadSampleFromICM(sample)) {
+    return; // dataReady() stays set, the next pass reads it again
+  }
+  ProcessSample(sample, deltaTime);
+#endif
+}
+
+/** @brief the canard servos, one specialization per SERVO_DRIVER */
+template <SERVO_DRIVER DRIVER>
+struct ServoOutput;
+
+#ifdef SERVO_HW_TIMERS
+template <>
+struct ServoOutput<SERVO_DRIVER_TIMERS> {
+  /**
+   * @brief Starts timers 3 and 4 in fast PWM (mode 14, TOP = ICR) so the pulses come from the hardware 
+   * and cost nothing per frame
+   * @param pulses The first pulse widths of canards 1 - 4 in SERVO_TICKS_PER_US ticks
+   */
+  static void Begin(const uint16_t pulses[4]) {
+    const uint16_t SERVO_TOP = (uint16_t)(SERVO_FRAME_US * SERVO_TICKS_PER_US - 1);
+    for (int i = 0; i < 4; i++) {
+      pinMode(Board::CANARD_PINS[i], OUTPUT);
+    }
+
+    // hold the prescalers while both timers are set up so they start in step and start a frame together
+    GTCCR = _BV(TSM) | _BV(PSRSYNC);
+    TCCR4A = _BV(COM4A1) | _BV(COM4B1) | _BV(COM4C1) | _BV(WGM41);
+    TCCR4B = _BV(WGM43) | _BV(WGM42) | _BV(CS41);
+    ICR4 = SERVO_TOP;
+    TCNT4 = 0;
+    TCCR3A = _BV(COM3A1) | _BV(WGM31);
+    TCCR3B = _BV(WGM33) | _BV(WGM32) | _BV(CS31);
+    ICR3 = SERVO_TOP;
+    TCNT3 = 0;
+    Write(pulses);
+    GTCCR = 0;
+  }
+
+  /**
+   * @brief Sets the compare registers; they are double buffered and only load at the start of a frame, 
+   * so the four new widths go out together in the next frame
+   */
+  static void Write(const uint16_t pulses[4]) {
+    // 16 bit timer registers are written through a shared temp register, an interrupt touching 
+    // one halfway would corrupt the write
+    uint8_t sreg = SREG;
+    cli();
+    OCR4A = pulses[0];
+    OCR4B = pulses[1];
+    OCR4C = pulses[2];
+    OCR3A = pulses[3];
+    SREG = sreg;
+  }
+};
+#else
+/** 
+ * @brief namespace that holds the Servo library objects of the canards
+ */
+namespace Servos {
+  Servo canards[4];
+}
+
+template <>
+struct ServoOutput<SERVO_DRIVER_LIBRARY> {
+  static void Begin(const uint16_t pulses[4]) {
+    for (int i = 0; i < 4; i++) {
+      Servos::canards[i].attach(Board::CANARD_PINS[i]);
+    }
+    Write(pulses);
+  }
+
+  static void Write(const uint16_t pulses[4]) {
+    for (int i = 0; i < 4; i++) {
+      Servos::canards[i].writeMicroseconds(pulses[i]);
+    }
+  }
+};
+#endif
+
+/**
+ * @brief Sets the pulse widths of all four canard servos at once; nothing blocks, the timers or the 
+ * Servo library make the pulses
+ * @param pulses The pulse widths of canards 1 - 4 in SERVO_TICKS_PER_US ticks
+ */
+void ActuateCanards(const uint16_t pulses[4])
+{
+  ServoOutput<BuildConfig::SERVO>::Write(pulses);
+}
+
+/** @brief Starts the servo pulses with every canard at neutral */
+void ConfigureServos()
+{
+  for (int i = 0; i < 4; i++) {
+    Rocket::canard_pulses[i] = RadToServoTicks(0.0f);
+  }
+  ServoOutput<BuildConfig::SERVO>::Begin(Rocket::canard_pulses);
+}
+
+
+/***************************************************************
+                      TASK SCHEDULER
+***************************************************************/
+// rates of the tasks run by loop(), the control path runs at the full sensor rate and the
+// rest only as often as they are needed; the pad and the descent run some of them slower (see FLIGHT PHASES)
+const unsigned long SENSOR_PERIOD_US = 1000;     // 1kHz
+const unsigned long CONTROL_PERIOD_US = 1000;    // 1kHz
+const unsigned long ACTUATION_PERIOD_US = 1000;  // 1kHz
+#ifdef TELEMETRY_BINARY
+const unsigned long TELEMETRY_PERIOD_US = 1000;  // 1kHz, a frame every control tick
+#else
+const unsigned long TELEMETRY_PERIOD_US = 100000; // 10Hz, the ASCII line and the status line with room to spare at 9600 baud
+#endif
+#if defined(ICM_FIFO_MODE) || defined(ICM_DMP_MODE)
+const unsigned long PAD_SAMPLE_PERIOD_US = SENSOR_PERIOD_US; // the FIFO fills at the full rate either way, it has to be drained
+#else
+const unsigned long PAD_SAMPLE_PERIOD_US = 5000; // 200Hz on the pad and in descent (see FLIGHT PHASES)
+#endif
+#ifdef TELEMETRY_BINARY
+const unsigned long PAD_TELEMETRY_PERIOD_US = 20000;  // 50Hz
+#else
+const unsigned long PAD_TELEMETRY_PERIOD_US = 250000; // 4Hz
+#endif
+const unsigned long STATUS_PERIOD_US = 1000000;  // 1Hz
+const unsigned long LOG_PERIOD_US = 1000;        // 1kHz, a record per sample once launched
+#ifdef PROFILE_ON
+#ifdef TELEMETRY_BINARY
+const unsigned long PROFILE_PERIOD_US = 1000000 / PROFILE_STAGE_COUNT; // one stage per run, every stage once a second
+#else
+const unsigned long PROFILE_PERIOD_US = 500000; // two stages a second, the ASCII line leaves 9600 baud no room for more
+#endif
+#endif
+// what the telemetry and the status (and profile) lines or frames put on the link each second, TX_SLOT_BYTES 
+// bounds the last ones; past what BuildConfig::BAUD carries (10 bits a byte) TxEnqueue drops frames all flight long
+const unsigned long LINK_BYTES_PER_S = TELEMETRY_STATE_BYTES * (1000000UL / TELEMETRY_PERIOD_US)
+  + TX_SLOT_BYTES * (1000000UL / STATUS_PERIOD_US)
+#ifdef PROFILE_ON
+  + TX_SLOT_BYTES * (1000000UL / PROFILE_PERIOD_US)
+#endif
+  ;
+static_assert(LINK_BYTES_PER_S <= BuildConfig::BAUD / 10, "the telemetry does not fit the baud rate, slow TELEMETRY_PERIOD_US down");
+
+/** @brief a job that loop() runs at a fixed rate */
+struct Task {
+  void (*run)(float deltaTime); // the job, gets the time since it last ran (seconds)
+  unsigned long period;         // micros between runs
+  unsigned long next_run;       // micros() the next run is due
+  unsigned long last_run;       // micros() of the last run
+  unsigned long overruns;       // times the task fell a whole period behind (those runs were skipped)
+};
+
+/**
+ * @brief Sets the first run of each task to now
+ * @param tasks The tasks
+ * @param task_c The amount of tasks
+ */
+void StartTasks(Task* tasks, size_t task_c)
+{
+  unsigned long now = micros();
+  for (size_t i = 0; i < task_c; i++) {
+    tasks[i].next_run = now;
+    tasks[i].last_run = now - tasks[i].period; // the first run sees one nominal period
+    tasks[i].overruns = 0;
+  }
+}
+
+/**
+ * @brief Runs the task if it is due; keeps the task on its fixed rate,
+ * if it fell a whole period behind the missed runs are counted and skipped instead of run back to back
+ * @param task The task
+ * @return true if the task ran
+ */
+bool RunTaskIfDue(Task& task)
+{
+  unsigned long now = micros();
+  if ((long)(now - task.next_run) < 0) {
+    return false;
+  }
+
+  float deltaTime = (now - task.last_run) / 1000000.0f;
+  task.last_run = now;
+  task.run(deltaTime);
+
+  task.next_run += task.period;
+  now = micros();
+  if ((long)(now - task.next_run) >= 0) {
+    task.overruns++;
+    task.next_run = now + task.period;
+  }
+  return true;
+}
+
+
+/***************************************************************
+                      ACTUATOR OUTPUT
+***************************************************************/
+// the controller runs much faster than servos take new pulses (50 - 330Hz) and a register write
+// every tick mostly just makes the servos chatter, so the commands go through a deadband and a slew limit 
+// and the registers are only written when the pulse that results is different from the last one
+
+const uint16_t SERVO_DEADBAND_TICKS = 3 * SERVO_TICKS_PER_US; // 3us (0.3 degrees), under what hobby servos resolve
+constexpr float SERVO_MAX_SLEW = 400.0f * DEG2RAD;               // how fast a canard may be moved (rad/s)
+const uint32_t SERVO_SLEW_TICKS_PER_S = (uint32_t)(SERVO_MAX_SLEW * SERVO_US_PER_RAD * SERVO_TICKS_PER_US);
+
+/**
+ * @brief The slew limit as ticks per actuation tick, at least 1 so the output always gets to the command
+ * @param period_us The period of the actuation task
+ */
+inline uint16_t SlewTicks(unsigned long period_us) {
+  uint32_t ticks = SERVO_SLEW_TICKS_PER_S * period_us / 1000000UL;
+  return (ticks < 1)? 1 : ((ticks > 0xFFFF)? 0xFFFF : (uint16_t)ticks);
+}
+
+/** 
+ * @brief namespace that holds the pulses sent to the servos and how many writes were saved
+ */
+namespace Actuator {
+  uint16_t output[4] = {0};           // pulses last written to the servos
+  bool primed = false;                // output holds what was written at startup
+  unsigned long commits = 0;          // ticks the servo registers were written
+  unsigned long suppressed = 0;       // ticks nothing changed so nothing was written
+  unsigned long deadband_holds = 0;   // canard commands held by the deadband
+  unsigned long slew_limited = 0;     // canard commands cut back by the slew limit
+  uint16_t slew_ticks = SlewTicks(ACTUATION_PERIOD_US); // slew limit at the actuation task's period, see ApplyPhaseRates
+}
+
+/**
+ * @brief Moves the servo outputs toward the commanded pulses, within the deadband and slew limit,
+ * and writes them out only if one of them changed
+ * @param commands The commanded pulse widths of canards 1 - 4 in SERVO_TICKS_PER_US ticks
+ */
+void UpdateActuators(const uint16_t commands[4])
+{
+  PROFILE_SCOPE(PROFILE_ACTUATION);
+  if (!Actuator::primed) {
+    // ConfigureServos already wrote these
+    memcpy(Actuator::output, commands, sizeof(Actuator::output));
+    Actuator::primed = true;
+    return;
+  }
+
+  bool changed = false;
+  for (int i = 0; i < 4; i++) {
+    int32_t error = (int32_t)commands[i] - Actuator::output[i];
+    if (error == 0) {
+      continue;
+    }
+    if (error < SERVO_DEADBAND_TICKS && error > -(int32_t)SERVO_DEADBAND_TICKS) {
+      Actuator::deadband_holds++;
+      continue;
+    }
+    if (error > Actuator::slew_ticks) {
+      error = Actuator::slew_ticks;
+      Actuator::slew_limited++;
+    } else if (error < -(int32_t)Actuator::slew_ticks) {
+      error = -(int32_t)Actuator::slew_ticks;
+      Actuator::slew_limited++;
+    }
+    Actuator::output[i] += error;
+    changed = true;
+  }
+
+  if (changed) {
+    ActuateCanards(Actuator::output);
+    Actuator::commits++;
+  } else {
+    Actuator::suppressed++;
+  }
+}
+
+
+/***************************************************************
+                      FLIGHT PHASES
+***************************************************************/
+// the flight goes pad -> boost -> coast -> apogee -> descent, one way, on the accel magnitude of the newest sample:
+// launch once it stays over LAUNCH_ACCEL_MG for LAUNCH_CONFIRM_US, burnout once the motor no longer pushes it over
+// BURNOUT_ACCEL_MG and apogee once even the drag has gone under APOGEE_ACCEL_MG, each for PHASE_CONFIRM_US; descent
+// follows APOGEE_HOLD_US after apogee. FLIGHT_PHASES says what each phase runs: the pad and the descent sample, 
+// control and send at a low rate with the canards parked, apogee parks them too. The accel is at +-2g so the launch 
+// threshold has to sit under that (the ICM saturates at 2g during boost); ICM_DMP_MODE has the DMP send its raw 
+// accel along with the quaternions, at the +-4g initializeDMP sets.
+const float LAUNCH_ACCEL_MG = 1800.0f;
+const unsigned long LAUNCH_CONFIRM_US = 50000;
+const float BURNOUT_ACCEL_MG = LAUNCH_ACCEL_MG; // the drag near burnout speed is over this too, so coast starts
+                                                // a second or two late; boost and coast run the same
+const float APOGEE_ACCEL_MG = 50.0f;            // the drag of about 20 m/s, under a second before apogee
+const unsigned long PHASE_CONFIRM_US = 300000;  // so the noise or a gust does not end boost or coast early
+const unsigned long APOGEE_HOLD_US = 1000000;  // the recovery deploys around apogee, log it at full rate
+#ifdef ICM_DMP_MODE
+constexpr float PHASE_ACC_LSB_PER_MG = 8.192f;  // the DMP's raw accel, +-4g
+#else
+constexpr float PHASE_ACC_LSB_PER_MG = ACC_LSB_PER_MG;
+#endif
+
+/** @brief enum which stores the phases of the flight, in the order they come */
+enum FLIGHT_PHASE {
+  FLIGHT_PHASE_PAD = 0,
+  FLIGHT_PHASE_BOOST,
+  FLIGHT_PHASE_COAST,
+  FLIGHT_PHASE_APOGEE,
+  FLIGHT_PHASE_DESCENT,
+  FLIGHT_PHASE_COUNT
+};
+
+/** @brief what a flight phase runs */
+struct PhaseConfig {
+  bool control;               // the controller runs, otherwise the canards are parked at neutral
+  unsigned long sample_us;    // period of the sensor, control and actuation tasks
+  unsigned long telemetry_us; // period of the telemetry task
+  uint8_t log_divider;        // every log_divider th sample is logged
+};
+
+const PhaseConfig FLIGHT_PHASES[FLIGHT_PHASE_COUNT] = {
+  {false, PAD_SAMPLE_PERIOD_US, PAD_TELEMETRY_PERIOD_US, 10},  // pad, 20Hz of log
+  {true, SENSOR_PERIOD_US, TELEMETRY_PERIOD_US, 1},             // boost
+  {true, SENSOR_PERIOD_US, TELEMETRY_PERIOD_US, 1},             // coast
+  {false, SENSOR_PERIOD_US, TELEMETRY_PERIOD_US, 1},            // apogee
+  {false, PAD_SAMPLE_PERIOD_US, PAD_TELEMETRY_PERIOD_US, 10}   // descent
+};
+
+/** 
+ * @brief namespace that holds the state of the flight
+ */
+namespace Flight {
+  uint8_t phase = FLIGHT_PHASE_PAD;       // FLIGHT_PHASE
+  bool launched = false;
+  unsigned long launch_time = 0;          // micros() of the first sample over the launch threshold
+  unsigned long phase_time = 0;           // micros() of the sample the phase started with
+  bool pending = false;                   // the samples since pending_since say the next phase has come
+  unsigned long pending_since = 0;
+  unsigned long checked_sample_count = 0; // Sensor::sample_count UpdateFlightPhase last looked at
+}
+
+/**
+ * @brief Moves on to the next flight phase once the accel magnitude has stayed past that phase's threshold long 
+ * enough; only looks at samples it has not seen yet
+ */
+void UpdateFlightPhase()
+{
+  if (Flight::phase == FLIGHT_PHASE_DESCENT || Sensor::sample_count == Flight::checked_sample_count) {
+    return;
+  }
+  Flight::checked_sample_count = Sensor::sample_count;
+
+  // raw counts are filled in every build, so compare squared counts and skip the sqrt
+  const float LAUNCH_COUNTS = LAUNCH_ACCEL_MG * PHASE_ACC_LSB_PER_MG;
+  const float BURNOUT_COUNTS = BURNOUT_ACCEL_MG * PHASE_ACC_LSB_PER_MG;
+  const float APOGEE_COUNTS = APOGEE_ACCEL_MG * PHASE_ACC_LSB_PER_MG;
+  const int16_t* acc = Sensor::sample.accRaw;
+  uint32_t mag_sq = (uint32_t)((int32_t)acc[0] * acc[0]) + (uint32_t)((int32_t)acc[1] * acc[1]) + (uint32_t)((int32_t)acc[2] * acc[2]);
+
+  bool next = true;
+  unsigned long hold_us = APOGEE_HOLD_US;
+  if (Flight::phase == FLIGHT_PHASE_PAD) {
+    next = mag_sq >= (uint32_t)(LAUNCH_COUNTS * LAUNCH_COUNTS);
+    hold_us = LAUNCH_CONFIRM_US;
+  } else if (Flight::phase == FLIGHT_PHASE_BOOST) {
+    next = mag_sq < (uint32_t)(BURNOUT_COUNTS * BURNOUT_COUNTS);
+    hold_us = PHASE_CONFIRM_US;
+  } else if (Flight::phase == FLIGHT_PHASE_COAST) {
+    next = mag_sq < (uint32_t)(APOGEE_COUNTS * APOGEE_COUNTS);
+    hold_us = PHASE_CONFIRM_US;
+  }
+
+  if (!next) {
+    Flight::pending = false;
+    return;
+  }
+  if (!Flight::pending) {
+    Flight::pending = true;
+    Flight::pending_since = Sensor::sample.timestamp;
+  }
+  if (Sensor::sample.timestamp - Flight::pending_since < hold_us) {
+    return;
+  }
+  Flight::pending = false;
+  Flight::phase++;
+  Flight::phase_time = Sensor::sample.timestamp;
+  if (Flight::phase == FLIGHT_PHASE_BOOST) {
+    Flight::launched = true;
+    Flight::launch_time = Flight::pending_since;
+  }
+}
+
+
+/***************************************************************
+                  STABILIZATION CONTROLLER
+***************************************************************/
+// one PID per body rate (roll about x, pitch about y, yaw about z) holds the rates at zero, and the 
+// mixer turns the three torque commands into the four canard deflections. The control task runs on 
+// a fixed period, so everything that depends on the time step is worked out ahead of time 
+// (MakePIDCoeffs, RATE_GAINS), and the gains follow the flight through GAIN_SCHEDULE.
+// MATH_FIXED_POINT builds run the same controller in integer math on the raw gyro counts: the gains have 
+// GYR_RAD_PER_LSB folded in as well and are kept as fixed-point coefficients (PID_KP_Q, PID_KI_Q), the terms 
+// and the canard commands are canard radians * 2^CANARD_Q, so a tick has no soft-float at all.
+constexpr float GYR_RAD_PER_LSB = DEG2RAD / GYR_LSB_PER_DPS;
+
+#ifdef MATH_FIXED_POINT
+const uint8_t PID_KP_Q = 28;       // kp and kd are canard radians * 2^PID_KP_Q per gyro count (per count and tick for kd)
+const uint8_t PID_KI_Q = 40;       // ki is canard radians * 2^PID_KI_Q per gyro count and tick
+const uint8_t PID_INTEGRAL_Q = 32; // the integral is canard radians * 2^PID_INTEGRAL_Q, ki * error is rounded onto it
+const uint8_t PID_ALPHA_Q = 10;    // the derivative low pass factor is * 2^PID_ALPHA_Q
+// largest measurement change of one tick the derivative takes (31 dps a tick), so kd * change fits 31 bits
+const int16_t PID_MAX_D_COUNTS = 4096;
+// largest gains that fit: kp * error and ki * error for a full scale error, kd * PID_MAX_D_COUNTS
+const int32_t PID_MAX_KP = 65535;
+const int32_t PID_MAX_KI = 32767;
+const int32_t PID_MAX_KD = 0x7FFFFFFFL / PID_MAX_D_COUNTS;
+
+/** @brief PID gains with the control period and the gyro scale already folded in */
+struct PIDCoeffs {
+  int32_t kp;         // proportional gain (PID_KP_Q per count of error)
+  int32_t ki_dt;      // integral gain * control period (PID_KI_Q per count of error)
+  int32_t kd_over_dt; // derivative gain / control period (PID_KP_Q per count of change)
+  int16_t d_alpha;    // smoothing factor of the derivative low pass (PID_ALPHA_Q)
+  int32_t i_limit;    // largest magnitude of the integral term (PID_INTEGRAL_Q)
+  int32_t out_limit;  // largest magnitude of the output (CANARD_Q)
+};
+
+/** @brief the running state of one PID */
+struct PIDState {
+  int32_t integral;         // integral term, already scaled by ki (PID_INTEGRAL_Q)
+  int16_t prev_measurement; // measurement of the previous tick (gyro counts), the derivative works on the measurement
+  int32_t d_filtered;       // low passed derivative term (CANARD_Q)
+  bool primed;              // prev_measurement is valid
+};
+#else
+/** @brief PID gains with the control period already folded in */
+struct PIDCoeffs {
+  float kp;         // proportional gain (canard rad per rad/s of error)
+  float ki_dt;      // integral gain * control period
+  float kd_over_dt; // derivative gain / control period
+  float d_alpha;    // smoothing factor of the derivative low pass, 0 - 1
+  float i_limit;    // largest magnitude of the integral term (canard rad)
+  float out_limit;  // largest magnitude of the output (canard rad)
+};
+
+/** @brief the running state of one PID */
+struct PIDState {
+  float integral;         // integral term, already scaled by ki
+  float prev_measurement; // measurement of the previous tick, the derivative works on the measurement
+  float d_filtered;       // low passed derivative term
+  bool primed;            // prev_measurement is valid
+};
+#endif
+
+/**
+ * @brief Works out the PID coefficients for the control period
+ * @param kp Proportional gain (canard rad per rad/s)
+ * @param ki Integral gain (canard rad per rad of accumulated error)
+ * @param kd Derivative gain (canard rad per rad/s^2)
+ * @param d_cutoff_hz Cutoff of the derivative low pass (Hz)
+ * @param out_limit Largest output (canard rad), the integral gets half of it
+ * @return The coefficients
+ */
+PIDCoeffs MakePIDCoeffs(float kp, float ki, float kd, float d_cutoff_hz, float out_limit)
+{
+  const float dt = CONTROL_PERIOD_US / 1000000.0f;
+  float rc = 1.0f / (PI2 * d_cutoff_hz);
+  PIDCoeffs coeffs;
+#ifdef MATH_FIXED_POINT
+  coeffs.kp = ToFixed(kp * GYR_RAD_PER_LSB, PID_KP_Q);
+  coeffs.ki_dt = ToFixed(ki * dt * GYR_RAD_PER_LSB, PID_KI_Q);
+  coeffs.kd_over_dt = ToFixed(kd / dt * GYR_RAD_PER_LSB, PID_KP_Q);
+  coeffs.d_alpha = (int16_t)ToFixed(dt / (dt + rc), PID_ALPHA_Q);
+  coeffs.i_limit = ToFixed(0.5f * out_limit, PID_INTEGRAL_Q);
+  coeffs.out_limit = ToFixed(out_limit, CANARD_Q);
+#else
+  coeffs.kp = kp;
+  coeffs.ki_dt = ki * dt;
+  coeffs.kd_over_dt = kd / dt;
+  coeffs.d_alpha = dt / (dt + rc);
+  coeffs.i_limit = 0.5f * out_limit;
+  coeffs.out_limit = out_limit;
+#endif
+  return coeffs;
+}
+
+// derivative low pass and limits shared by every axis; kp, ki and kd come from GAIN_SCHEDULE
+const PIDCoeffs BASE_RATE_PID = MakePIDCoeffs(0.0f, 0.0f, 0.0f, 30.0f, CANARD_MAX_DEFLECTION);
+
+/** @brief the scheduled part of the PID coefficients of one axis, the control period already folded in */
+#ifdef MATH_FIXED_POINT
+struct RateGains {
+  int32_t kp;
+  int32_t ki_dt;
+  int32_t kd_over_dt;
+};
+
+// folds the control period and the gyro scale into a (kp, ki, kd) table entry at compile time
+#define RATE_GAINS(kp, ki, kd) {ToFixed((kp) * GYR_RAD_PER_LSB, PID_KP_Q), \
+  ToFixed((ki) * (CONTROL_PERIOD_US / 1000000.0f) * GYR_RAD_PER_LSB, PID_KI_Q), \
+  ToFixed((kd) / (CONTROL_PERIOD_US / 1000000.0f) * GYR_RAD_PER_LSB, PID_KP_Q)}
+#else
+struct RateGains {
+  float kp;
+  float ki_dt;
+  float kd_over_dt;
+};
+
+// folds the control period into a (kp, ki, kd) table entry at compile time
+#define RATE_GAINS(kp, ki, kd) {(kp), (ki) * (CONTROL_PERIOD_US / 1000000.0f), (kd) / (CONTROL_PERIOD_US / 1000000.0f)}
+#endif
+
+// rows are 2^GAIN_SCHEDULE_SHIFT ms of flight apart, so the row is a shift of the time since launch instead of a search
+const uint8_t GAIN_SCHEDULE_SHIFT = 9; // 512ms
+const unsigned long GAIN_SCHEDULE_STEP_MS = 1UL << GAIN_SCHEDULE_SHIFT;
+
+/**
+ * @brief (roll, pitch, yaw) rate gains against the time since launch, linearly interpolated between rows.
+ * Canard torque grows with the dynamic pressure (speed squared), so the gains drop as 1 / v^2 from 50 m/s 
+ * on a nominal flight: about 2.5s of boost up to 200 m/s, coast to apogee around 13.5s, then descent.
+ * Past the last row the last row is held
+ */
+const RateGains GAIN_SCHEDULE[][3] PROGMEM = {
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, //  0.00s, ~0 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, //  0.51s, ~41 m/s
+  {RATE_GAINS(0.07451f, 0.0298f, 0.00075f), RATE_GAINS(0.11176f, 0.0149f, 0.00149f), RATE_GAINS(0.11176f, 0.0149f, 0.00149f)}, //  1.02s, ~82 m/s
+  {RATE_GAINS(0.03311f, 0.01325f, 0.00033f), RATE_GAINS(0.04967f, 0.00662f, 0.00066f), RATE_GAINS(0.04967f, 0.00662f, 0.00066f)}, //  1.54s, ~123 m/s
+  {RATE_GAINS(0.01863f, 0.00745f, 0.00019f), RATE_GAINS(0.02794f, 0.00373f, 0.00037f), RATE_GAINS(0.02794f, 0.00373f, 0.00037f)}, //  2.05s, ~164 m/s
+  {RATE_GAINS(0.01264f, 0.00505f, 0.00013f), RATE_GAINS(0.01896f, 0.00253f, 0.00025f), RATE_GAINS(0.01896f, 0.00253f, 0.00025f)}, //  2.56s, ~199 m/s
+  {RATE_GAINS(0.01391f, 0.00556f, 0.00014f), RATE_GAINS(0.02086f, 0.00278f, 0.00028f), RATE_GAINS(0.02086f, 0.00278f, 0.00028f)}, //  3.07s, ~190 m/s
+  {RATE_GAINS(0.01538f, 0.00615f, 0.00015f), RATE_GAINS(0.02307f, 0.00308f, 0.00031f), RATE_GAINS(0.02307f, 0.00308f, 0.00031f)}, //  3.58s, ~180 m/s
+  {RATE_GAINS(0.0171f, 0.00684f, 0.00017f), RATE_GAINS(0.02565f, 0.00342f, 0.00034f), RATE_GAINS(0.02565f, 0.00342f, 0.00034f)}, //  4.10s, ~171 m/s
+  {RATE_GAINS(0.01913f, 0.00765f, 0.00019f), RATE_GAINS(0.02869f, 0.00383f, 0.00038f), RATE_GAINS(0.02869f, 0.00383f, 0.00038f)}, //  4.61s, ~162 m/s
+  {RATE_GAINS(0.02154f, 0.00862f, 0.00022f), RATE_GAINS(0.03231f, 0.00431f, 0.00043f), RATE_GAINS(0.03231f, 0.00431f, 0.00043f)}, //  5.12s, ~152 m/s
+  {RATE_GAINS(0.02443f, 0.00977f, 0.00024f), RATE_GAINS(0.03665f, 0.00489f, 0.00049f), RATE_GAINS(0.03665f, 0.00489f, 0.00049f)}, //  5.63s, ~143 m/s
+  {RATE_GAINS(0.02795f, 0.01118f, 0.00028f), RATE_GAINS(0.04193f, 0.00559f, 0.00056f), RATE_GAINS(0.04193f, 0.00559f, 0.00056f)}, //  6.14s, ~134 m/s
+  {RATE_GAINS(0.03229f, 0.01292f, 0.00032f), RATE_GAINS(0.04844f, 0.00646f, 0.00065f), RATE_GAINS(0.04844f, 0.00646f, 0.00065f)}, //  6.66s, ~124 m/s
+  {RATE_GAINS(0.03772f, 0.01509f, 0.00038f), RATE_GAINS(0.05659f, 0.00754f, 0.00075f), RATE_GAINS(0.05659f, 0.00754f, 0.00075f)}, //  7.17s, ~115 m/s
+  {RATE_GAINS(0.04465f, 0.01786f, 0.00045f), RATE_GAINS(0.06698f, 0.00893f, 0.00089f), RATE_GAINS(0.06698f, 0.00893f, 0.00089f)}, //  7.68s, ~106 m/s
+  {RATE_GAINS(0.05368f, 0.02147f, 0.00054f), RATE_GAINS(0.08052f, 0.01074f, 0.00107f), RATE_GAINS(0.08052f, 0.01074f, 0.00107f)}, //  8.19s, ~97 m/s
+  {RATE_GAINS(0.06576f, 0.0263f, 0.00066f), RATE_GAINS(0.09863f, 0.01315f, 0.00132f), RATE_GAINS(0.09863f, 0.01315f, 0.00132f)}, //  8.70s, ~87 m/s
+  {RATE_GAINS(0.08241f, 0.03297f, 0.00082f), RATE_GAINS(0.12362f, 0.01648f, 0.00165f), RATE_GAINS(0.12362f, 0.01648f, 0.00165f)}, //  9.22s, ~78 m/s
+  {RATE_GAINS(0.1063f, 0.04252f, 0.00106f), RATE_GAINS(0.15946f, 0.02126f, 0.00213f), RATE_GAINS(0.15946f, 0.02126f, 0.00213f)}, //  9.73s, ~69 m/s
+  {RATE_GAINS(0.14232f, 0.05693f, 0.00142f), RATE_GAINS(0.21348f, 0.02846f, 0.00285f), RATE_GAINS(0.21348f, 0.02846f, 0.00285f)}, // 10.24s, ~59 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 10.75s, ~50 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 11.26s, ~41 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 11.78s, ~31 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 12.29s, ~22 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 12.80s, ~13 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 13.31s, ~3 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 13.82s, ~0 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 14.34s, ~0 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 14.85s, ~0 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 15.36s, ~0 m/s
+  {RATE_GAINS(0.2f, 0.08f, 0.002f), RATE_GAINS(0.3f, 0.04f, 0.004f), RATE_GAINS(0.3f, 0.04f, 0.004f)}, // 15.87s, ~0 m/s
+};
+const uint8_t GAIN_SCHEDULE_ROWS = sizeof(GAIN_SCHEDULE) / sizeof(GAIN_SCHEDULE[0]);
+
+/**
+ * @brief canard mixing matrix, rows are the canards and columns the (roll, pitch, yaw) torque commands.
+ * Canard 1 is on the +y arm, 2 on +z, 3 on -y and 4 on -z; a positive deflection rolls the rocket positive
+ * about x, so roll moves all four the same way and pitch / yaw move opposite pairs against each other
+ */
+#ifdef MATH_FIXED_POINT
+const int8_t CANARD_MIX[4][3] = {
+#else
+const float CANARD_MIX[4][3] = {
+#endif
+  {1, -1,  0},
+  {1,  0, -1},
+  {1,  1,  0},
+  {1,  0,  1}
+};
+
+/** 
+ * @brief namespace that holds the state of the stabilization controller
+ */
+namespace Controller {
+  PIDCoeffs gains[3];          // (roll, pitch, yaw) coefficients of this tick, set by ScheduleGains
+  PIDState roll_rate = PIDState();
+  PIDState pitch_rate = PIDState();
+  PIDState yaw_rate = PIDState();
+#ifdef MATH_FIXED_POINT
+  int32_t torque[3] = {0, 0, 0}; // last (roll, pitch, yaw) commands (CANARD_Q)
+#else
+  float torque[3] = {0.0f, 0.0f, 0.0f}; // last (roll, pitch, yaw) commands (canard rad)
+#endif
+  bool saturated = false;      // a canard hit CANARD_MAX_DEFLECTION in the last tick
+#ifdef ICM_DMP_MODE
+  float prev_quat[4] = {1.0f, 0.0f, 0.0f, 0.0f}; // DMP quaternion the rates were last worked out from
+  unsigned long prev_quat_timestamp = 0;
+  float rates[3] = {0.0f};
+#endif
+}
+
+/**
+ * @brief One PID step; derivative on the measurement (no kick when the setpoint changes) through a low pass,
+ * and the integral only moves when the output is not saturated or the error pulls it back out (anti-windup)
+ * @param coeffs The coefficients
+ * @param state The state of this PID
+ * @param setpoint The setpoint
+ * @param measurement The measurement
+ * @return The output, within +-coeffs.out_limit
+ */
+#ifdef MATH_FIXED_POINT
+int32_t PIDUpdate(const PIDCoeffs& coeffs, PIDState& state, int16_t setpoint, int16_t measurement)
+{
+  if (!state.primed) {
+    state.prev_measurement = measurement;
+    state.primed = true;
+  }
+  int32_t error = (int32_t)setpoint - measurement;
+  error = (error > 32767)? 32767 : ((error < -32767)? -32767 : error);
+
+  int32_t change = (int32_t)state.prev_measurement - measurement;
+  change = (change > PID_MAX_D_COUNTS)? PID_MAX_D_COUNTS : ((change < -PID_MAX_D_COUNTS)? -PID_MAX_D_COUNTS : change);
+  int32_t d_raw = (coeffs.kd_over_dt * change) >> (PID_KP_Q - CANARD_Q);
+  // past twice the output limit the derivative saturates the output anyway, and the low pass product has to fit
+  int32_t d_limit = 2 * coeffs.out_limit;
+  d_raw = (d_raw > d_limit)? d_limit : ((d_raw < -d_limit)? -d_limit : d_raw);
+  state.prev_measurement = measurement;
+  state.d_filtered += ((d_raw - state.d_filtered) * coeffs.d_alpha) >> PID_ALPHA_Q;
+
+  const int32_t HALF = 1L << (PID_KI_Q - PID_INTEGRAL_Q - 1);
+  int32_t integral = state.integral + ((coeffs.ki_dt * error + HALF) >> (PID_KI_Q - PID_INTEGRAL_Q));
+  integral = (integral > coeffs.i_limit)? coeffs.i_limit : ((integral < -coeffs.i_limit)? -coeffs.i_limit : integral);
+
+  int32_t output = ((coeffs.kp * error) >> (PID_KP_Q - CANARD_Q)) + (integral >> (PID_INTEGRAL_Q - CANARD_Q)) + state.d_filtered;
+  int32_t limited = (output > coeffs.out_limit)? coeffs.out_limit : ((output < -coeffs.out_limit)? -coeffs.out_limit : output);
+  if (limited == output || (output > 0) != (error > 0)) {
+    state.integral = integral;
+  }
+  return limited;
+}
+#else
+float PIDUpdate(const PIDCoeffs& coeffs, PIDState& state, float setpoint, float measurement)
+{
+  if (!state.primed) {
+    state.prev_measurement = measurement;
+    state.primed = true;
+  }
+  float error = setpoint - measurement;
+
+  float d_raw = (state.prev_measurement - measurement) * coeffs.kd_over_dt;
+  state.prev_measurement = measurement;
+  state.d_filtered += coeffs.d_alpha * (d_raw - state.d_filtered);
+
+  float integral = state.integral + coeffs.ki_dt * error;
+  integral = (integral > coeffs.i_limit)? coeffs.i_limit : ((integral < -coeffs.i_limit)? -coeffs.i_limit : integral);
+
+  float output = coeffs.kp * error + integral + state.d_filtered;
+  float limited = (output > coeffs.out_limit)? coeffs.out_limit : ((output < -coeffs.out_limit)? -coeffs.out_limit : output);
+  if (limited == output || (output > 0.0f) != (error > 0.0f)) {
+    state.integral = integral;
+  }
+  return limited;
+}
+#endif
+
+/**
+ * @brief Sets Controller::gains for the time since launch; a shift picks the row and a mask the 
+ * fraction to the next one, so the cost is the same every tick
+ * @param ms_since_launch Milliseconds since launch, 0 before launch
+ */
+void ScheduleGains(unsigned long ms_since_launch)
+{
+  unsigned long row = ms_since_launch >> GAIN_SCHEDULE_SHIFT;
+#ifdef MATH_FIXED_POINT
+  // the fraction stays in ms, the shift divides it back out
+  int32_t frac = ms_since_launch & (GAIN_SCHEDULE_STEP_MS - 1);
+  if (row >= GAIN_SCHEDULE_ROWS - 1) {
+    row = GAIN_SCHEDULE_ROWS - 2;
+    frac = GAIN_SCHEDULE_STEP_MS;
+  }
+#else
+  float frac = (ms_since_launch & (GAIN_SCHEDULE_STEP_MS - 1)) * (1.0f / GAIN_SCHEDULE_STEP_MS);
+  if (row >= GAIN_SCHEDULE_ROWS - 1) {
+    row = GAIN_SCHEDULE_ROWS - 2;
+    frac = 1.0f;
+  }
+#endif
+
+  RateGains lower[3], upper[3];
+  memcpy_P(lower, GAIN_SCHEDULE[row], sizeof(lower));
+  memcpy_P(upper, GAIN_SCHEDULE[row + 1], sizeof(upper));
+  for (int i = 0; i < 3; i++) {
+    Controller::gains[i] = BASE_RATE_PID;
+#ifdef MATH_FIXED_POINT
+    Controller::gains[i].kp = lower[i].kp + (((upper[i].kp - lower[i].kp) * frac) >> GAIN_SCHEDULE_SHIFT);
+    Controller::gains[i].ki_dt = lower[i].ki_dt + (((upper[i].ki_dt - lower[i].ki_dt) * frac) >> GAIN_SCHEDULE_SHIFT);
+    Controller::gains[i].kd_over_dt = lower[i].kd_over_dt + (((upper[i].kd_over_dt - lower[i].kd_over_dt) * frac) >> GAIN_SCHEDULE_SHIFT);
+#else
+    Controller::gains[i].kp = lower[i].kp + frac * (upper[i].kp - lower[i].kp);
+    Controller::gains[i].ki_dt = lower[i].ki_dt + frac * (upper[i].ki_dt - lower[i].ki_dt);
+    Controller::gains[i].kd_over_dt = lower[i].kd_over_dt + frac * (upper[i].kd_over_dt - lower[i].kd_over_dt);
+#endif
+  }
+}
+
+/** @brief Clears the controller state, the next tick starts from no integral and no derivative history */
+void ResetController()
+{
+  Controller::roll_rate = PIDState();
+  Controller::pitch_rate = PIDState();
+  Controller::yaw_rate = PIDState();
+}
+
+#ifdef MATH_FIXED_POINT
+/**
+ * @brief Gets the body rates the controller works on, the raw gyro counts (the gains carry GYR_RAD_PER_LSB)
+ * @param rates_ret Array used to retrieve the (roll, pitch, yaw) rates in gyro counts
+ */
+void GetBodyRates(int16_t rates_ret[3])
+{
+  memcpy(rates_ret, Sensor::sample.gyrRaw, 3 * sizeof(int16_t));
+}
+#else
+/**
+ * @brief Gets the body rates the controller works on
+ * @param rates_ret Array used to retrieve the (roll, pitch, yaw) rates in rad/s
+ */
+void GetBodyRates(float rates_ret[3])
+{
+#if defined(ICM_DMP_MODE)
+  // the DMP only hands out quaternions, so the rates come from the rotation between the last two:
+  // q_prev* x q_new is about (1, w * dt / 2) for small steps
+  if (Sensor::dmp_timestamp != Controller::prev_quat_timestamp) {
+    const float* p = Controller::prev_quat;
+    // ReadQuaternionFromDMP keeps w >= 0, so q flips to -q (the same attitude) whenever the rotation passes 180 degrees, 
+    // once a roll turn; take the one on the previous one's side or the rates flip sign for a tick
+    float q[4];
+    float sign = (p[0] * Sensor::dmp_quat[0] + p[1] * Sensor::dmp_quat[1] + p[2] * Sensor::dmp_quat[2] + p[3] * Sensor::dmp_quat[3] < 0.0f)? -1.0f : 1.0f;
+    for (int i = 0; i < 4; i++) {
+      q[i] = sign * Sensor::dmp_quat[i];
+    }
+    float dt = (Sensor::dmp_timestamp - Controller::prev_quat_timestamp) / 1000000.0f;
+    if (Controller::prev_quat_timestamp != 0 && dt > 0.0f && dt < MAHONY_MAX_DT) {
+      float scale = 2.0f / dt;
+      Controller::rates[0] = scale * (p[0] * q[1] - p[1] * q[0] - p[2] * q[3] + p[3] * q[2]);
+      Controller::rates[1] = scale * (p[0] * q[2] + p[1] * q[3] - p[2] * q[0] - p[3] * q[1]);
+      Controller::rates[2] = scale * (p[0] * q[3] - p[1] * q[2] + p[2] * q[1] - p[3] * q[0]);
+    }
+    memcpy(Controller::prev_quat, q, sizeof(Controller::prev_quat));
+    Controller::prev_quat_timestamp = Sensor::dmp_timestamp;
+  }
+  memcpy(rates_ret, Controller::rates, sizeof(Controller::rates));
+#else
+  rates_ret[0] = Sensor::sample.gyrX * DEG2RAD;
+  rates_ret[1] = Sensor::sample.gyrY * DEG2RAD;
+  rates_ret[2] = Sensor::sample.gyrZ * DEG2RAD;
+  #if ESTIMATOR == ESTIMATOR_MAHONY
+    // the filter learned the gyro bias, the integral feedback is its negative
+    for (int i = 0; i < 3; i++) {
+      rates_ret[i] += Mahony::bias_integral[i];
+    }
+  #endif
+#endif
+}
+#endif
+
+
+/***************************************************************
+                        COMMAND LINK
+***************************************************************/
+// COMMAND_LINK builds take commands from the sim in the same frame layout as the binary telemetry (see TELEMETRY FRAMES;
+// the timestamp is the sender's and is not used). CommandTask feeds whatever bytes have come in to an incremental 
+// parser, at most COMMAND_MAX_BYTES_PER_RUN a run, so it never waits on serial. Every command but an IMU sample is 
+// answered with a TELEMETRY_FRAME_ACK (a "# ack" line in ASCII builds); the ack can be dropped like any frame when 
+// the link is full, and every command only sets a value, so the sim just sends it again.
+#ifdef COMMAND_LINK
+const uint8_t COMMAND_MAX_BYTES_PER_RUN = 64;           // the most a run of CommandTask parses
+const unsigned long COMMAND_PERIOD_US = 1000;           // 1kHz, 50 bytes a run at 500000 baud
+const unsigned long COMMAND_MIN_TELEMETRY_PERIOD_US = 1000;
+
+/** @brief enum which stores the type byte of each command frame */
+enum COMMAND_FRAME {
+  COMMAND_FRAME_IMU = 0x10,            // 9 int16: accel, gyro and mag counts (x, y, z) as the ICM has them in its registers, mag in the AK09916 axes
+  COMMAND_FRAME_GAINS = 0x11,          // uint8 axis (0 roll, 1 pitch, 2 yaw, 0xFF all back to GAIN_SCHEDULE), 3 float32: kp, ki, kd
+  COMMAND_FRAME_TELEMETRY_RATE = 0x12, // uint32 micros between telemetry frames, at least COMMAND_MIN_TELEMETRY_PERIOD_US; holds until the next flight phase
+  COMMAND_FRAME_MODE = 0x13,           // uint8 COMMAND_MODE flags
+  COMMAND_FRAME_TELEMETRY_FIELDS = 0x14 // uint8 field mask, then a uint8 divider (1 - 255) per field (see TELEMETRY DELTA), TELEMETRY_DELTA builds only
+};
+
+/** @brief enum which stores the flags of COMMAND_FRAME_MODE */
+enum COMMAND_MODE {
+  COMMAND_MODE_INJECT = 0x01,          // the COMMAND_FRAME_IMU samples replace the ICM's
+  COMMAND_MODE_HOLD = 0x02,            // controller off, canards held at neutral
+  COMMAND_MODE_ALL = COMMAND_MODE_INJECT | COMMAND_MODE_HOLD
+};
+
+/** @brief enum which stores the result byte of TELEMETRY_FRAME_ACK */
+enum COMMAND_RESULT {
+  COMMAND_RESULT_OK = 0,
+  COMMAND_RESULT_BAD_PAYLOAD = 1,      // wrong length or a value out of range
+  COMMAND_RESULT_UNSUPPORTED = 2       // unknown type, or not in this build
+};
+
+/** 
+ * @brief namespace that holds the command parser and what the commands set
+ */
+namespace Command {
+  uint8_t frame[TELEMETRY_MAX_FRAME];  // frame being received
+  uint8_t received = 0;                // bytes of it so far
+  uint8_t mode = 0;                    // COMMAND_MODE flags
+  IMUSample sample;                    // newest injected sample
+  bool sample_pending = false;         // sample has not been processed yet
+  bool gains_set[3] = {false, false, false}; // the axis' gains are overridden
+  RateGains gains[3];                  // overrides of the (roll, pitch, yaw) gains, the control period folded in
+  unsigned long frames = 0;            // good frames received
+  unsigned long bad_frames = 0;        // frames with a bad length or crc
+  unsigned long injected = 0;          // injected samples processed
+}
+
+/**
+ * @brief Feeds one received byte to the frame parser; a bad frame is dropped and the parser 
+ * looks for the next sync word
+ * @param b The byte
+ * @return true if the byte completed a frame with a good crc, which is then in Command::frame
+ */
+bool ParseCommandByte(uint8_t b)
+{
+  uint8_t* frame = Command::frame;
+  if (Command::received == 0) {
+    if (b == TELEMETRY_SYNC_0) {
+      frame[Command::received++] = b;
+    }
+    return false;
+  }
+  if (Command::received == 1) {
+    if (b == TELEMETRY_SYNC_1) {
+      frame[Command::received++] = b;
+    } else {
+      Command::received = (b == TELEMETRY_SYNC_0)? 1 : 0;
+    }
+    return false;
+  }
+
+  frame[Command::received++] = b;
+  if (Command::received == 4 && frame[3] > TELEMETRY_MAX_PAYLOAD) {
+    Command::bad_frames++;
+    Command::received = 0;
+    return false;
+  }
+  if (Command::received < TELEMETRY_HEADER_SIZE + TELEMETRY_CRC_SIZE || Command::received < TELEMETRY_HEADER_SIZE + frame[3] + TELEMETRY_CRC_SIZE) {
+    return false;
+  }
+
+  Command::received = 0;
+  uint8_t len = TELEMETRY_HEADER_SIZE + frame[3];
+  uint16_t crc;
+  memcpy(&crc, frame + len, sizeof(crc));
+  if (Crc16(frame + 2, len - 2) != crc) {
+    Command::bad_frames++;
+    return false;
+  }
+  Command::frames++;
+  return true;
+}
+
+/**
+ * @brief Answers a command
+ * @param type The type of the command
+ * @param seq The sequence number of the command
+ * @param result The COMMAND_RESULT
+ */
+void SendCommandAck(uint8_t type, uint8_t seq, uint8_t result)
+{
+#ifdef TELEMETRY_BINARY
+  uint8_t payload[3] = {type, seq, result};
+  static_assert(sizeof(payload) <= TELEMETRY_MAX_PAYLOAD, "the ack must fit a frame");
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t frame_len = BuildTelemetryFrame(frame, TELEMETRY_FRAME_ACK, payload, sizeof(payload));
+  TxEnqueue(frame, frame_len);
+#else
+  char line[24];
+  int len = snprintf(line, sizeof(line) - 2, "# ack %u %u %u", type, seq, result);
+  line[len++] = '\r';
+  line[len++] = '\n';
+  TxEnqueue((const uint8_t*)line, len);
+#endif
+}
+
+/** @brief Puts the overridden gains over the ones ScheduleGains set */
+void OverrideGains()
+{
+  for (int i = 0; i < 3; i++) {
+    if (Command::gains_set[i]) {
+      Controller::gains[i].kp = Command::gains[i].kp;
+      Controller::gains[i].ki_dt = Command::gains[i].ki_dt;
+      Controller::gains[i].kd_over_dt = Command::gains[i].kd_over_dt;
+    }
+  }
+}
+
+/** @brief Starts the orientation estimate over, for when the samples start or stop coming from the sim */
+void RestartEstimate()
+{
+#if ESTIMATOR == ESTIMATOR_MAHONY
+  Mahony::initialized = false;
+  Mahony::heading_valid = false;
+  memset(Mahony::bias_integral, 0, sizeof(Mahony::bias_integral));
+#endif
+}
+
+/**
+ * @brief Runs the newest injected sample through the orientation estimate, if there is one
+ * @param deltaTime The loop time, only used for the very first sample
+ */
+void ProcessInjectedSample(float deltaTime)
+{
+  if (!Command::sample_pending) {
+    return;
+  }
+  Command::sample_pending = false;
+  Command::injected++;
+  ProcessSample(Command::sample, deltaTime);
+}
+#endif
+
+
+/***************************************************************
+                        CORE HANDOFF
+***************************************************************/
+// The telemetry and log tasks report from a RocketSnapshot instead of the live state, so they never see
+// the orientation from one tick next to the canards of the next. Single core builds take one right when it is 
+// asked for, nothing else writes the state in between. DUAL_CORE builds share one snapshot through a sequence lock: 
+// the control core makes Snapshot::seq odd, writes the snapshot and makes it even again, and the other core copies 
+// it out and starts over if seq was odd or moved meanwhile. The writer never waits and takes no lock, a reader only
+// repeats a copy of a few dozen bytes when it ran into a write, and both only need plain 32 bit atomic loads and
+// stores, which the Cortex-M0+ of the RP2040 has (it has no atomic exchange).
+
+/**
+ * @brief Copies the live state into a snapshot
+ * @param state_ret The snapshot to fill
+ */
+void FillSnapshot(RocketSnapshot& state_ret)
+{
+  memcpy(state_ret.attitude, Rocket::attitude, sizeof(state_ret.attitude));
+  state_ret.pitch = Rocket::pitch;
+  state_ret.roll = Rocket::roll;
+  state_ret.yaw = Rocket::yaw;
+  state_ret.euler_stale = Rocket::euler_stale;
+#ifdef MATH_FIXED_POINT
+  state_ret.pitch_bam = Rocket::pitch_bam;
+  state_ret.roll_bam = Rocket::roll_bam;
+  state_ret.yaw_bam = Rocket::yaw_bam;
+  state_ret.attitude_stale = Rocket::attitude_stale;
+  memcpy(state_ret.canard_bam, Rocket::canard_bam, sizeof(state_ret.canard_bam));
+#endif
+  GetCanardRotations(state_ret.canard_rotations);
+  state_ret.sample = Sensor::sample;
+  state_ret.sample_count = Sensor::sample_count;
+  state_ret.launched = Flight::launched;
+  state_ret.phase = Flight::phase;
+}
+
+#ifdef DUAL_CORE
+#include <atomic>
+
+/** 
+ * @brief namespace that holds the snapshot shared between the cores
+ */
+namespace Snapshot {
+  RocketSnapshot shared;             // written by the control core while seq is odd
+  std::atomic<uint32_t> seq(0);      // goes up by one at the start and at the end of every write
+  RocketSnapshot copy;               // the reporting core's copy of shared, only it touches this
+  uint32_t copy_seq = 0;             // seq copy was taken at
+  unsigned long retries = 0;         // copies started over because the control core was writing
+  std::atomic<bool> started(false);  // setup() is done and the first snapshot is out
+}
+
+/** @brief Publishes the live state to the other core, only called on the control core */
+void PublishSnapshot()
+{
+  uint32_t seq = Snapshot::seq.load(std::memory_order_relaxed);
+  Snapshot::seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release); // odd before any of the writes
+  FillSnapshot(Snapshot::shared);
+  Snapshot::seq.store(seq + 2, std::memory_order_release);
+}
+#else
+namespace Snapshot {
+  RocketSnapshot copy;
+}
+#endif
+
+/**
+ * @brief Gets the state to report, only called by the telemetry and log side;
+ * stays valid and unchanged until the next call
+ * @return The newest snapshot
+ */
+const RocketSnapshot& ReportedState()
+{
+#ifdef DUAL_CORE
+  uint32_t seq = Snapshot::seq.load(std::memory_order_acquire);
+  while (seq != Snapshot::copy_seq) {
+    if (seq & 1) {
+      // the control core is in the middle of a write, it is done in a few us
+      seq = Snapshot::seq.load(std::memory_order_acquire);
+      continue;
+    }
+    memcpy(&Snapshot::copy, &Snapshot::shared, sizeof(Snapshot::copy));
+    std::atomic_thread_fence(std::memory_order_acquire); // the copy before the second look at seq
+    uint32_t after = Snapshot::seq.load(std::memory_order_relaxed);
+    if (after == seq) {
+      Snapshot::copy_seq = seq;
+      break;
+    }
+    Snapshot::retries++;
+    seq = after;
+  }
+#else
+  FillSnapshot(Snapshot::copy);
+#endif
+  return Snapshot::copy;
+}
+
+/** @return The flight phase as the telemetry and log side sees it, without taking a new snapshot */
+inline uint8_t ReportedPhase() {
+#ifdef DUAL_CORE
+  return Snapshot::copy.phase; // as of the last ReportedState()
+#else
+  return Flight::phase;
+#endif
+}
+
+
+/***************************************************************
+                        FLIGHT LOG
+***************************************************************/
+// Records go into one of two page sized RAM buffers while the other one is programmed into the flash 
+// a chunk at a time, and only when the flash is not busy, so logging never waits on the chip.
+// Flash layout: 256 byte pages, each one a LogPageHeader and LOG_RECORDS_PER_PAGE LogRecords (little endian),
+// written one after another from address 0; a page with seq 0xFFFF is erased and marks the end of the log.
+// A new boot carries on after the last written page with the next boot id.
+#ifdef FLIGHT_LOG
+const uint16_t LOG_PAGE_BYTES = 256;
+const uint8_t LOG_CHUNK_BYTES = 64;          // bytes programmed per call, about 70us of SPI at 8MHz
+const uint32_t LOG_MAX_BYTES = 16777216UL;   // 3 byte addresses, larger chips only use the first 16MB
+const SPISettings LOG_SPI_SETTINGS(8000000, MSBFIRST, SPI_MODE0);
+
+// SPI NOR flash commands (W25Q series and most compatible chips)
+const uint8_t FLASH_CMD_WRITE_ENABLE = 0x06;
+const uint8_t FLASH_CMD_READ_STATUS = 0x05;
+const uint8_t FLASH_CMD_PAGE_PROGRAM = 0x02;
+const uint8_t FLASH_CMD_READ = 0x03;
+const uint8_t FLASH_CMD_CHIP_ERASE = 0xC7;
+const uint8_t FLASH_CMD_JEDEC_ID = 0x9F;
+const uint8_t FLASH_STATUS_BUSY = 0x01;
+
+/** @brief one logged sample, 40 bytes */
+struct LogRecord {
+  uint32_t timestamp;      // micros() of the sample
+  int16_t acc[3];          // raw accel counts (x, y, z)
+  int16_t gyr[3];          // raw gyro counts
+  int16_t mag[3];          // raw mag counts
+  int16_t attitude[4];     // attitude quaternion (w, x, y, z) * 16384
+  int16_t canards[4];      // canard rotations, radians * 4096
+  uint16_t loop_us;        // time since the previous record was taken (micros, saturates)
+} __attribute__((packed));
+
+/** @brief start of every flash page, 8 bytes */
+struct LogPageHeader {
+  uint16_t seq;            // page number since the chip was erased, 0xFFFF is an erased page
+  uint8_t boot;            // boot id, goes up by one every power on
+  uint8_t count;           // records in the page
+  uint16_t dropped;        // records lost since the previous page because both buffers were full
+  uint16_t crc;            // Crc16 over seq, boot, count, dropped and the records
+} __attribute__((packed));
+
+const uint8_t LOG_RECORDS_PER_PAGE = (LOG_PAGE_BYTES - sizeof(LogPageHeader)) / sizeof(LogRecord);
+const uint16_t LOG_PAGE_USED = sizeof(LogPageHeader) + LOG_RECORDS_PER_PAGE * sizeof(LogRecord); // the rest stays erased
+
+/** 
+ * @brief namespace that holds the log buffers and where the log is in the flash
+ */
+namespace Log {
+  uint8_t pages[2][LOG_PAGE_BYTES];  // ping-pong page buffers
+  bool pending[2] = {false, false};  // the buffer is full and waiting to be programmed
+  uint8_t fill = 0;                  // buffer records are added to
+  uint8_t fill_count = 0;            // records in the fill buffer
+  uint8_t flush = 0;                 // buffer being programmed
+  uint16_t flush_offset = 0;         // bytes of the flush buffer programmed so far
+  uint32_t address = 0;              // flash address of the page being programmed
+  uint32_t capacity = 0;             // bytes the log may use, 0 if there is no flash
+  uint16_t seq = 0;                  // seq of the next page
+  uint8_t boot = 0;
+  bool full = false;                 // ran out of flash, nothing more is logged
+  unsigned long checked_sample_count = 0;
+  unsigned long last_timestamp = 0;
+  unsigned long records = 0;         // records logged
+  unsigned long dropped = 0;         // records lost because both buffers were full
+  uint16_t dropped_since_page = 0;
+}
+
+inline void FlashSelect() {
+  SPI.beginTransaction(LOG_SPI_SETTINGS);
+  digitalWrite(LOG_FLASH_CS_PIN, LOW);
+}
+
+inline void FlashDeselect() {
+  digitalWrite(LOG_FLASH_CS_PIN, HIGH);
+  SPI.endTransaction();
+}
+
+/** @brief Sends a one byte command to the flash */
+void FlashCommand(uint8_t cmd)
+{
+  FlashSelect();
+  SPI.transfer(cmd);
+  FlashDeselect();
+}
+
+/** @brief Sends a command with a 3 byte address to the flash, leaves the chip selected */
+void FlashAddressCommand(uint8_t cmd, uint32_t address)
+{
+  FlashSelect();
+  SPI.transfer(cmd);
+  SPI.transfer((uint8_t)(address >> 16));
+  SPI.transfer((uint8_t)(address >> 8));
+  SPI.transfer((uint8_t)address);
+}
+
+/** @return true while the flash is still programming or erasing */
+bool FlashBusy()
+{
+  FlashSelect();
+  SPI.transfer(FLASH_CMD_READ_STATUS);
+  uint8_t status = SPI.transfer(0);
+  FlashDeselect();
+  return (status & FLASH_STATUS_BUSY) != 0;
+}
+
+/**
+ * @brief Reads from the flash
+ * @param address The flash address
+ * @param data Where the bytes go
+ * @param len The amount of bytes
+ */
+void FlashRead(uint32_t address, uint8_t* data, uint16_t len)
+{
+  FlashAddressCommand(FLASH_CMD_READ, address);
+  for (uint16_t i = 0; i < len; i++) {
+    data[i] = SPI.transfer(0);
+  }
+  FlashDeselect();
+}
+
+/**
+ * @brief Starts programming bytes into the flash, they must stay within one page; does not wait for it to finish
+ * @param address The flash address
+ * @param data The bytes
+ * @param len The amount of bytes
+ */
+void FlashProgram(uint32_t address, const uint8_t* data, uint16_t len)
+{
+  FlashCommand(FLASH_CMD_WRITE_ENABLE);
+  FlashAddressCommand(FLASH_CMD_PAGE_PROGRAM, address);
+  for (uint16_t i = 0; i < len; i++) {
+    SPI.transfer(data[i]);
+  }
+  FlashDeselect();
+}
+
+/** @return The seq of the flash page, 0xFFFF if it is erased */
+uint16_t FlashPageSeq(uint32_t page)
+{
+  uint16_t seq;
+  FlashRead(page * LOG_PAGE_BYTES, (uint8_t*)&seq, sizeof(seq));
+  return seq;
+}
+
+/**
+ * @brief Finds the flash and the end of the log; the pages are written in order, 
+ * so a binary search for the first erased page finds it in ~16 reads
+ * @return true if a flash chip answered
+ */
+bool LogBegin()
+{
+  pinMode(LOG_FLASH_CS_PIN, OUTPUT);
+  digitalWrite(LOG_FLASH_CS_PIN, HIGH);
+  SPI.begin();
+
+  // the last JEDEC id byte is log2 of the size for nearly every SPI NOR chip
+  uint8_t id[3];
+  FlashSelect();
+  SPI.transfer(FLASH_CMD_JEDEC_ID);
+  for (int i = 0; i < 3; i++) {
+    id[i] = SPI.transfer(0);
+  }
+  FlashDeselect();
+  if (id[0] == 0x00 || id[0] == 0xFF || id[2] < 16 || id[2] > 31) {
+    Log::capacity = 0;
+    return false;
+  }
+  Log::capacity = 1UL << id[2];
+  Log::capacity = (Log::capacity > LOG_MAX_BYTES)? LOG_MAX_BYTES : Log::capacity;
+
+  uint32_t lower = 0;
+  uint32_t upper = Log::capacity / LOG_PAGE_BYTES; // first erased page is in [lower, upper]
+  while (lower < upper) {
+    uint32_t mid = lower + (upper - lower) / 2;
+    if (FlashPageSeq(mid) == 0xFFFF) {
+      upper = mid;
+    } else {
+      lower = mid + 1;
+    }
+  }
+  Log::address = lower * LOG_PAGE_BYTES;
+  Log::full = (Log::address >= Log::capacity);
+  if (lower > 0) {
+    LogPageHeader last;
+    FlashRead(Log::address - LOG_PAGE_BYTES, (uint8_t*)&last, sizeof(last));
+    Log::seq = last.seq + 1;
+    Log::boot = last.boot + 1;
+  }
+  return true;
+}
+
+/** @brief Finishes the fill buffer's header and hands it to the flush side */
+void LogClosePage()
+{
+  uint8_t* page = Log::pages[Log::fill];
+  LogPageHeader header;
+  header.seq = Log::seq++;
+  header.boot = Log::boot;
+  header.count = Log::fill_count;
+  header.dropped = Log::dropped_since_page;
+  // the crc covers everything in the page but itself
+  header.crc = Crc16((const uint8_t*)&header, sizeof(header) - sizeof(header.crc));
+  header.crc = Crc16(page + sizeof(header), Log::fill_count * sizeof(LogRecord), header.crc);
+  memcpy(page, &header, sizeof(header));
+
+  Log::pending[Log::fill] = true;
+  Log::dropped_since_page = 0;
+  Log::fill ^= 1;
+  Log::fill_count = 0;
+}
+
+/**
+ * @brief Adds a record of the newest sample to the fill buffer
+ * @param state The state the sample is in
+ */
+void LogRecordSample(const RocketSnapshot& state)
+{
+  if (Log::pending[Log::fill]) {
+    // both buffers are waiting on the flash
+    Log::dropped++;
+    Log::dropped_since_page += (Log::dropped_since_page < 0xFFFF)? 1 : 0;
+    return;
+  }
+
+  const IMUSample& sample = state.sample;
+  LogRecord record;
+  record.timestamp = sample.timestamp;
+  memcpy(record.acc, sample.accRaw, sizeof(record.acc));
+  memcpy(record.gyr, sample.gyrRaw, sizeof(record.gyr));
+  memcpy(record.mag, sample.magRaw, sizeof(record.mag));
+  float q[4];
+  SnapshotAttitude(state, q);
+  for (int i = 0; i < 4; i++) {
+    record.attitude[i] = (int16_t)(q[i] * 16384.0f);
+    record.canards[i] = RadToQ12(state.canard_rotations[i]);
+  }
+  unsigned long loop_us = sample.timestamp - Log::last_timestamp;
+  record.loop_us = (Log::records == 0 || loop_us > 0xFFFF)? 0xFFFF : (uint16_t)loop_us;
+  Log::last_timestamp = sample.timestamp;
+
+  memcpy(Log::pages[Log::fill] + sizeof(LogPageHeader) + Log::fill_count * sizeof(LogRecord), &record, sizeof(record));
+  Log::records++;
+  if (++Log::fill_count >= LOG_RECORDS_PER_PAGE) {
+    LogClosePage();
+  }
+}
+
+/** @brief Programs the next chunk of a full buffer if the flash is free, returns right away otherwise */
+void LogFlush()
+{
+  if (!Log::pending[Log::flush] || FlashBusy()) {
+    return;
+  }
+  uint16_t len = LOG_PAGE_USED - Log::flush_offset;
+  len = (len > LOG_CHUNK_BYTES)? LOG_CHUNK_BYTES : len;
+  FlashProgram(Log::address + Log::flush_offset, Log::pages[Log::flush] + Log::flush_offset, len);
+  Log::flush_offset += len;
+
+  if (Log::flush_offset >= LOG_PAGE_USED) {
+    Log::pending[Log::flush] = false;
+    Log::flush ^= 1;
+    Log::flush_offset = 0;
+    Log::address += LOG_PAGE_BYTES;
+    Log::full = (Log::address >= Log::capacity);
+  }
+}
+
+/**
+ * @brief Sends the whole log over serial as it sits in the flash (raw pages up to the first erased one)
+ * for tools/decode_flight_log.py; blocks, only used by LOG_DUMP_MODE
+ */
+void LogDump()
+{
+  uint8_t page[LOG_PAGE_BYTES];
+  for (uint32_t address = 0; address < Log::capacity; address += LOG_PAGE_BYTES) {
+    FlashRead(address, page, LOG_PAGE_BYTES);
+    if (page[0] == 0xFF && page[1] == 0xFF) {
+      break;
+    }
+    Serial.write(page, LOG_PAGE_BYTES);
+  }
+}
+
+/** @brief Erases the whole flash chip, blocks until it is done (can take a minute) */
+void LogErase()
+{
+  FlashCommand(FLASH_CMD_WRITE_ENABLE);
+  FlashCommand(FLASH_CMD_CHIP_ERASE);
+  while (FlashBusy()) {
+    delay(100);
+  }
+  Log::address = 0;
+  Log::seq = 0;
+  Log::boot = 0;
+  Log::full = false;
+}
+
+/** @brief Serves the LOG_DUMP_MODE commands: 'd' dumps the log, 'e' erases the chip */
+void LogDumpCommands()
+{
+  if (Serial.available() <= 0) {
+    return;
+  }
+  int cmd = Serial.read();
+  if (cmd == 'd') {
+    LogDump();
+  } else if (cmd == 'e') {
+    LogErase();
+    Serial.println("# log erased");
+  }
+}
+#endif
+
+
+/***************************************************************
+                        BENCHMARKS
+***************************************************************/
+// BENCH_MODE_ON times the hot path kernels on the board itself. Results go out over serial as CSV:
+// a header line, a board line (bench_board,<arch>,<cycles per us>,<cycle clock>) and then one line per
+// benchmark, bench,<name>,<calls>,<cycles per call>,<max error>. Keep a capture of a known good build
+// and compare new ones against it: python3 tools/compare_bench.py good.txt new.txt
+const uint16_t BENCH_CALLS = 2000;
+const uint16_t BENCH_SLOW_CALLS = 200; // for the snprintf and I2C benchmarks, each call is a ms or so on AVR
+const uint8_t BENCH_INPUTS = 64;
+
+#if defined(__AVR__)
+const char* const BENCH_ARCH = "avr";
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+const char* const BENCH_ARCH = "arm-cortex-m";
+#elif defined(__arm__)
+const char* const BENCH_ARCH = "arm";
+#else
+const char* const BENCH_ARCH = "other";
+#endif
+
+/** @brief Prints the CSV header and the board line the results are in the cycles of */
+void BenchHeader()
+{
+  Serial.println("bench,name,calls,cycles_per_call,max_error");
+  Serial.print("bench_board,");
+  Serial.print(BENCH_ARCH);
+  Serial.print(",");
+  Serial.print((unsigned long)CYCLES_PER_US);
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  Serial.println(",dwt");
+#else
+  Serial.println(",micros");
+#endif
+}
+
+/**
+ * @brief Prints one benchmark result as a CSV line
+ * @param name The name of the benchmark
+ * @param calls The calls the cycles are over
+ * @param cycles The cycles all the calls took
+ * @param max_error The largest error against the reference seen, 0 if there is none
+ */
+void BenchReport(const char* name, uint16_t calls, uint32_t cycles, float max_error)
+{
+  Serial.print("bench,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.print((unsigned long)calls);
+  Serial.print(",");
+  Serial.print((double)cycles / calls, 1);
+  Serial.print(",");
+  Serial.print((double)max_error, 7);
+  Serial.println();
+}
+
+/**
+ * @brief Runs the math microbenchmarks: the libm atan2f and 1 / sqrt against the FAST MATH kernels
+ */
+void RunMathBenchmarks()
+{
+  // inputs like the sensor path sees; accel in milli g over every direction
+  float in_y[BENCH_INPUTS], in_x[BENCH_INPUTS], in_sq[BENCH_INPUTS];
+  for (uint8_t i = 0; i < BENCH_INPUTS; i++) {
+    float angle = i * (PI2 / BENCH_INPUTS) - PI + 0.01f;
+    in_y[i] = 1000.0f * sinf(angle);
+    in_x[i] = 1000.0f * cosf(angle);
+    in_sq[i] = 10.0f + i * i * 300.0f;
+  }
+
+  volatile float sink = 0.0f; // keeps the compiler from dropping the calls
+  float error = 0.0f;
+  uint32_t start;
+
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_CALLS; n++) {
+    sink = atan2f(in_y[n % BENCH_INPUTS], in_x[n % BENCH_INPUTS]);
+  }
+  BenchReport("atan2f", BENCH_CALLS, CycleCount() - start, 0.0f);
+
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_CALLS; n++) {
+    sink = fastAtan2f(in_y[n % BENCH_INPUTS], in_x[n % BENCH_INPUTS]);
+  }
+  uint32_t cycles = CycleCount() - start;
+  for (uint8_t i = 0; i < BENCH_INPUTS; i++) {
+    float e = fabsf(fastAtan2f(in_y[i], in_x[i]) - atan2f(in_y[i], in_x[i]));
+    error = (e > error)? e : error;
+  }
+  BenchReport("fastAtan2f", BENCH_CALLS, cycles, error);
+
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_CALLS; n++) {
+    sink = 1.0f / sqrtf(in_sq[n % BENCH_INPUTS]);
+  }
+  BenchReport("1/sqrtf", BENCH_CALLS, CycleCount() - start, 0.0f);
+
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_CALLS; n++) {
+    sink = fastInvSqrtf(in_sq[n % BENCH_INPUTS]);
+  }
+  cycles = CycleCount() - start;
+  error = 0.0f;
+  for (uint8_t i = 0; i < BENCH_INPUTS; i++) {
+    float exact = 1.0f / sqrtf(in_sq[i]);
+    float e = fabsf(fastInvSqrtf(in_sq[i]) - exact) / exact; // relative
+    error = (e > error)? e : error;
+  }
+  BenchReport("fastInvSqrtf", BENCH_CALLS, cycles, error);
+  (void)sink;
+}
+
+/**
+ * @brief Times the functions loop() runs on every tick with the inputs they see in flight: the telemetry
+ * string packing, the angle wrapping, the raw orientation (atan2 / sqrt block of the sensor path), the canard 
+ * clamp and servo conversion, and the I2C read of the ICM, which needs the ICM started
+ */
+void RunHotPathBenchmarks()
+{
+  IMUSample samples[BENCH_INPUTS / 4];
+  float angles[BENCH_INPUTS], canards[BENCH_INPUTS][4];
+  for (uint8_t i = 0; i < BENCH_INPUTS; i++) {
+    // angles up to a few turns out either way, most of them within a turn like on the hot path
+    angles[i] = (i * (PI2 / BENCH_INPUTS) - PI) * ((i % 8 == 0)? 5.0f : 1.5f);
+    for (uint8_t c = 0; c < 4; c++) {
+      canards[i][c] = ((i + 16 * c) % BENCH_INPUTS) * (0.7f / BENCH_INPUTS) - 0.35f; // +-20 degrees, some past the limit
+    }
+  }
+  for (uint8_t i = 0; i < BENCH_INPUTS / 4; i++) {
+    float angle = i * (PI2 / (BENCH_INPUTS / 4));
+    IMUSample& sample = samples[i];
+    memset(&sample, 0, sizeof(sample));
+    sample.accX = 980.0f * cosf(0.3f * angle);
+    sample.accY = 150.0f * sinf(angle);
+    sample.accZ = 150.0f * cosf(angle);
+    sample.magX = 25.0f * cosf(angle);
+    sample.magY = 25.0f * sinf(angle);
+    sample.magZ = -43.0f;
+  }
+
+  volatile float sink = 0.0f; // keeps the compiler from dropping the calls
+  uint32_t start, cycles;
+
+  float telemetry[7] = {0.12f, -1.5f, 3.1f, 0.2f, -0.2f, 0.05f, -0.05f};
+  char line[8 * 7 + 1];
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_SLOW_CALLS; n++) {
+    telemetry[0] = angles[n % BENCH_INPUTS];
+    PackFloatsInStr(line, sizeof(line), telemetry, 7, 8);
+  }
+  cycles = CycleCount() - start;
+  sink = line[0];
+  BenchReport("PackFloatsInStr", BENCH_SLOW_CALLS, cycles, 0.0f);
+
+  float wrapped = 0.0f;
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_CALLS; n++) {
+    wrapped = angles[n % BENCH_INPUTS];
+    fixRadian(wrapped);
+    sink = wrapped;
+  }
+  BenchReport("fixRadian", BENCH_CALLS, CycleCount() - start, 0.0f);
+
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_CALLS; n++) {
+    wrapped = angles[n % BENCH_INPUTS] * RAD2DEG;
+    fixDegree(wrapped);
+    sink = wrapped;
+  }
+  BenchReport("fixDegree", BENCH_CALLS, CycleCount() - start, 0.0f);
+
+  float pitch, roll, yaw;
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_CALLS; n++) {
+    RawOrientation(samples[n % (BENCH_INPUTS / 4)], pitch, roll, yaw);
+    sink = pitch + roll + yaw;
+  }
+  BenchReport("RawOrientation", BENCH_CALLS, CycleCount() - start, 0.0f);
+
+  float rad[4];
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_CALLS; n++) {
+    memcpy(rad, canards[n % BENCH_INPUTS], sizeof(rad));
+    SetCanardRotations(rad);
+  }
+  cycles = CycleCount() - start;
+  SetCanardRotations(rad); // back at a command inside the limits, the output is never written in this mode
+  BenchReport("SetCanardRotations", BENCH_CALLS, cycles, 0.0f);
+
+  start = CycleCount();
+  for (uint16_t n = 0; n < BENCH_SLOW_CALLS; n++) {
+    ICM_Obj.getAGMT();
+  }
+  cycles = CycleCount() - start;
+  BenchReport("getAGMT", BENCH_SLOW_CALLS, cycles, (ICM_Obj.status == ICM_20948_Stat_Ok)? 0.0f : 1.0f);
+  (void)sink;
+}
+
+
+/***************************************************************
+                ARDUINO ENTRY POINT / LOOP
+***************************************************************/
+
+/**
+ * @brief Runs one tick of the rate controller and sets the canards, or parks them in the flight phases without control; 
+ * the same amount of work every tick, the gains assume the tick is CONTROL_PERIOD_US
+ * (the coefficients are precomputed for the fixed period, so it takes no time step)
+ */
+void StabilizationSystem()
+{
+  PROFILE_SCOPE(PROFILE_CONTROL);
+  UpdateFlightPhase();
+  ScheduleGains(Flight::launched? (micros() - Flight::launch_time) / 1000UL : 0UL);
+  bool parked = !FLIGHT_PHASES[Flight::phase].control;
+#ifdef COMMAND_LINK
+  OverrideGains();
+  parked |= (Command::mode & COMMAND_MODE_HOLD) != 0;
+#endif
+#ifdef MATH_FIXED_POINT
+  if (parked) {
+    // the controller starts clean when it is back on
+    const int32_t neutral[4] = {0, 0, 0, 0};
+    ResetController();
+    SetCanardDeflections(neutral);
+    return;
+  }
+
+  int16_t rates[3];
+  GetBodyRates(rates);
+
+  Controller::torque[0] = PIDUpdate(Controller::gains[0], Controller::roll_rate, 0, rates[0]);
+  Controller::torque[1] = PIDUpdate(Controller::gains[1], Controller::pitch_rate, 0, rates[1]);
+  Controller::torque[2] = PIDUpdate(Controller::gains[2], Controller::yaw_rate, 0, rates[2]);
+
+  int32_t canards[4];
+  int32_t largest = 0;
+  for (int i = 0; i < 4; i++) {
+    canards[i] = CANARD_MIX[i][0] * Controller::torque[0] 
+      + CANARD_MIX[i][1] * Controller::torque[1] 
+      + CANARD_MIX[i][2] * Controller::torque[2];
+    int32_t magnitude = (canards[i] < 0)? -canards[i] : canards[i];
+    largest = (magnitude > largest)? magnitude : largest;
+  }
+  Controller::saturated = (largest > CANARD_MAX_DEFLECTION_Q);
+  if (Controller::saturated) {
+    // limit / largest * 2^15 from one divide; the shifts keep the scaled commands within 31 bits
+    int32_t scale = (CANARD_MAX_DEFLECTION_Q << 8) / (largest >> 7);
+    for (int i = 0; i < 4; i++) {
+      canards[i] = ((canards[i] >> 5) * scale) >> 10;
+    }
+  }
+  SetCanardDeflections(canards);
+#else
+  if (parked) {
+    // the controller starts clean when it is back on
+    float neutral[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    ResetController();
+    SetCanardRotations(neutral);
+    return;
+  }
+
+  float rates[3];
+  GetBodyRates(rates);
+
+  Controller::torque[0] = PIDUpdate(Controller::gains[0], Controller::roll_rate, 0.0f, rates[0]);
+  Controller::torque[1] = PIDUpdate(Controller::gains[1], Controller::pitch_rate, 0.0f, rates[1]);
+  Controller::torque[2] = PIDUpdate(Controller::gains[2], Controller::yaw_rate, 0.0f, rates[2]);
+
+  float canards[4];
+  float largest = 0.0f;
+  for (int i = 0; i < 4; i++) {
+    canards[i] = CANARD_MIX[i][0] * Controller::torque[0] 
+      + CANARD_MIX[i][1] * Controller::torque[1] 
+      + CANARD_MIX[i][2] * Controller::torque[2];
+    largest = (fabsf(canards[i]) > largest)? fabsf(canards[i]) : largest;
+  }
+  // past the limit all four are scaled down together, so the torque keeps its direction instead of 
+  // the clipped canards dropping whichever axis they carried
+  Controller::saturated = (largest > CANARD_MAX_DEFLECTION);
+  if (Controller::saturated) {
+    float scale = CANARD_MAX_DEFLECTION / largest;
+    for (int i = 0; i < 4; i++) {
+      canards[i] *= scale;
+    }
+  }
+  SetCanardRotations(canards);
+#endif
+}
+
+void SensorTask(float deltaTime)
+{
+#ifdef COMMAND_LINK
+  if (Command::mode & COMMAND_MODE_INJECT) {
+    ProcessInjectedSample(deltaTime);
+    return;
+  }
+#endif
+  SetOrientationFromSensors(deltaTime);
+}
+
+void ControlTask(float /*deltaTime*/)
+{
+  StabilizationSystem();
+}
+
+// send data to serial (if compiled to work with simulation)
+void TelemetryTask(float /*deltaTime*/)
+{
+  SendDataToSerial(ReportedState());
+}
+
+// Actuate the Canard fins (rotate servos) (if compiled to work with actual rocket)
+void ActuationTask(float /*deltaTime*/)
+{
+  UpdateActuators(Rocket::canard_pulses);
+}
+
+void StatusTask(float deltaTime);
+void CommandTask(float deltaTime);
+
+#ifdef PROFILE_ON
+// send the stats of the next stage and start them over
+void ProfileTask(float /*deltaTime*/)
+{
+  uint8_t stage = Profile::next_report;
+  Profile::next_report = (stage + 1) % PROFILE_STAGE_COUNT;
+  ProfileStats stats = Profile::stats[stage];
+  ProfileReset(Profile::stats[stage]);
+
+  uint32_t min_us = (stats.count > 0)? stats.min_cycles / CYCLES_PER_US : 0;
+  uint32_t mean_us = (stats.count > 0)? stats.total_cycles / stats.count / CYCLES_PER_US : 0;
+  uint32_t max_us = stats.max_cycles / CYCLES_PER_US;
+  uint16_t fields[4] = {
+    (uint16_t)((stats.count > 0xFFFF)? 0xFFFF : stats.count),
+    (uint16_t)((min_us > 0xFFFF)? 0xFFFF : min_us),
+    (uint16_t)((mean_us > 0xFFFF)? 0xFFFF : mean_us),
+    (uint16_t)((max_us > 0xFFFF)? 0xFFFF : max_us)
+  };
+#ifdef TELEMETRY_BINARY
+  uint8_t payload[1 + sizeof(fields) + sizeof(stats.histogram)];
+  static_assert(sizeof(payload) <= TELEMETRY_MAX_PAYLOAD, "the profile frame must fit a frame, take histogram buckets out");
+  payload[0] = stage;
+  memcpy(payload + 1, fields, sizeof(fields));
+  memcpy(payload + 1 + sizeof(fields), stats.histogram, sizeof(stats.histogram));
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t frame_len = BuildTelemetryFrame(frame, TELEMETRY_FRAME_PROFILE, payload, sizeof(payload));
+  TxEnqueue(frame, frame_len);
+#elif DEBUG
+  char line[TX_SLOT_BYTES];
+  int len = snprintf(line, sizeof(line), "# prof %u n %u us %u/%u/%u h", stage, fields[0], fields[1], fields[2], fields[3]);
+  for (uint8_t i = 0; i < PROFILE_BUCKETS && len < (int)sizeof(line); i++) {
+    len += snprintf(line + len, sizeof(line) - len, " %u", stats.histogram[i]);
+  }
+  if (len > (int)sizeof(line) - 3) {
+    len = sizeof(line) - 3;
+  }
+  line[len++] = '\r';
+  line[len++] = '\n';
+  TxEnqueue((const uint8_t*)line, len);
+#endif
+}
+#endif
+
+#ifdef FLIGHT_LOG
+// record the newest sample (every log_divider th of the flight phase, so the pad does not fill the chip) and move the flash writes along
+void LogTask(float /*deltaTime*/)
+{
+  PROFILE_SCOPE(PROFILE_LOG);
+  const RocketSnapshot& state = ReportedState();
+  if (!Log::full && Log::capacity > 0 && state.sample_count != Log::checked_sample_count) {
+    Log::checked_sample_count = state.sample_count;
+    if ((state.sample_count % FLIGHT_PHASES[state.phase].log_divider) == 0) {
+      LogRecordSample(state);
+    }
+  }
+  if (Log::capacity > 0) {
+    LogFlush();
+  }
+}
+#endif
+
+Task tasks[] = {
+  {SensorTask, SENSOR_PERIOD_US, 0, 0, 0},
+  {ControlTask, CONTROL_PERIOD_US, 0, 0, 0},
+#if SIM_MODE_ON
+  {TelemetryTask, TELEMETRY_PERIOD_US, 0, 0, 0},
+#else
+  {ActuationTask, ACTUATION_PERIOD_US, 0, 0, 0},
+#endif
+#ifdef FLIGHT_LOG
+  {LogTask, LOG_PERIOD_US, 0, 0, 0},
+#endif
+#ifdef PROFILE_ON
+  {ProfileTask, PROFILE_PERIOD_US, 0, 0, 0},
+#endif
+#ifdef COMMAND_LINK
+  {CommandTask, COMMAND_PERIOD_US, 0, 0, 0},
+#endif
+  {StatusTask, STATUS_PERIOD_US, 0, 0, 0}
+};
+const size_t TASK_COUNT = sizeof(tasks) / sizeof(Task);
+// the first tasks are the control path, DUAL_CORE runs them on a core of their own
+const size_t CONTROL_TASK_COUNT = BuildConfig::SIM_MODE? 2 : 3; // sensor, control and (on the rocket) actuation
+
+/**
+ * @brief Sets the periods of tasks first to last - 1 to the rates of the flight phase,
+ * and the slew limit to the actuation task's new period so the canards move as fast in every phase
+ * @param phase The FLIGHT_PHASE
+ * @param first The first task
+ * @param last One past the last task
+ */
+void ApplyPhaseRates(uint8_t phase, size_t first, size_t last)
+{
+  const PhaseConfig& config = FLIGHT_PHASES[phase];
+  for (size_t i = first; i < last; i++) {
+    if (tasks[i].run == SensorTask || tasks[i].run == ControlTask || tasks[i].run == ActuationTask) {
+      tasks[i].period = config.sample_us;
+      if (tasks[i].run == ActuationTask) {
+        Actuator::slew_ticks = SlewTicks(config.sample_us);
+      }
+    } else if (tasks[i].run == TelemetryTask) {
+      tasks[i].period = config.telemetry_us;
+    }
+  }
+}
+
+/** 
+ * @brief namespace that holds the flight phase each core last set its task rates for
+ */
+namespace PhaseRates {
+  uint8_t control = FLIGHT_PHASE_COUNT; // none yet, the first pass sets them
+  uint8_t report = FLIGHT_PHASE_COUNT;
+}
+
+#ifdef COMMAND_LINK
+/**
+ * @brief Carries out a command
+ * @param frame The frame of the command, crc already checked
+ * @return The COMMAND_RESULT
+ */
+uint8_t ApplyCommand(const uint8_t* frame)
+{
+  uint8_t type = frame[2];
+  uint8_t len = frame[3];
+  const uint8_t* payload = frame + TELEMETRY_HEADER_SIZE;
+  if (type == COMMAND_FRAME_IMU) {
+    if (len != 3 * sizeof(Command::sample.accRaw)) {
+      return COMMAND_RESULT_BAD_PAYLOAD;
+    }
+    memcpy(Command::sample.accRaw, payload, sizeof(Command::sample.accRaw));
+    memcpy(Command::sample.gyrRaw, payload + 6, sizeof(Command::sample.gyrRaw));
+    memcpy(Command::sample.magRaw, payload + 12, sizeof(Command::sample.magRaw));
+    ScaleRawSample(Command::sample);
+    Command::sample.timestamp = micros(); // the board's clock, launch detection and the gains run on it
+    Command::sample_pending = true;
+    return COMMAND_RESULT_OK;
+  }
+  if (type == COMMAND_FRAME_GAINS) {
+    if (len != 1 + 3 * sizeof(float)) {
+      return COMMAND_RESULT_BAD_PAYLOAD;
+    }
+    uint8_t axis = payload[0];
+    float kpid[3];
+    memcpy(kpid, payload + 1, sizeof(kpid));
+    if (axis == 0xFF) {
+      memset(Command::gains_set, 0, sizeof(Command::gains_set));
+      return COMMAND_RESULT_OK;
+    }
+    if (axis > 2 || !(kpid[0] >= 0.0f && kpid[1] >= 0.0f && kpid[2] >= 0.0f)) {
+      return COMMAND_RESULT_BAD_PAYLOAD;
+    }
+#ifdef MATH_FIXED_POINT
+    // the fixed-point coefficients only hold so much, see PID_MAX_KP
+    if (kpid[0] * GYR_RAD_PER_LSB * (1UL << PID_KP_Q) > PID_MAX_KP 
+        || kpid[1] * (CONTROL_PERIOD_US / 1000000.0f) * GYR_RAD_PER_LSB * (float)(1ULL << PID_KI_Q) > PID_MAX_KI
+        || kpid[2] / (CONTROL_PERIOD_US / 1000000.0f) * GYR_RAD_PER_LSB * (1UL << PID_KP_Q) > PID_MAX_KD) {
+      return COMMAND_RESULT_BAD_PAYLOAD;
+    }
+#endif
+    RateGains gains = RATE_GAINS(kpid[0], kpid[1], kpid[2]);
+    Command::gains[axis] = gains;
+    Command::gains_set[axis] = true;
+    return COMMAND_RESULT_OK;
+  }
+  if (type == COMMAND_FRAME_TELEMETRY_RATE) {
+    uint32_t period;
+    if (len != sizeof(period)) {
+      return COMMAND_RESULT_BAD_PAYLOAD;
+    }
+    memcpy(&period, payload, sizeof(period));
+    if (period < COMMAND_MIN_TELEMETRY_PERIOD_US) {
+      return COMMAND_RESULT_BAD_PAYLOAD;
+    }
+    for (size_t i = 0; i < TASK_COUNT; i++) {
+      if (tasks[i].run == TelemetryTask) {
+        tasks[i].period = period;
+        return COMMAND_RESULT_OK;
+      }
+    }
+    return COMMAND_RESULT_UNSUPPORTED; // no telemetry task without SIM_MODE_ON
+  }
+  if (type == COMMAND_FRAME_MODE) {
+    if (len != 1 || (payload[0] & ~COMMAND_MODE_ALL) != 0) {
+      return COMMAND_RESULT_BAD_PAYLOAD;
+    }
+#ifdef ICM_DMP_MODE
+    if (payload[0] & COMMAND_MODE_INJECT) {
+      return COMMAND_RESULT_UNSUPPORTED; // the DMP fuses inside the ICM, there is nothing to inject raw samples into
+    }
+#endif
+    if ((payload[0] ^ Command::mode) & COMMAND_MODE_INJECT) {
+      Command::sample_pending = false;
+      RestartEstimate();
+    }
+    Command::mode = payload[0];
+    return COMMAND_RESULT_OK;
+  }
+#ifdef TELEMETRY_DELTA
+  if (type == COMMAND_FRAME_TELEMETRY_FIELDS) {
+    if (len != 1 + TELEMETRY_FIELD_COUNT || payload[0] >= (1 << TELEMETRY_FIELD_COUNT) || memchr(payload + 1, 0, TELEMETRY_FIELD_COUNT) != NULL) {
+      return COMMAND_RESULT_BAD_PAYLOAD;
+    }
+    TelemetryDelta::mask = payload[0];
+    memcpy(TelemetryDelta::divider, payload + 1, TELEMETRY_FIELD_COUNT);
+    TelemetryDelta::frames_to_key = 0; // fields the sim had no value of yet
+    return COMMAND_RESULT_OK;
+  }
+#endif
+  return COMMAND_RESULT_UNSUPPORTED;
+}
+
+// parse the bytes that came in since the last run and carry out the commands they complete
+void CommandTask(float /*deltaTime*/)
+{
+  int available = Serial.available();
+  if (available > COMMAND_MAX_BYTES_PER_RUN) {
+    available = COMMAND_MAX_BYTES_PER_RUN;
+  }
+  for (int i = 0; i < available; i++) {
+    if (!ParseCommandByte((uint8_t)Serial.read())) {
+      continue;
+    }
+    uint8_t result = ApplyCommand(Command::frame);
+    if (Command::frame[2] != COMMAND_FRAME_IMU) {
+      SendCommandAck(Command::frame[2], Command::frame[4], result);
+    }
+  }
+}
+#endif
+
+/**
+ * @brief Reports the task overruns and dropped frames; as a status frame in binary mode
+ * (only a status frame every STATUS_PERIOD_US, it is small) or as a text line when debugging
+ */
+void StatusTask(float /*deltaTime*/)
+{
+#ifdef TELEMETRY_BINARY
+  // payload: uint16 frames dropped, uint16 fifo overflows, uint16 overruns per task in task order,
+  // then uint16 servo commits and suppressed servo writes, then uint16 last and longest ICM read (us),
+  // then uint16 FLIGHT_PHASE, then with TELEMETRY_DELTA uint16 STATE_Q12 bytes per delta frame byte * 100
+#ifdef TELEMETRY_DELTA
+  uint16_t status[8 + TASK_COUNT];
+  status[7 + TASK_COUNT] = TelemetryCompressionPercent();
+#else
+  uint16_t status[7 + TASK_COUNT];
+#endif
+  // the fields add up with the options turned on; past TELEMETRY_MAX_PAYLOAD the status needs a second frame type
+  static_assert(sizeof(status) <= TELEMETRY_MAX_PAYLOAD, "the status frame must fit a frame");
+  status[6 + TASK_COUNT] = ReportedPhase();
+  status[0] = (TxQueue::dropped > 0xFFFF)? 0xFFFF : (uint16_t)TxQueue::dropped;
+  status[1] = (Sensor::fifo_overflows > 0xFFFF)? 0xFFFF : (uint16_t)Sensor::fifo_overflows;
+  for (size_t i = 0; i < TASK_COUNT; i++) {
+    status[2 + i] = (tasks[i].overruns > 0xFFFF)? 0xFFFF : (uint16_t)tasks[i].overruns;
+  }
+  status[2 + TASK_COUNT] = (Actuator::commits > 0xFFFF)? 0xFFFF : (uint16_t)Actuator::commits;
+  status[3 + TASK_COUNT] = (Actuator::suppressed > 0xFFFF)? 0xFFFF : (uint16_t)Actuator::suppressed;
+  status[4 + TASK_COUNT] = (Sensor::read_us > 0xFFFF)? 0xFFFF : (uint16_t)Sensor::read_us;
+  status[5 + TASK_COUNT] = (Sensor::max_read_us > 0xFFFF)? 0xFFFF : (uint16_t)Sensor::max_read_us;
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t frame_len = BuildTelemetryFrame(frame, TELEMETRY_FRAME_STATUS, status, sizeof(status));
+  TxEnqueue(frame, frame_len);
+#elif DEBUG
+  char line[TX_SLOT_BYTES];
+  int len = snprintf(line, sizeof(line), "# status phase %u dropped %lu fifo %lu overruns", ReportedPhase(), TxQueue::dropped, Sensor::fifo_overflows);
+  for (size_t i = 0; i < TASK_COUNT && len < (int)sizeof(line); i++) {
+    len += snprintf(line + len, sizeof(line) - len, " %lu", tasks[i].overruns);
+  }
+  if (len < (int)sizeof(line)) {
+    len += snprintf(line + len, sizeof(line) - len, " servo %lu/%lu", Actuator::commits, Actuator::suppressed);
+  }
+  if (len < (int)sizeof(line)) {
+    len += snprintf(line + len, sizeof(line) - len, " read %lu/%lu", Sensor::read_us, Sensor::max_read_us);
+  }
+#ifdef DUAL_CORE
+  if (len < (int)sizeof(line)) {
+    len += snprintf(line + len, sizeof(line) - len, " retries %lu", Snapshot::retries);
+  }
+#endif
+  if (len > (int)sizeof(line) - 3) {
+    len = sizeof(line) - 3;
+  }
+  line[len++] = '\r';
+  line[len++] = '\n';
+  TxEnqueue((const uint8_t*)line, len);
+#endif
+}
+
+/** @brief One pass over the control path tasks, with DUAL_CORE their state is published if one of them ran */
+void RunControlTasks()
+{
+  if (PhaseRates::control != Flight::phase) {
+    PhaseRates::control = Flight::phase;
+    ApplyPhaseRates(Flight::phase, 0, CONTROL_TASK_COUNT);
+  }
+  bool ran = false;
+  for (size_t i = 0; i < CONTROL_TASK_COUNT; i++) {
+    ran |= RunTaskIfDue(tasks[i]);
+  }
+#ifdef DUAL_CORE
+  if (ran) {
+    PublishSnapshot();
+  }
+#else
+  (void)ran;
+#endif
+}
+
+/** @brief One pass over the telemetry, log and status tasks, then the serial link */
+void RunReportTasks()
+{
+  uint8_t phase = ReportedPhase();
+  if (PhaseRates::report != phase) {
+    PhaseRates::report = phase;
+    ApplyPhaseRates(phase, CONTROL_TASK_COUNT, TASK_COUNT);
+  }
+  for (size_t i = CONTROL_TASK_COUNT; i < TASK_COUNT; i++) {
+    RunTaskIfDue(tasks[i]);
+  }
+  {
+    PROFILE_SCOPE(PROFILE_TX_PUMP);
+    TxPump();
+  }
+}
+
+
+/***************************************************************
+                        DUAL CORE
+***************************************************************/
+// DUAL_CORE gives the control path (the first CONTROL_TASK_COUNT tasks) a core of its own and runs the rest 
+// on the other one; the only state that crosses over is the snapshot of CORE HANDOFF (and the counters
+// StatusTask prints, which are single words), so serial formatting and flash writes cannot hold up a control tick
+#if defined(DUAL_CORE) && defined(ESP32)
+const BaseType_t CONTROL_CORE = 0;       // loop() and the Arduino core stay on core 1
+const UBaseType_t CONTROL_TASK_PRIORITY = configMAX_PRIORITIES - 1;
+const uint32_t CONTROL_TASK_STACK = 8192; // bytes
+
+/** @brief The control core of the ESP32, runs the control path in a busy loop above everything else on core 0 */
+void ControlCoreTask(void* /*unused*/)
+{
+  for (;;) {
+    RunControlTasks();
+  }
+}
+
+/** @brief Starts ControlCoreTask on CONTROL_CORE */
+void StartControlCore()
+{
+  // the busy loop never lets the idle task of core 0 run, its watchdog would reset the board
+  disableCore0WDT();
+  xTaskCreatePinnedToCore(ControlCoreTask, "control", CONTROL_TASK_STACK, NULL, CONTROL_TASK_PRIORITY, NULL, CONTROL_CORE);
+}
+#elif defined(DUAL_CORE)
+// the RP2040 core runs setup() and loop() on core 0 and setup1() and loop1() on core 1 at the same time,
+// with no scheduler on either, so the control path simply has core 0 to itself
+void setup1() {}
+
+/** @brief The reporting core of the RP2040, waits until setup() on core 0 is done */
+void loop1()
+{
+  if (!Snapshot::started.load(std::memory_order_acquire)) {
+    return;
+  }
+  RunReportTasks();
+}
+#endif
+
+void setup() {
+  // initalize serial and wire
+  Serial.begin(BuildConfig::BAUD);
+  while (!Serial)
+    ;
+  StartCycleCounter();
+
+#ifdef FLIGHT_LOG
+  if (!LogBegin() && BuildConfig::DEBUG_MESSAGES) {
+    Serial.println("No log flash found, not logging");
+  }
+  #ifdef LOG_DUMP_MODE
+    return; // only the log commands run in loop()
+  #endif
+#endif
+
+  Icm::Begin();
+
+  bool init = false;
+  while (!init) {
+    Icm::Connect(ICM_Obj);
+    if (ICM_Obj.status != ICM_20948_Stat_Ok) {
+      if (BuildConfig::DEBUG_MESSAGES) {
+        Serial.println("Failed to init ICM, trying again...");
+      }
+      delay(100);
+    } else {
+      init = true;
+    }
+  }
+  LoadCalibration();
+
+#ifdef BENCH_MODE_ON
+  BenchHeader();
+  RunMathBenchmarks();
+  RunHotPathBenchmarks();
+  return;
+#endif
+
+#ifdef CALIBRATION_MODE
+  RunCalibration();
+  return;
+#endif
+
+#ifdef ICM_FIFO_MODE
+  ConfigureFIFO();
+#endif
+
+#ifdef ICM_DMP_MODE
+  while (!ConfigureDMP()) {
+    if (BuildConfig::DEBUG_MESSAGES) {
+      Serial.println("Failed to start the DMP, trying again...");
+    }
+    delay(100);
+  }
+#endif
+
+#ifdef ICM_DRDY_INTERRUPT
+  // INT pin goes low on each new sample and stays latched until cleared, so a sample is never missed
+  // just because the main loop was busy
+  ICM_Obj.cfgIntActiveLow(true);
+  ICM_Obj.cfgIntOpenDrain(false);
+  ICM_Obj.cfgIntLatch(true);
+  ICM_Obj.intEnableRawDataReady(true);
+  pinMode(ICM_INT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(ICM_INT_PIN), ICM_DataReadyISR, FALLING);
+#endif
+
+  if (!BuildConfig::SIM_MODE) {
+    ConfigureServos();
+  }
+
+#ifdef PROFILE_ON
+  for (uint8_t i = 0; i < PROFILE_STAGE_COUNT; i++) {
+    ProfileReset(Profile::stats[i]);
+  }
+#endif
+
+#ifdef TELEMETRY_DELTA
+  TelemetryDeltaBegin();
+#endif
+
+  // first run of every task is now, so each one gets its dt from here
+  StartTasks(tasks, TASK_COUNT);
+
+#ifdef DUAL_CORE
+  PublishSnapshot(); // the reporting core starts from the state as it is now
+  Snapshot::started.store(true, std::memory_order_release);
+  #ifdef ESP32
+    StartControlCore();
+  #endif
+#endif
+}
+
+
+void loop() {
+#ifdef BENCH_MODE_ON
+  return; // the benchmarks ran once in setup
+#endif
+#ifdef LOG_DUMP_MODE
+  LogDumpCommands();
+  return;
+#endif
+#ifdef CALIBRATION_MODE
+  return; // the calibration ran once in setup
+#endif
+
+#if defined(DUAL_CORE) && defined(ARDUINO_ARCH_RP2040)
+  RunControlTasks(); // loop() is core 0, loop1() runs the rest on core 1
+#elif defined(DUAL_CORE)
+  RunReportTasks();  // loop() is core 1 of the ESP32, ControlCoreTask runs the control path on core 0
+#else
+  PROFILE_SCOPE(PROFILE_LOOP);
+  // no delay, the tasks keep their own rates and the time in between goes to the serial link
+  RunControlTasks();
+  RunReportTasks();
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Compares two BENCH_MODE_ON captures.
+
+Build the sketch with BENCH_MODE_ON, open the port at the sketch's baud and save what
+comes back after reset to a file, once for a known good build and once for the new one:
+
+    python3 tools/compare_bench.py good.txt new.txt
+
+Prints every benchmark of the new capture next to the good one and exits 1 if one got
+slower than --max-slowdown (a ratio) or its error grew, so a costlier loop shows up
+here instead of in flight. Only captures from the same board are compared.
+"""
+import argparse
+import sys
+
+
+def read_capture(path):
+    """Returns (board, {name: (calls, cycles per call, max error)}) of a capture."""
+    board = None
+    results = {}
+    with open(path, "r", errors="replace") as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if fields[0] == "bench_board" and len(fields) >= 4:
+                board = tuple(fields[1:4])
+            elif fields[0] == "bench" and len(fields) >= 5 and fields[1] != "name":
+                try:
+                    results[fields[1]] = (int(fields[2]), float(fields[3]), float(fields[4]))
+                except ValueError:
+                    print("compare_bench: skipping line %r of %s" % (line.strip(), path), file=sys.stderr)
+    return board, results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("good", help="capture of the known good build")
+    parser.add_argument("new", help="capture of the build to check")
+    parser.add_argument("--max-slowdown", type=float, default=1.10,
+                        help="largest new / good cycles per call allowed (default 1.10)")
+    args = parser.parse_args()
+
+    good_board, good = read_capture(args.good)
+    new_board, new = read_capture(args.new)
+    if not new:
+        print("compare_bench: no results in %s" % args.new, file=sys.stderr)
+        return 2
+    if good_board != new_board:
+        print("compare_bench: %s is from %s, %s from %s, the cycles do not compare"
+              % (args.good, good_board, args.new, new_board), file=sys.stderr)
+        return 2
+
+    failed = False
+    print("name,good_cycles,new_cycles,ratio,good_error,new_error,result")
+    for name, (calls, cycles, error) in new.items():
+        if name not in good:
+            print("%s,,%.1f,,,%g,new" % (name, cycles, error))
+            continue
+        _, good_cycles, good_error = good[name]
+        ratio = cycles / good_cycles if good_cycles > 0 else 1.0
+        result = "ok"
+        if ratio > args.max_slowdown:
+            result = "slower"
+        elif error > good_error * 1.01 + 1e-7:
+            result = "less accurate"
+        failed |= result != "ok"
+        print("%s,%.1f,%.1f,%.3f,%g,%g,%s" % (name, good_cycles, cycles, ratio, good_error, error, result))
+    for name in good:
+        if name not in new:
+            print("%s,%.1f,,,%g,,missing" % (name, good[name][1], good[name][2]))
+            failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
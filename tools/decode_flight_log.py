@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Decodes a FLIGHT_LOG dump into CSV.
+
+Capture the dump with the board built with FLIGHT_LOG and LOG_DUMP_MODE: open the
+port at 250000 baud, send 'd' and save everything that comes back to a file, then
+
+    python3 tools/decode_flight_log.py dump.bin > flight.csv
+
+The page and record layout must match LogPageHeader / LogRecord in main.cpp.
+"""
+import argparse
+import struct
+import sys
+
+PAGE_BYTES = 256
+HEADER = struct.Struct("<HBBHH")           # seq, boot, count, dropped, crc
+RECORD = struct.Struct("<I3h3h3h4h4hH")     # timestamp, acc, gyr, mag, attitude, canards, loop_us
+RECORDS_PER_PAGE = (PAGE_BYTES - HEADER.size) // RECORD.size
+
+# the scales main.cpp logs with
+ACC_LSB_PER_MG = 16.384
+GYR_LSB_PER_DPS = 131.0
+MAG_UT_PER_LSB = 0.15
+ATTITUDE_SCALE = 16384.0
+CANARD_SCALE = 4096.0
+
+COLUMNS = (["boot", "seq", "timestamp_us", "loop_us"]
+           + ["acc_%s_mg" % a for a in "xyz"]
+           + ["gyr_%s_dps" % a for a in "xyz"]
+           + ["mag_%s_ut" % a for a in "xyz"]
+           + ["q_%s" % c for c in "wxyz"]
+           + ["canard_%d_rad" % i for i in range(1, 5)])
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC16-CCITT, the same as Crc16 in main.cpp."""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def pages(data):
+    for offset in range(0, len(data) - PAGE_BYTES + 1, PAGE_BYTES):
+        yield data[offset:offset + PAGE_BYTES]
+
+
+def decode(data, out, raw=False):
+    """Writes the records as CSV, returns (pages, records, bad pages, dropped records)."""
+    out.write(",".join(COLUMNS) + "\n")
+    page_count = record_count = bad = dropped = 0
+    all_pages = list(pages(data))
+    for index, page in enumerate(all_pages):
+        seq, boot, count, page_dropped, crc = HEADER.unpack_from(page)
+        if seq == 0xFFFF:
+            break  # erased, the end of the log
+        page_count += 1
+        body = page[HEADER.size:HEADER.size + count * RECORD.size]
+        if count > RECORDS_PER_PAGE or crc16(body, crc16(page[:HEADER.size - 2])) != crc:
+            if index + 1 == len(all_pages) or all_pages[index + 1][:2] == b"\xff\xff":
+                # the last page, the power went off while it was being written
+                sys.stderr.write("page %d: torn, the end of the log\n" % seq)
+                page_count -= 1
+                break
+            bad += 1
+            sys.stderr.write("page %d: bad crc, skipped\n" % seq)
+            continue
+        dropped += page_dropped
+        for i in range(count):
+            f = RECORD.unpack_from(body, i * RECORD.size)
+            timestamp, acc, gyr, mag = f[0], f[1:4], f[4:7], f[7:10]
+            attitude, canards, loop_us = f[10:14], f[14:18], f[18]
+            if not raw:
+                acc = ["%.2f" % (v / ACC_LSB_PER_MG) for v in acc]
+                gyr = ["%.3f" % (v / GYR_LSB_PER_DPS) for v in gyr]
+                mag = ["%.2f" % (v * MAG_UT_PER_LSB) for v in mag]
+                attitude = ["%.5f" % (v / ATTITUDE_SCALE) for v in attitude]
+                canards = ["%.5f" % (v / CANARD_SCALE) for v in canards]
+            row = [boot, seq, timestamp, "" if loop_us == 0xFFFF else loop_us]
+            out.write(",".join(str(v) for v in row + list(acc) + list(gyr) + list(mag)
+                               + list(attitude) + list(canards)) + "\n")
+            record_count += 1
+    return page_count, record_count, bad, dropped
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", help="raw dump from LOG_DUMP_MODE")
+    parser.add_argument("--raw", action="store_true", help="keep the sensor counts and fixed point values unscaled")
+    parser.add_argument("--boot", type=int, help="only decode this boot id")
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        data = f.read()
+    if args.boot is not None:
+        data = b"".join(p for p in pages(data) if p[2] == args.boot or p[:2] == b"\xff\xff")
+
+    page_count, record_count, bad, dropped = decode(data, sys.stdout, args.raw)
+    sys.stderr.write("%d pages, %d records, %d bad pages, %d records dropped on the board\n"
+                     % (page_count, record_count, bad, dropped))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""Decodes the binary telemetry stream into CSV.
+
+Capture what the board sends when built with TELEMETRY_BINARY (500000 baud), or take the
+--serial-out file of the host build, then
+
+    python3 tools/decode_telemetry.py telemetry.bin > state.csv
+
+Writes a row per state frame (STATE_F32, STATE_Q12 or STATE_DELTA) and exits 1 if a frame
+had a bad crc or a key frame of a delta stream did not line up with the decoded values
+(more than --max-key-jump from them), which is what a broken encoder looks like.
+The frame layout must match TELEMETRY FRAMES / TELEMETRY DELTA in main.cpp.
+"""
+import argparse
+import math
+import struct
+import sys
+
+SYNC = b"\xaa\x55"
+HEADER = struct.Struct("<BBBI")           # type, payload length, seq, timestamp (after the sync word)
+HEADER_SIZE = 2 + HEADER.size
+CRC_SIZE = 2
+MAX_PAYLOAD = 32
+
+FRAME_STATE_F32 = 0x01
+FRAME_STATE_Q12 = 0x02
+FRAME_STATE_DELTA = 0x06
+KEY_FLAG = 0x80
+FIELDS = 7
+Q12_SCALE = 4096.0
+STATE_Q12_FRAME = HEADER_SIZE + 2 * FIELDS + CRC_SIZE
+ANGLE_FIELDS = 3                            # pitch, roll and yaw wrap at 2 pi, the canards do not
+TWO_PI_Q12 = 2.0 * math.pi * Q12_SCALE
+
+COLUMNS = ["seq", "timestamp_us", "type", "pitch_rad", "roll_rad", "yaw_rad"] + ["canard_%d_rad" % i for i in range(1, 5)]
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC16-CCITT, the same as Crc16 in main.cpp."""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def frames(data, stats):
+    """Yields (type, seq, timestamp, payload) of every frame with a good crc."""
+    i = 0
+    while True:
+        i = data.find(SYNC, i)
+        if i < 0 or i + HEADER_SIZE > len(data):
+            return
+        kind, length, seq, timestamp = HEADER.unpack_from(data, i + 2)
+        end = i + HEADER_SIZE + length
+        if length > MAX_PAYLOAD or end + CRC_SIZE > len(data):
+            i += 1
+            continue
+        crc, = struct.unpack_from("<H", data, end)
+        if crc16(data[i + 2:end]) != crc:
+            stats["bad"] += 1
+            i += 1
+            continue
+        yield kind, seq, timestamp, data[i + HEADER_SIZE:end]
+        stats["bytes_" + ("delta" if kind == FRAME_STATE_DELTA else "other")] += end + CRC_SIZE - i
+        i = end + CRC_SIZE
+
+
+def zigzag_varints(payload, count):
+    """Reads count zigzag varints, returns them and the bytes left over (None if the payload is short)."""
+    values = []
+    pos = 0
+    for _ in range(count):
+        zigzag = shift = 0
+        while True:
+            if pos >= len(payload):
+                return None, None
+            byte = payload[pos]
+            pos += 1
+            zigzag |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        values.append((zigzag >> 1) ^ -(zigzag & 1))
+    return values, payload[pos:]
+
+
+def to_int16(value):
+    return ((value + 0x8000) & 0xFFFF) - 0x8000
+
+
+def jump(field, new, old):
+    """How far (Q12 LSB) a field moved from old to new, the short way around for the angles."""
+    change = to_int16(new - old)
+    if field < ANGLE_FIELDS:
+        change = (change + 0.5 * TWO_PI_Q12) % TWO_PI_Q12 - 0.5 * TWO_PI_Q12
+    return abs(change)
+
+
+def decode(data, out, max_key_jump):
+    """Writes the state rows as CSV, returns the stats."""
+    stats = {"frames": 0, "bad": 0, "state": 0, "delta": 0, "keys": 0, "gaps": 0, "mismatches": 0,
+             "bytes_delta": 0, "bytes_other": 0}
+    out.write(",".join(COLUMNS) + "\n")
+    values = [None] * FIELDS  # the delta stream as decoded so far, int16 Q12
+    synced = False            # a key frame came in and no frame was lost since
+    last_seq = None
+    for kind, seq, timestamp, payload in frames(data, stats):
+        stats["frames"] += 1
+        if last_seq is not None and seq != (last_seq + 1) & 0xFF:
+            stats["gaps"] += 1
+            synced = False
+        last_seq = seq
+
+        if kind == FRAME_STATE_F32 and len(payload) == 4 * FIELDS:
+            row = ["%.5f" % v for v in struct.unpack("<%df" % FIELDS, payload)]
+        elif kind == FRAME_STATE_Q12 and len(payload) == 2 * FIELDS:
+            row = ["%.5f" % (v / Q12_SCALE) for v in struct.unpack("<%dh" % FIELDS, payload)]
+        elif kind == FRAME_STATE_DELTA and len(payload) >= 1:
+            flags = payload[0]
+            fields = [i for i in range(FIELDS) if flags & (1 << i)]
+            read, rest = zigzag_varints(payload[1:], len(fields))
+            if read is None or rest:
+                stats["bad"] += 1
+                synced = False
+                continue
+            stats["delta"] += 1
+            if flags & KEY_FLAG:
+                stats["keys"] += 1
+                for i, value in zip(fields, read):
+                    if synced and values[i] is not None and jump(i, value, values[i]) > max_key_jump * Q12_SCALE:
+                        stats["mismatches"] += 1
+                        sys.stderr.write("seq %d: key frame field %d is %d, decoded %d\n" % (seq, i, value, values[i]))
+                    values[i] = value
+                synced = True
+            elif synced:
+                for i, change in zip(fields, read):
+                    if values[i] is not None:
+                        values[i] = to_int16(values[i] + change)
+            if not synced:
+                continue
+            row = ["" if v is None else "%.5f" % (v / Q12_SCALE) for v in values]
+        else:
+            continue
+        stats["state"] += 1
+        out.write(",".join([str(seq), str(timestamp), "%d" % kind] + row) + "\n")
+    return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="bytes the board sent")
+    parser.add_argument("--max-key-jump", type=float, default=0.1,
+                        help="largest change (rad) a key frame may make to a decoded field (default 0.1)")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        data = f.read()
+    stats = decode(data, sys.stdout, args.max_key_jump)
+    sys.stderr.write("%d frames, %d bad, %d state rows, %d sequence gaps" % (stats["frames"], stats["bad"], stats["state"], stats["gaps"]))
+    if stats["delta"]:
+        sys.stderr.write(", %d delta frames (%d key) in %d bytes, %.2fx smaller than STATE_Q12, %d key mismatches"
+                         % (stats["delta"], stats["keys"], stats["bytes_delta"],
+                            stats["delta"] * STATE_Q12_FRAME / max(stats["bytes_delta"], 1), stats["mismatches"]))
+    sys.stderr.write("\n")
+    return 1 if stats["bad"] or stats["mismatches"] else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Reports the flash and RAM each configuration of main.cpp takes.
+
+Builds main.cpp once per --config (name=defines) and prints a CSV row of its section sizes:
+
+    python3 tools/size_report.py --config default= --config fixed="-DMATH_FIXED_POINT -DTELEMETRY_BINARY"
+
+By default the sketch is built with the host compiler against host/stubs, which shows what a
+toggle adds or takes away but not the bytes a board has; for those point it at the board's
+toolchain and the include paths of the Arduino core and libraries, e.g.
+
+    python3 tools/size_report.py --cxx avr-g++ --size avr-size \\
+        --cxxflags "-std=gnu++11 -Os -mmcu=atmega2560 -DF_CPU=16000000L -DARDUINO_AVR_MEGA2560 -I<core> -I<libraries> -include Arduino.h" ...
+
+flash is text + data (the initialized data is stored in flash), ram is data + bss; neither counts the stack.
+The sizes are of the object file, so a function nothing calls still counts until the board's link drops it.
+make -C host size reports every configuration make check builds.
+"""
+import argparse
+import os
+import shlex
+import subprocess
+import sys
+import tempfile
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DEFAULT_CXXFLAGS = "-std=gnu++11 -Os -ffunction-sections -fdata-sections -I%s -include Arduino.h" % os.path.join(REPO, "host", "stubs")
+
+
+def section_sizes(size_tool, obj):
+    """Returns (text, data, bss) of an object file, from the Berkeley output of size."""
+    out = subprocess.run([size_tool, obj], check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    fields = out.splitlines()[1].split()
+    return int(fields[0]), int(fields[1]), int(fields[2])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--config", action="append", default=[], metavar="NAME=DEFINES",
+                        help="a configuration to build, may be given more than once (default: default=)")
+    parser.add_argument("--cxx", default=os.environ.get("CXX", "g++"), help="compiler (default $CXX or g++)")
+    parser.add_argument("--cxxflags", default=DEFAULT_CXXFLAGS, help="flags of every build (default: host stubs, -Os)")
+    parser.add_argument("--size", default="size", help="size tool of the toolchain (default size)")
+    parser.add_argument("--source", default=os.path.join(REPO, "main.cpp"), help="sketch to build (default main.cpp)")
+    args = parser.parse_args()
+
+    configs = []
+    for config in args.config or ["default="]:
+        name, sep, defines = config.partition("=")
+        if not sep or not name:
+            parser.error("--config %r is not NAME=DEFINES" % config)
+        configs.append((name, defines))
+
+    failed = False
+    print("config,text,data,bss,flash,ram")
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, defines in configs:
+            obj = os.path.join(tmp, name + ".o")
+            cmd = [args.cxx] + shlex.split(args.cxxflags) + shlex.split(defines) + ["-x", "c++", "-c", args.source, "-o", obj]
+            build = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+            if build.returncode != 0:
+                sys.stderr.write("size_report: %s does not build:\n%s" % (name, build.stdout))
+                failed = True
+                continue
+            text, data, bss = section_sizes(args.size, obj)
+            print("%s,%d,%d,%d,%d,%d" % (name, text, data, bss, text + data, data + bss))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())